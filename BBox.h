@@ -0,0 +1,110 @@
+/*
+ * BBox.h
+ * Axis aligned bounding box used by the bounding volume hierarchy
+ */
+
+#pragma once
+
+#include "GeomX.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+struct BBox {
+  double min[3];
+  double max[3];
+
+  // An empty box, which grows to fit whatever is added to it
+  BBox() {
+    for (int a = 0; a < 3; a++) {
+      min[a] = numeric_limits<double>::infinity();
+      max[a] = -numeric_limits<double>::infinity();
+    }
+  }
+
+  BBox(Point3 p1, Point3 p2) : BBox() {
+    grow(p1);
+    grow(p2);
+  }
+
+  void grow(Point3 p) {
+    double c[3] = {p.getX(), p.getY(), p.getZ()};
+    for (int a = 0; a < 3; a++) {
+      min[a] = std::min(min[a], c[a]);
+      max[a] = std::max(max[a], c[a]);
+    }
+  }
+
+  void grow(const BBox &b) {
+    for (int a = 0; a < 3; a++) {
+      min[a] = std::min(min[a], b.min[a]);
+      max[a] = std::max(max[a], b.max[a]);
+    }
+  }
+
+  // Widens the box in every direction, flat shapes such as squares
+  // would otherwise have no thickness to hit
+  void pad(double amount) {
+    for (int a = 0; a < 3; a++) {
+      min[a] -= amount;
+      max[a] += amount;
+    }
+  }
+
+  bool empty() const { return min[0] > max[0]; }
+
+  double centre(int axis) const { return (min[axis] + max[axis]) / 2; }
+
+  // The axis the box is longest along
+  int longestAxis() const {
+    double ex = max[0] - min[0];
+    double ey = max[1] - min[1];
+    double ez = max[2] - min[2];
+    if (ex >= ey && ex >= ez)
+      return 0;
+    return ey >= ez ? 1 : 2;
+  }
+
+  double surfaceArea() const {
+    if (empty())
+      return 0;
+    double ex = max[0] - min[0];
+    double ey = max[1] - min[1];
+    double ez = max[2] - min[2];
+    return 2 * (ex * ey + ey * ez + ez * ex);
+  }
+
+  bool contains(Point3 p) const {
+    double c[3] = {p.getX(), p.getY(), p.getZ()};
+    for (int a = 0; a < 3; a++) {
+      if (c[a] < min[a] || c[a] > max[a])
+        return false;
+    }
+    return true;
+  }
+
+  /*
+   * Slab test against a ray given by its origin and inverse direction
+   * Returns the distance the ray enters the box, or -1 if it misses or
+   * only meets the box beyond tMax
+   */
+  double intersect(const double origin[3], const double invDir[3],
+                   double tMax) const {
+    double tNear = 0;
+    double tFar = tMax;
+    for (int a = 0; a < 3; a++) {
+      double t0 = (min[a] - origin[a]) * invDir[a];
+      double t1 = (max[a] - origin[a]) * invDir[a];
+      if (t0 > t1)
+        swap(t0, t1);
+      // Written so a NaN from 0 * infinity leaves the interval alone
+      tNear = t0 > tNear ? t0 : tNear;
+      tFar = t1 < tFar ? t1 : tFar;
+      if (tNear > tFar)
+        return -1;
+    }
+    return tNear;
+  }
+};
@@ -0,0 +1,361 @@
+#include "BVH.h"
+#include "Shapes.h"
+
+// Number of buckets candidate splits are binned into
+#define SAH_BINS 16
+
+// Most shapes a leaf holds before it is always split
+#define MAX_LEAF 4
+
+// Cost of visiting a node relative to testing a shape
+#define TRAVERSAL_COST 0.5
+
+BVH::BVH(vector<Shape *> shapes) {
+  this->shapes = shapes;
+
+  vector<BBox> boxes;
+  for (vector<Shape *>::iterator it = shapes.begin(); it != shapes.end();
+       it++) {
+    boxes.push_back((*it)->bounds());
+  }
+
+  build(boxes);
+}
+
+BVH::BVH(const vector<BBox> &boxes) { build(boxes); }
+
+BVH::BVH(vector<Shape *> shapes, BinaryReader &in) {
+  this->shapes = shapes;
+  in.readArray(nodes);
+  in.readArray(order);
+  if (!in.ok() || !validate((int)shapes.size())) {
+    in.fail();
+    nodes.clear();
+    order.clear();
+  }
+}
+
+BVH::BVH(int primitives, BinaryReader &in) {
+  in.readArray(nodes);
+  in.readArray(order);
+  if (!in.ok() || !validate(primitives)) {
+    in.fail();
+    nodes.clear();
+    order.clear();
+  }
+}
+
+void BVH::write(BinaryWriter &out) {
+  out.writeArray(nodes);
+  out.writeArray(order);
+}
+
+bool BVH::validate(int primitives) {
+  if ((int)order.size() != primitives) {
+    return false;
+  }
+  for (vector<int>::iterator it = order.begin(); it != order.end(); it++) {
+    if (*it < 0 || *it >= primitives) {
+      return false;
+    }
+  }
+
+  // Traversal never looks at the nodes of an empty hierarchy
+  if (primitives == 0) {
+    return true;
+  }
+
+  int nodeCount = (int)nodes.size();
+  if (nodeCount == 0) {
+    return false;
+  }
+
+  // Children always come after their parent, so depths can be found in
+  // one pass and traversal can't loop or overflow its stack
+  vector<int> depth(nodeCount, 0);
+  for (int i = 0; i < nodeCount; i++) {
+    const Node &node = nodes[i];
+    if (node.count > 0) {
+      if (node.offset < 0 || node.offset + node.count > primitives) {
+        return false;
+      }
+      continue;
+    }
+    if (node.count < 0 || node.offset <= i + 1 || node.offset >= nodeCount ||
+        depth[i] >= MAX_DEPTH) {
+      return false;
+    }
+    depth[i + 1] = depth[i] + 1;
+    depth[node.offset] = depth[i] + 1;
+  }
+  return true;
+}
+
+void BVH::build(vector<BBox> boxes) {
+  for (int i = 0; i < (int)boxes.size(); i++) {
+    order.push_back(i);
+  }
+
+  nodes.reserve(2 * boxes.size() + 1);
+  build(boxes, 0, (int)boxes.size(), 0);
+}
+
+/*
+ * Builds the subtree over shapes [start, end), returning its node index
+ * Splits are chosen by binning box centres along the longest axis and
+ * picking the bin boundary with the lowest surface area cost
+ */
+int BVH::build(vector<BBox> &boxes, int start, int end, int depth) {
+  int index = (int)nodes.size();
+  nodes.push_back(Node());
+
+  BBox box;
+  BBox centres;
+  for (int i = start; i < end; i++) {
+    box.grow(boxes[i]);
+    Point3 c = Point3(boxes[i].centre(0), boxes[i].centre(1),
+                      boxes[i].centre(2));
+    centres.grow(c);
+  }
+  nodes[index].box = box;
+  nodes[index].offset = start;
+  nodes[index].count = end - start;
+
+  int count = end - start;
+  if (count <= 1) {
+    return index;
+  }
+
+  int axis = centres.longestAxis();
+  double low = centres.min[axis];
+  double extent = centres.max[axis] - low;
+
+  // Every centre in the same place, nothing to split on
+  if (extent <= 0 || depth >= MAX_DEPTH) {
+    return index;
+  }
+
+  // Bin the shapes along the axis
+  int binCount[SAH_BINS] = {0};
+  BBox binBox[SAH_BINS];
+  for (int i = start; i < end; i++) {
+    int b = (int)(SAH_BINS * (boxes[i].centre(axis) - low) / extent);
+    b = min(b, SAH_BINS - 1);
+    binCount[b]++;
+    binBox[b].grow(boxes[i]);
+  }
+
+  // Sweep from the right to get the area of every right hand side
+  double rightArea[SAH_BINS];
+  int rightCount[SAH_BINS];
+  BBox sweep;
+  int sweepCount = 0;
+  for (int b = SAH_BINS - 1; b > 0; b--) {
+    sweep.grow(binBox[b]);
+    sweepCount += binCount[b];
+    rightArea[b] = sweep.surfaceArea();
+    rightCount[b] = sweepCount;
+  }
+
+  // Sweep from the left, costing a split before each bin
+  double bestCost = -1;
+  int bestSplit = -1;
+  sweep = BBox();
+  sweepCount = 0;
+  for (int b = 1; b < SAH_BINS; b++) {
+    sweep.grow(binBox[b - 1]);
+    sweepCount += binCount[b - 1];
+    if (sweepCount == 0 || rightCount[b] == 0)
+      continue;
+    double cost =
+        sweep.surfaceArea() * sweepCount + rightArea[b] * rightCount[b];
+    if (bestCost < 0 || cost < bestCost) {
+      bestCost = cost;
+      bestSplit = b;
+    }
+  }
+
+  // Keep small sets as a leaf if splitting would not pay for itself
+  double leafCost = box.surfaceArea() * count;
+  double splitCost = TRAVERSAL_COST * box.surfaceArea() + bestCost;
+  if (bestSplit < 0 || (count <= MAX_LEAF && splitCost >= leafCost)) {
+    return index;
+  }
+
+  // Partition shapes (and their boxes) around the split
+  int mid = start;
+  for (int i = start; i < end; i++) {
+    int b = (int)(SAH_BINS * (boxes[i].centre(axis) - low) / extent);
+    b = min(b, SAH_BINS - 1);
+    if (b < bestSplit) {
+      swap(boxes[i], boxes[mid]);
+      swap(order[i], order[mid]);
+      mid++;
+    }
+  }
+
+  build(boxes, start, mid, depth + 1);
+  int right = build(boxes, mid, end, depth + 1);
+
+  nodes[index].offset = right;
+  nodes[index].count = 0;
+  return index;
+}
+
+/*
+ * Children always follow their parent, so walking the nodes backwards
+ * reaches both children of a node before the node itself
+ */
+void BVH::refit(const vector<BBox> &boxes) {
+  if (order.empty()) {
+    return;
+  }
+
+  for (int index = (int)nodes.size() - 1; index >= 0; index--) {
+    Node &node = nodes[index];
+    node.box = BBox();
+    if (node.count > 0) {
+      for (int i = node.offset; i < node.offset + node.count; i++) {
+        node.box.grow(boxes[order[i]]);
+      }
+    } else {
+      node.box.grow(nodes[index + 1].box);
+      node.box.grow(nodes[node.offset].box);
+    }
+  }
+}
+
+void BVH::refit() {
+  vector<BBox> boxes;
+  for (vector<Shape *>::iterator it = shapes.begin(); it != shapes.end();
+       it++) {
+    boxes.push_back((*it)->bounds());
+  }
+  refit(boxes);
+}
+
+/*
+ * The primitive of each closer hit is kept as it is found, so the
+ * closest shape never has to be intersected again
+ */
+double BVH::intersect(Ray3 r, Hit &hit) {
+  double best = -1;
+  int bestPrimitive = -1;
+  int index = closest(r, hit.t, [&](int i, const Ray3 &ray) {
+    int primitive;
+    double t = shapes[i]->intersectPrimitive(ray, primitive);
+    countTest(shapes[i]->kind, t);
+    if (t > 0 && (best < 0 || t < best)) {
+      best = t;
+      bestPrimitive = primitive;
+    }
+    return t;
+  });
+
+  hit.shape = index >= 0 ? shapes[index] : NULL;
+  hit.primitive = bestPrimitive;
+  return hit.t;
+}
+
+float BVH::packetEntry(const BBox &box, const RayPacket &packet) {
+  float minX = (float)box.min[0], maxX = (float)box.max[0];
+  float minY = (float)box.min[1], maxY = (float)box.max[1];
+  float minZ = (float)box.min[2], maxZ = (float)box.max[2];
+
+  // Each lane's entry goes into its own slot so the loop has no
+  // reduction, the closest is found after it
+  alignas(64) float near[PACKET_SIZE];
+  for (int i = 0; i < PACKET_SIZE; i++) {
+    float tx0 = (minX - packet.ox[i]) * packet.invDx[i];
+    float tx1 = (maxX - packet.ox[i]) * packet.invDx[i];
+    float ty0 = (minY - packet.oy[i]) * packet.invDy[i];
+    float ty1 = (maxY - packet.oy[i]) * packet.invDy[i];
+    float tz0 = (minZ - packet.oz[i]) * packet.invDz[i];
+    float tz1 = (maxZ - packet.oz[i]) * packet.invDz[i];
+
+    float tNear =
+        max(max(min(tx0, tx1), min(ty0, ty1)), max(min(tz0, tz1), 0.0f));
+    float tFar = min(min(max(tx0, tx1), max(ty0, ty1)),
+                     min(max(tz0, tz1), packet.t[i]));
+
+    near[i] = tNear <= tFar ? tNear : numeric_limits<float>::infinity();
+  }
+
+  float entry = near[0];
+  for (int i = 1; i < PACKET_SIZE; i++) {
+    entry = min(entry, near[i]);
+  }
+
+  return entry == numeric_limits<float>::infinity() ? -1 : entry;
+}
+
+void BVH::intersect(RayPacket &packet) {
+  if (nodes.empty() || shapes.empty()) {
+    return;
+  }
+
+  float tHit[PACKET_SIZE];
+
+  int stack[MAX_DEPTH * 2];
+  int top = 0;
+  stack[top++] = 0;
+
+  while (top > 0) {
+    int index = stack[--top];
+    const Node &node = nodes[index];
+    if (packetEntry(node.box, packet) < 0) {
+      continue;
+    }
+
+    if (node.count > 0) {
+      for (int i = node.offset; i < node.offset + node.count; i++) {
+        Shape *shape = shapes[order[i]];
+        shape->intersectPacket(packet, tHit);
+        packet.count(shape->kind, tHit);
+        packet.update(tHit, shape);
+      }
+      continue;
+    }
+
+    // Nearer child first, judged by the closest lane
+    int left = index + 1;
+    int right = node.offset;
+    float tLeft = packetEntry(nodes[left].box, packet);
+    float tRight = packetEntry(nodes[right].box, packet);
+
+    if (tLeft >= 0 && tRight >= 0) {
+      if (tLeft < tRight) {
+        stack[top++] = right;
+        stack[top++] = left;
+      } else {
+        stack[top++] = left;
+        stack[top++] = right;
+      }
+    } else if (tLeft >= 0) {
+      stack[top++] = left;
+    } else if (tRight >= 0) {
+      stack[top++] = right;
+    }
+  }
+}
+
+bool BVH::occluded(Ray3 r, double tMax, Shape **occluder) {
+  int hit = any(r, tMax, [this, tMax](int i, const Ray3 &ray) {
+    bool blocked = shapes[i]->occludes(ray, tMax);
+    countTest(shapes[i]->kind, blocked ? 1.0 : -1.0);
+    return blocked;
+  });
+  *occluder = hit >= 0 ? shapes[hit] : NULL;
+  return hit >= 0;
+}
+
+void BVH::query(Point3 p, vector<Shape *> &found) {
+  query(p, [this, &found](int i) { found.push_back(shapes[i]); });
+}
+
+BBox BVH::bounds() {
+  if (nodes.empty()) {
+    return BBox();
+  }
+  return nodes[0].box;
+}
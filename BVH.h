@@ -0,0 +1,267 @@
+/*
+ * BVH.h
+ * Contains the BVH class, a bounding volume hierarchy built with the
+ * surface area heuristic (SAH).
+ *
+ * A BVH is built either over shapes, or over any primitives given by
+ * their boxes (such as the triangles of a Mesh) which are then traced
+ * by index through the generic closest, any and query traversals.
+ */
+
+#pragma once
+
+#include "BBox.h"
+#include "BinaryIO.h"
+#include "GeomX.h"
+#include "RayPacket.h"
+
+#include <vector>
+
+using namespace std;
+
+class Shape;
+struct Hit;
+
+// Deepest possible tree, primitives below this are kept in one leaf
+#define MAX_DEPTH 64
+
+class BVH {
+
+  /*
+   * Nodes are stored flat, depth first. An interior node's left child
+   * directly follows it, offset holds the right child. A leaf holds
+   * count primitives starting at offset in order.
+   */
+  struct Node {
+    BBox box;
+    int offset;
+    int count;
+  };
+
+  /*
+   * Ray data unpacked for fast slab tests
+   */
+  struct RayBoxData {
+    double origin[3];
+    double invDir[3];
+
+    RayBoxData(const Ray3 &r) {
+      Point3 o = r.startP();
+      Vector3 d = r.directionV();
+      origin[0] = o.getX();
+      origin[1] = o.getY();
+      origin[2] = o.getZ();
+      invDir[0] = 1 / d.getXDir();
+      invDir[1] = 1 / d.getYDir();
+      invDir[2] = 1 / d.getZDir();
+    }
+  };
+
+  vector<Shape *> shapes; // Empty for a BVH over plain primitives
+  vector<int> order;      // Primitive index held in each leaf slot
+  vector<Node> nodes;
+
+  void build(vector<BBox> boxes);
+
+  // Checks a restored hierarchy only refers to nodes and primitives it has
+  bool validate(int primitives);
+  int build(vector<BBox> &boxes, int start, int end, int depth);
+
+  // Nearest distance any lane of the packet enters the box, or -1
+  static float packetEntry(const BBox &box, const RayPacket &packet);
+
+public:
+  // Builds a hierarchy over bounded shapes
+  BVH(vector<Shape *> shapes);
+
+  // Builds a hierarchy over primitives, identified by their box index
+  BVH(const vector<BBox> &boxes);
+
+  /*
+   * Restores a hierarchy saved by write, without rebuilding it
+   * The shapes must be given in the same order they were built with
+   * A restore that fails leaves the reader failed and the BVH empty
+   */
+  BVH(vector<Shape *> shapes, BinaryReader &in);
+  BVH(int primitives, BinaryReader &in);
+
+  // Saves the built hierarchy
+  void write(BinaryWriter &out);
+
+  /*
+   * Recomputes every node's box after primitives have moved, keeping the
+   * tree as it was built. Much cheaper than a rebuild, but the tree gets
+   * looser the further primitives move from where it was built.
+   * boxes are given by primitive index, as for the constructor
+   */
+  void refit(const vector<BBox> &boxes);
+
+  // Refits a hierarchy over shapes from their current bounds
+  void refit();
+
+  /*
+   * Finds the closest primitive hit by the ray, where test(index, r)
+   * returns the distance to a primitive or -1.
+   * Returns the primitive index with its distance in t, or -1
+   */
+  template <typename Test> int closest(const Ray3 &r, double &t, Test test);
+
+  /*
+   * Finds any primitive blocking the ray before tMax, where test(index, r)
+   * returns true if a primitive does. Stops at the first one found.
+   * Returns its index, or -1
+   */
+  template <typename Test> int any(const Ray3 &r, double tMax, Test test);
+
+  // Calls visit(index) for every primitive whose box contains the point
+  template <typename Visit> void query(Point3 p, Visit visit);
+
+  /*
+   * Finds the closest shape hit by the ray, setting the distance, shape
+   * and primitive of hit. Returns the distance, or -1 with hit.shape NULL
+   * if nothing is hit
+   */
+  double intersect(Ray3 r, Hit &hit);
+
+  /*
+   * Traces a packet of rays together, updating each lane's closest
+   * hit. A node is visited if any lane in the packet hits its box.
+   */
+  void intersect(RayPacket &packet);
+
+  /*
+   * Returns true if any shape blocks the ray before tMax, setting
+   * occluder to the first blocker found
+   */
+  bool occluded(Ray3 r, double tMax, Shape **occluder);
+
+  // Adds every shape whose bounds contain the point to found
+  void query(Point3 p, vector<Shape *> &found);
+
+  BBox bounds();
+
+  int size() { return (int)order.size(); }
+};
+
+template <typename Test>
+int BVH::closest(const Ray3 &r, double &t, Test test) {
+  int hitIndex = -1;
+  t = -1;
+  if (nodes.empty() || order.empty()) {
+    return -1;
+  }
+
+  RayBoxData ray(r);
+  double best = numeric_limits<double>::infinity();
+
+  int stack[MAX_DEPTH * 2];
+  int top = 0;
+  stack[top++] = 0;
+
+  while (top > 0) {
+    int index = stack[--top];
+    const Node &node = nodes[index];
+    if (node.box.intersect(ray.origin, ray.invDir, best) < 0) {
+      continue;
+    }
+
+    if (node.count > 0) {
+      for (int i = node.offset; i < node.offset + node.count; i++) {
+        double tHit = test(order[i], r);
+        if (tHit > 0 && tHit < best) {
+          best = tHit;
+          hitIndex = order[i];
+        }
+      }
+      continue;
+    }
+
+    // Visit the nearer child first so the far one can be culled
+    int left = index + 1;
+    int right = node.offset;
+    double tLeft = nodes[left].box.intersect(ray.origin, ray.invDir, best);
+    double tRight = nodes[right].box.intersect(ray.origin, ray.invDir, best);
+
+    if (tLeft >= 0 && tRight >= 0) {
+      if (tLeft < tRight) {
+        stack[top++] = right;
+        stack[top++] = left;
+      } else {
+        stack[top++] = left;
+        stack[top++] = right;
+      }
+    } else if (tLeft >= 0) {
+      stack[top++] = left;
+    } else if (tRight >= 0) {
+      stack[top++] = right;
+    }
+  }
+
+  if (hitIndex >= 0) {
+    t = best;
+  }
+  return hitIndex;
+}
+
+template <typename Test>
+int BVH::any(const Ray3 &r, double tMax, Test test) {
+  if (nodes.empty() || order.empty()) {
+    return -1;
+  }
+
+  RayBoxData ray(r);
+
+  int stack[MAX_DEPTH * 2];
+  int top = 0;
+  stack[top++] = 0;
+
+  while (top > 0) {
+    int index = stack[--top];
+    const Node &node = nodes[index];
+    if (node.box.intersect(ray.origin, ray.invDir, tMax) < 0) {
+      continue;
+    }
+
+    if (node.count > 0) {
+      for (int i = node.offset; i < node.offset + node.count; i++) {
+        if (test(order[i], r)) {
+          return order[i]; // Any hit will do
+        }
+      }
+      continue;
+    }
+
+    stack[top++] = node.offset;
+    stack[top++] = index + 1;
+  }
+
+  return -1;
+}
+
+template <typename Visit> void BVH::query(Point3 p, Visit visit) {
+  if (nodes.empty() || order.empty()) {
+    return;
+  }
+
+  int stack[MAX_DEPTH * 2];
+  int top = 0;
+  stack[top++] = 0;
+
+  while (top > 0) {
+    int index = stack[--top];
+    const Node &node = nodes[index];
+    if (!node.box.contains(p)) {
+      continue;
+    }
+
+    if (node.count > 0) {
+      for (int i = node.offset; i < node.offset + node.count; i++) {
+        visit(order[i]);
+      }
+      continue;
+    }
+
+    stack[top++] = node.offset;
+    stack[top++] = index + 1;
+  }
+}
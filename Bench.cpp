@@ -0,0 +1,355 @@
+/*
+ * Bench.cpp
+ * Microbenchmarks for the geometry, intersection and shading kernels
+ *
+ * Each kernel is run over a set of random inputs from a fixed seed, so
+ * runs are repeatable and two builds can be compared kernel by kernel.
+ * Build and run with `make bench`.
+ */
+
+#include "GeomX.h"
+#include "Illumination.h"
+#include "LightTable.h"
+#include "LightTree.h"
+#include "Shapes.h"
+#include "TextureCache.h"
+#include "View.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// Inputs in each random set
+#define BENCH_INPUTS 4096
+
+// Shortest time each kernel is run for, in seconds
+#define BENCH_MIN_TIME 0.25
+
+// Seed for the random inputs
+#define BENCH_SEED 1
+
+// Results are added into this so the kernels can't be optimised away
+static volatile double sink;
+
+/*
+ * Times kernel(i) for i over the input set, repeating the whole set until
+ * minTime has passed, and prints ns/op and rays (calls) per second. A
+ * kernel tracing raysPerCall rays in each call, as the packet kernels do,
+ * is reported per ray
+ */
+template <typename Kernel>
+void bench(const char *name, int inputs, double minTime, Kernel kernel,
+           int raysPerCall = 1) {
+  // One untimed pass warms the caches
+  double total = 0;
+  for (int i = 0; i < inputs; i++) {
+    total += kernel(i);
+  }
+
+  long long ops = 0;
+  double seconds = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  while (seconds < minTime) {
+    for (int i = 0; i < inputs; i++) {
+      total += kernel(i);
+    }
+    ops += inputs;
+    seconds =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  }
+  sink = sink + total;
+
+  ops *= raysPerCall;
+  double ns = seconds * 1e9 / ops;
+  cout << left << setw(28) << name << right << fixed << setprecision(2)
+       << setw(10) << ns << " ns/op" << setw(14) << setprecision(0)
+       << ops / seconds << " rays/s" << endl;
+}
+
+/*
+ * Random point in the box from -extent to extent on every axis
+ */
+static Point3 randomPoint(mt19937 &rng, double extent) {
+  uniform_real_distribution<double> d(-extent, extent);
+  double x = d(rng);
+  double y = d(rng);
+  double z = d(rng);
+  return Point3(x, y, z);
+}
+
+/*
+ * Random unit vector
+ */
+static Vector3 randomDirection(mt19937 &rng) {
+  Vector3 v;
+  do {
+    v = randomPoint(rng, 1) - Point3(0, 0, 0);
+  } while (dot(v, v) > 1 || dot(v, v) < 1e-6);
+  return unit(v);
+}
+
+/*
+ * Rays from random points around the origin towards random points near
+ * it, so each shape (centred on the origin, about a unit across) is hit
+ * by some rays and missed by the rest
+ */
+static vector<Ray3> randomRays(mt19937 &rng, int count) {
+  vector<Ray3> rays;
+  for (int i = 0; i < count; i++) {
+    Point3 origin = Point3(0, 0, 0) + randomDirection(rng) * 5;
+    Point3 target = randomPoint(rng, 1.5);
+    rays.push_back(Ray3(origin, unit(target - origin)));
+  }
+  return rays;
+}
+
+/*
+ * Times intersect over the random rays, also printing the fraction hit
+ */
+static void benchIntersect(const char *name, Shape *shape,
+                           const vector<Ray3> &rays, double minTime) {
+  int hits = 0;
+  for (size_t i = 0; i < rays.size(); i++) {
+    hits += shape->intersect(rays[i]) > 0 ? 1 : 0;
+  }
+  bench(name, (int)rays.size(), minTime,
+        [&](int i) { return shape->intersect(rays[i]); });
+  cout << setw(28) << "" << setprecision(1)
+       << 100.0 * hits / rays.size() << "% hit" << endl;
+}
+
+/*
+ * Times intersectPacket over the random rays, PACKET_SIZE at a time, for
+ * comparison with intersect on the same rays
+ */
+static void benchPacket(const char *name, Shape *shape,
+                        const vector<Ray3> &rays, double minTime) {
+  // C++11 allocators don't honour alignas beyond the default, so the
+  // packets are placed in a buffer aligned by hand
+  size_t count = rays.size() / PACKET_SIZE;
+  size_t space = (count + 1) * sizeof(RayPacket);
+  vector<char> storage(space);
+  void *start = storage.data();
+  align(alignof(RayPacket), count * sizeof(RayPacket), start, space);
+  RayPacket *packets = (RayPacket *)start;
+  for (size_t i = 0; i < count; i++) {
+    new (&packets[i]) RayPacket();
+    for (int lane = 0; lane < PACKET_SIZE; lane++) {
+      packets[i].set(lane, rays[i * PACKET_SIZE + lane]);
+    }
+  }
+  bench(name, (int)count, minTime,
+        [&](int i) {
+          alignas(64) float t[PACKET_SIZE];
+          shape->intersectPacket(packets[i], t);
+          double total = 0;
+          for (int lane = 0; lane < PACKET_SIZE; lane++) {
+            total += t[lane];
+          }
+          return total;
+        },
+        PACKET_SIZE);
+}
+
+static double sum(Colour c) { return c.red() + c.green() + c.blue(); }
+
+int main(int argc, char *argv[]) {
+  int inputs = BENCH_INPUTS;
+  double minTime = BENCH_MIN_TIME;
+  unsigned seed = BENCH_SEED;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      inputs = max(atoi(argv[++i]), 1);
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      minTime = max(atof(argv[++i]), 0.0);
+    } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+      seed = (unsigned)atoi(argv[++i]);
+    } else {
+      cout << "Usage: " << argv[0] << " [-n inputs] [-t seconds] [-seed seed]"
+           << endl;
+      return 1;
+    }
+  }
+
+  cout << inputs << " inputs, seed " << seed << ", at least " << minTime
+       << " s per kernel" << endl;
+
+  mt19937 rng(seed);
+  vector<Ray3> rays = randomRays(rng, inputs);
+
+  Material plain(Colour(0.7, 0.3, 0.2), Colour(0.4, 0.4, 0.4), 100, 0.25, 1.0,
+                 1.0);
+
+  // Intersection
+  Sphere sphere(Point3(0, 0, 0), 1, plain);
+  benchIntersect("Sphere::intersect", &sphere, rays, minTime);
+
+  Plane plane(Point3(0, 0, 0), Vector3(0, 1, 0), plain);
+  benchIntersect("Plane::intersect", &plane, rays, minTime);
+
+  Triangle triangle(Point3(-1, 0, 0), Point3(1, 0, 0), Point3(0, 1, 1), plain);
+  benchIntersect("Triangle::intersect", &triangle, rays, minTime);
+
+  // The same rays in packets
+  benchPacket("Sphere::intersectPacket", &sphere, rays, minTime);
+  benchPacket("Plane::intersectPacket", &plane, rays, minTime);
+  benchPacket("Triangle::intersectPacket", &triangle, rays, minTime);
+
+  Square square(Point3(-1, -1, 0), Point3(1, 1, 0), Vector3(0, 0, 1), plain);
+  benchIntersect("Square::intersect", &square, rays, minTime);
+
+  Cube cube(Point3(-0.5, -0.5, -0.5), 1, plain);
+  benchIntersect("Cube::intersect", &cube, rays, minTime);
+
+  vector<Triangle *> pyramid;
+  pyramid.push_back(new Triangle(Point3(-1, 0, 0), Point3(0, 0, 1),
+                                 Point3(0, 1, 0), plain));
+  pyramid.push_back(new Triangle(Point3(0, 0, 1), Point3(1, 0, 0),
+                                 Point3(0, 1, 0), plain));
+  pyramid.push_back(new Triangle(Point3(1, 0, 0), Point3(0, 0, -1),
+                                 Point3(0, 1, 0), plain));
+  pyramid.push_back(new Triangle(Point3(0, 0, -1), Point3(-1, 0, 0),
+                                 Point3(0, 1, 0), plain));
+  Polyhedron polyhedron(pyramid, plain);
+  benchIntersect("Polyhedron::intersect", &polyhedron, rays, minTime);
+  benchPacket("Polyhedron::intersectPacket", &polyhedron, rays, minTime);
+
+  // Camera rays
+  View view(Point3(3, 2, 4), Point3(0, 1, 0), Vector3(0, 1, 0), 60, 1920,
+            1080);
+  vector<float> columns, rows;
+  uniform_real_distribution<float> column(0, 1920), row(0, 1080);
+  for (int i = 0; i < inputs; i++) {
+    columns.push_back(column(rng));
+    rows.push_back(row(rng));
+  }
+  bench("View::createRay", inputs, minTime, [&](int i) {
+    return view.createRay(columns[i], rows[i]).directionV().getXDir();
+  });
+
+  // Shading, at random points on a unit sphere seen from random directions
+  vector<Point3> points;
+  vector<Vector3> normals, views;
+  vector<bool> shadowed;
+  for (int i = 0; i < inputs; i++) {
+    Vector3 normal = randomDirection(rng);
+    Vector3 toView = randomDirection(rng);
+    if (dot(normal, toView) < 0) {
+      toView = -toView;
+    }
+    points.push_back(Point3(0, 0, 0) + normal);
+    normals.push_back(normal);
+    views.push_back(toView);
+    shadowed.push_back(rng() % 4 == 0);
+  }
+
+  DirectionLight direction(0.4, unit(Vector3(-1, 5, 0)), 0.05);
+  SpotLight spot(0.4, unit(Vector3(1, 5, 2)), 0.05, Point3(2, 4, 2), 8, 0);
+
+  bench("lit_colour direction", inputs, minTime, [&](int i) {
+    return sum(plain.lit_colour(points[i], 0, 0, normals[i], &direction,
+                                views[i], shadowed[i], 0, 0));
+  });
+  bench("lit_colour spot", inputs, minTime, [&](int i) {
+    return sum(plain.lit_colour(points[i], 0, 0, normals[i], &spot, views[i],
+                                shadowed[i], 0, 0));
+  });
+
+  // Both lights in one pass, against a lit_colour call for each
+  vector<Lighting *> both = {&direction, &spot};
+  LightTable table(both);
+  bench("lit_colour both lights", inputs, minTime, [&](int i) {
+    return sum(plain.lit_colour(points[i], 0, 0, normals[i], &direction,
+                                views[i], shadowed[i], 0, 0) +
+               plain.lit_colour(points[i], 0, 0, normals[i], &spot, views[i],
+                                shadowed[i], 0, 0));
+  });
+  bench("LightTable::shade", inputs, minTime, [&](int i) {
+    double visible = shadowed[i] ? 0 : 1;
+    LightChoice choices[2] = {{0, visible}, {1, visible}};
+    double diffuse, specular;
+    table.shade(points[i], normals[i], views[i], plain.shininess(), choices,
+                2, diffuse, specular);
+    return sum(plain.shaded_colour(0, 0, table.ambient(), diffuse, specular,
+                                   0, 0));
+  });
+
+  // A 16 x 16 grid of ceiling spot lights, each lighting a few metres
+  // of floor, chosen for points scattered over the floor
+  list<Lighting *> grid;
+  for (int x = 0; x < 16; x++) {
+    for (int z = 0; z < 16; z++) {
+      grid.push_back(new SpotLight(0.4, Vector3(0, 1, 0), 0.001,
+                                   Point3(x * 2, 4, z * 2), 4, 6));
+    }
+  }
+  LightTree lightTree(grid);
+  uniform_real_distribution<double> floorRange(0, 32);
+  vector<Point3> floorPoints;
+  for (int i = 0; i < inputs; i++) {
+    floorPoints.push_back(Point3(floorRange(rng), 0, floorRange(rng)));
+  }
+  Vector3 up(0, 1, 0);
+  vector<LightChoice> chosen;
+  bench("LightTree::choose", inputs, minTime, [&](int i) {
+    Ray3 ray(floorPoints[i] + up, -up);
+    lightTree.choose(floorPoints[i], up, ray, 0, chosen);
+    return (double)chosen.size();
+  });
+  bench("LightTree::choose -L 4", inputs, minTime,
+        [&](int i) {
+          Ray3 ray(floorPoints[i] + up, -up);
+          lightTree.choose(floorPoints[i], up, ray, 4, chosen);
+          return (double)chosen.size();
+        });
+  for (list<Lighting *>::iterator it = grid.begin(); it != grid.end(); it++) {
+    delete *it;
+  }
+
+  // Textured kernels need a texture to sample
+  int earthTGA = TextureCache::instance().load("earth.tga");
+  if (earthTGA < 0) {
+    cout << "Skipping texture kernels" << endl;
+    return 0;
+  }
+  Material earth(earthTGA, Colour(0, 0, 0), 0, 0, 1.0, 1.0);
+  Sphere globe(Point3(0, 0, 0), 1, earth);
+
+  vector<double> us, vs, footprints;
+  uniform_real_distribution<double> unitRange(0, 1);
+  for (int i = 0; i < inputs; i++) {
+    us.push_back(unitRange(rng));
+    vs.push_back(unitRange(rng));
+    // From a texel to the whole texture
+    footprints.push_back(pow(2, -10 * unitRange(rng)));
+  }
+
+  // Hits on the globe, whose texture coordinates are found once per hit
+  vector<Hit> hits(inputs);
+  for (int i = 0; i < inputs; i++) {
+    hits[i].point = points[i];
+    globe.surface(hits[i]);
+  }
+
+  bench("Sphere::surface", inputs, minTime, [&](int i) {
+    globe.surface(hits[i]);
+    return hits[i].u + hits[i].v;
+  });
+  bench("Sphere::getColour", inputs, minTime, [&](int i) {
+    return sum(globe.getColour(hits[i], &direction, views[i], shadowed[i],
+                               footprints[i]));
+  });
+  bench("Material::posColour", inputs, minTime, [&](int i) {
+    return sum(earth.posColour(us[i], vs[i], footprints[i], footprints[i]));
+  });
+
+  return 0;
+}
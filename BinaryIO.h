@@ -0,0 +1,113 @@
+/*
+ * BinaryIO.h
+ * Contains BinaryWriter and BinaryReader, used to save and restore
+ * compiled scenes. Values are stored in native byte order, so a
+ * compiled scene is only read back on the machine type that wrote it.
+ */
+
+#pragma once
+
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+class BinaryWriter {
+  ofstream out;
+
+public:
+  BinaryWriter(const char *filename)
+      : out(filename, ios_base::binary | ios_base::trunc) {}
+
+  bool ok() { return (bool)out; }
+
+  template <typename T> void write(const T &value) {
+    static_assert(is_trivially_copyable<T>::value, "T must be plain data");
+    out.write((const char *)&value, sizeof(T));
+  }
+
+  void writeBytes(const void *data, size_t size) {
+    out.write((const char *)data, size);
+  }
+
+  // Arrays are written as their length followed by the raw elements
+  template <typename T> void writeArray(const vector<T> &values) {
+    static_assert(is_trivially_copyable<T>::value, "T must be plain data");
+    write((uint64_t)values.size());
+    if (!values.empty()) {
+      writeBytes(&values[0], values.size() * sizeof(T));
+    }
+  }
+
+  void writeString(const string &value) {
+    write((uint64_t)value.size());
+    writeBytes(value.data(), value.size());
+  }
+};
+
+/*
+ * Reads from a block of memory, usually a mapped file
+ * Reading past the end marks the reader as failed rather than crashing,
+ * so a truncated or corrupt file is caught by checking ok() once
+ */
+class BinaryReader {
+  const char *position;
+  const char *end;
+  bool valid;
+
+public:
+  BinaryReader(const char *data, size_t size)
+      : position(data), end(data + size), valid(true) {}
+
+  bool ok() { return valid; }
+
+  // Marks the data as invalid, for checks the reader can't make itself
+  void fail() { valid = false; }
+
+  // Returns a pointer to the next size bytes without copying them
+  const char *readBytes(size_t size) {
+    if (!valid || (size_t)(end - position) < size) {
+      valid = false;
+      return NULL;
+    }
+    const char *bytes = position;
+    position += size;
+    return bytes;
+  }
+
+  template <typename T> T read() {
+    static_assert(is_trivially_copyable<T>::value, "T must be plain data");
+    T value;
+    memset((void *)&value, 0, sizeof(T));
+    const char *bytes = readBytes(sizeof(T));
+    if (bytes != NULL) {
+      memcpy((void *)&value, bytes, sizeof(T));
+    }
+    return value;
+  }
+
+  template <typename T> void readArray(vector<T> &values) {
+    static_assert(is_trivially_copyable<T>::value, "T must be plain data");
+    uint64_t count = read<uint64_t>();
+    if (!valid || count > (uint64_t)(end - position) / sizeof(T)) {
+      valid = false;
+      values.clear();
+      return;
+    }
+    values.resize((size_t)count);
+    const char *bytes = readBytes((size_t)count * sizeof(T));
+    if (bytes != NULL && count > 0) {
+      memcpy((void *)&values[0], bytes, (size_t)count * sizeof(T));
+    }
+  }
+
+  string readString() {
+    uint64_t size = read<uint64_t>();
+    const char *bytes = readBytes((size_t)size);
+    return bytes != NULL ? string(bytes, (size_t)size) : string();
+  }
+};
@@ -4,40 +4,109 @@
 //	Colour.h
 //	RaXaR
 //	Port of Colour.py by Richard Lobb
+//
+//	Colours are linear radiance and aren't clamped, so bright lights and
+//	reflections keep their energy while shading adds them up. Channels
+//	are floats, held in one SSE register where the compiler has SSE2.
+//	TGAWriter brings them into the displayable range once per pixel.
 #include <algorithm>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
 class Colour {
 
-  double r;
-  double g;
-  double b;
+#ifdef __SSE2__
+  __m128 c; // red, green, blue, and an unused lane kept at zero
+
+  Colour(__m128 c) : c(c) {}
 
-  void constrain() {
-    r = max(0.0, min(r, 1.0));
-    g = max(0.0, min(g, 1.0));
-    b = max(0.0, min(b, 1.0));
+  float lane(int i) const {
+    float lanes[4];
+    _mm_storeu_ps(lanes, c);
+    return lanes[i];
   }
+#else
+  float r;
+  float g;
+  float b;
+#endif
 
 public:
   Colour(){};
 
-  Colour(double r, double g, double b);
+#ifdef __SSE2__
+  Colour(double r, double g, double b)
+      : c(_mm_setr_ps((float)r, (float)g, (float)b, 0.0f)) {}
+
+  Colour modulate(Colour other) const { return Colour(_mm_mul_ps(c, other.c)); }
+
+  Colour operator*(double factor) const {
+    return Colour(_mm_mul_ps(c, _mm_set1_ps((float)factor)));
+  }
+
+  Colour operator/(double divisor) const {
+    return Colour(_mm_div_ps(c, _mm_set1_ps((float)divisor)));
+  }
+
+  Colour operator+(Colour other) const { return Colour(_mm_add_ps(c, other.c)); }
 
-  Colour modulate(Colour other);
+  Colour &operator+=(Colour other) {
+    c = _mm_add_ps(c, other.c);
+    return *this;
+  }
+
+  // Each channel limited to 0 - 1, as a display shows it
+  Colour clamped() const {
+    return Colour(
+        _mm_max_ps(_mm_setzero_ps(), _mm_min_ps(c, _mm_set1_ps(1.0f))));
+  }
 
-  Colour operator*(double factor);
+  double red() const { return _mm_cvtss_f32(c); }
 
-  Colour operator/(double divisor);
+  double green() const { return lane(1); }
 
-  Colour operator+(Colour other);
+  double blue() const { return lane(2); }
+#else
+  Colour(double r, double g, double b)
+      : r((float)r), g((float)g), b((float)b) {}
 
-  Colour &operator+=(Colour other);
+  Colour modulate(Colour other) const {
+    return Colour(r * other.r, g * other.g, b * other.b);
+  }
+
+  Colour operator*(double factor) const {
+    return Colour(r * factor, g * factor, b * factor);
+  }
+
+  Colour operator/(double divisor) const {
+    return Colour(r / divisor, g / divisor, b / divisor);
+  }
+
+  Colour operator+(Colour other) const {
+    return Colour(r + other.r, g + other.g, b + other.b);
+  }
+
+  Colour &operator+=(Colour other) {
+    r += other.r;
+    g += other.g;
+    b += other.b;
+    return *this;
+  }
+
+  // Each channel limited to 0 - 1, as a display shows it
+  Colour clamped() const {
+    return Colour(max(0.0f, min(r, 1.0f)), max(0.0f, min(g, 1.0f)),
+                  max(0.0f, min(b, 1.0f)));
+  }
 
-  double red();
+  double red() const { return r; }
 
-  double green();
+  double green() const { return g; }
 
-  double blue();
+  double blue() const { return b; }
+#endif
 };
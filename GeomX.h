@@ -2,6 +2,11 @@
 //  GeomX.h
 //  RaXar
 //  Port of Geom3.py
+//
+//  Header only, so every operator can be inlined into the intersection
+//  and shading code. The classes are templated on their scalar type,
+//  Point3, Vector3 and Ray3 are the double precision versions used by
+//  the renderer and Point3f, Vector3f and Ray3f the single precision ones.
 
 #pragma once
 
@@ -9,170 +14,250 @@
 #include <cmath>
 #include <iostream>
 
-class Vector3;
-class Point3;
-class Ray3;
-class Line3;
+template <typename T> class Vector3T;
+template <typename T> class Point3T;
+template <typename T> class Ray3T;
+template <typename T> class Line3T;
+
+/*
+ * Tolerance used when comparing points and vectors
+ */
+template <typename T> constexpr T geomEpsilon() { return T(1.e-10); }
+template <> constexpr float geomEpsilon<float>() { return 1.e-5f; }
 
 /*
  * Point3
  */
 
-class Point3 {
+template <typename T> class Point3T {
 
-  double x;
-  double y;
-  double z;
+  T x;
+  T y;
+  T z;
 
 public:
-  double getX();
-  double getY();
-  double getZ();
+  constexpr T getX() const { return x; }
+  constexpr T getY() const { return y; }
+  constexpr T getZ() const { return z; }
+
+  Point3T() {}
+
+  constexpr Point3T(T value) : x(value), y(value), z(value) {}
 
-  Point3() {}
+  constexpr Point3T(T xP, T yP, T zP) : x(xP), y(yP), z(zP) {}
 
-  Point3(double value);
+  constexpr Point3T(const Vector3T<T> &vector)
+      : x(vector.getXDir()), y(vector.getYDir()), z(vector.getZDir()) {}
 
-  Point3(double xP, double yP, double zP);
+  // Converts between precisions
+  template <typename U>
+  explicit constexpr Point3T(const Point3T<U> &point)
+      : x(T(point.getX())), y(T(point.getY())), z(T(point.getZ())) {}
 
-  Point3(Vector3 vector);
+  constexpr Point3T operator+(const Vector3T<T> &rhs) const {
+    return Point3T(x + rhs.getXDir(), y + rhs.getYDir(), z + rhs.getZDir());
+  }
 
-  Point3 &operator=(Point3 rhs);
-  Point3 operator+(Vector3 rhs);
-  Vector3 operator-(Point3 rhs);
-  bool operator==(Point3 rhs);
-  bool operator!=(Point3 rhs);
+  constexpr Vector3T<T> operator-(const Point3T &rhs) const {
+    return Vector3T<T>(x - rhs.x, y - rhs.y, z - rhs.z);
+  }
 
-  // Point3 operator-(Vector3 rhs);
+  bool operator==(const Point3T &rhs) const {
+    return std::fabs(x - rhs.x) < geomEpsilon<T>() &&
+           std::fabs(y - rhs.y) < geomEpsilon<T>() &&
+           std::fabs(z - rhs.z) < geomEpsilon<T>();
+  }
+
+  bool operator!=(const Point3T &rhs) const { return !(*this == rhs); }
 };
 
 /*
  * Vector3
  */
 
-class Vector3 {
+template <typename T> class Vector3T {
 
-  double dirX;
-  double dirY;
-  double dirZ;
+  T dirX;
+  T dirY;
+  T dirZ;
 
 public:
-  Vector3() {}
-
-  Vector3(double xDir, double yDir, double zDir);
-  Vector3(double value);
-  Vector3(Point3 point);
-
-  double getXDir();
-  double getYDir();
-  double getZDir();
-
-  bool operator==(Vector3 rhs);
-  bool operator!=(Vector3 rhs);
-
-  Vector3 &operator=(Vector3 rhs);
-
-  Vector3 operator+(Vector3 rhs);
-  Vector3 operator-(Vector3 rhs);
-  Vector3 operator-(); // negation
-
-  Vector3 operator*(double scalar);
-  Vector3 operator/(double scalar);
-
-  Vector3 norm();
-  Vector3 unit();
-
-  double dot(Vector3 rhs);
-  Vector3 cross(Vector3 rhs);
-  double length();
+  Vector3T() {}
+
+  constexpr Vector3T(T xDir, T yDir, T zDir)
+      : dirX(xDir), dirY(yDir), dirZ(zDir) {}
+  constexpr Vector3T(T value) : dirX(value), dirY(value), dirZ(value) {}
+  constexpr Vector3T(const Point3T<T> &point)
+      : dirX(point.getX()), dirY(point.getY()), dirZ(point.getZ()) {}
+
+  // Converts between precisions
+  template <typename U>
+  explicit constexpr Vector3T(const Vector3T<U> &vector)
+      : dirX(T(vector.getXDir())), dirY(T(vector.getYDir())),
+        dirZ(T(vector.getZDir())) {}
+
+  constexpr T getXDir() const { return dirX; }
+  constexpr T getYDir() const { return dirY; }
+  constexpr T getZDir() const { return dirZ; }
+
+  bool operator==(const Vector3T &rhs) const {
+    return std::fabs(dirX - rhs.dirX) < geomEpsilon<T>() &&
+           std::fabs(dirY - rhs.dirY) < geomEpsilon<T>() &&
+           std::fabs(dirZ - rhs.dirZ) < geomEpsilon<T>();
+  }
+
+  bool operator!=(const Vector3T &rhs) const { return !(*this == rhs); }
+
+  constexpr Vector3T operator+(const Vector3T &rhs) const {
+    return Vector3T(dirX + rhs.dirX, dirY + rhs.dirY, dirZ + rhs.dirZ);
+  }
+
+  constexpr Vector3T operator-(const Vector3T &rhs) const {
+    return Vector3T(dirX - rhs.dirX, dirY - rhs.dirY, dirZ - rhs.dirZ);
+  }
+
+  constexpr Vector3T operator-() const { // negation
+    return Vector3T(-dirX, -dirY, -dirZ);
+  }
+
+  constexpr Vector3T operator*(T scalar) const {
+    return Vector3T(dirX * scalar, dirY * scalar, dirZ * scalar);
+  }
+
+  constexpr Vector3T operator/(T scalar) const {
+    return Vector3T(dirX / scalar, dirY / scalar, dirZ / scalar);
+  }
+
+  Vector3T norm() const { return *this / length(); }
+  Vector3T unit() const { return norm(); }
+
+  constexpr T dot(const Vector3T &rhs) const {
+    return dirX * rhs.dirX + dirY * rhs.dirY + dirZ * rhs.dirZ;
+  }
+
+  constexpr Vector3T cross(const Vector3T &rhs) const {
+    return Vector3T(dirY * rhs.dirZ - dirZ * rhs.dirY,
+                    dirZ * rhs.dirX - dirX * rhs.dirZ,
+                    dirX * rhs.dirY - dirY * rhs.dirX);
+  }
+
+  T length() const { return std::sqrt(dot(*this)); }
 };
 
 /*
 * Ray3
 * Ray3 is defined by a starting point and a direction
 */
-class Ray3 {
+template <typename T> class Ray3T {
 
   // Private data
-  Point3 start;
-  Vector3 direction; // Unit vector
+  Point3T<T> start;
+  Vector3T<T> direction; // Unit vector
 
 public:
   /*
    * Ray3 Constructor
    */
-  Ray3() {}
-  Ray3(Point3 startP, Vector3 directionV);
+  Ray3T() {}
+  constexpr Ray3T(const Point3T<T> &startP, const Vector3T<T> &directionV)
+      : start(startP), direction(directionV) {}
 
   /*
    * Returns a Point3 on the ray at alpha*direction
    */
-  Point3 pos(double alpha);
+  constexpr Point3T<T> pos(T alpha) const { return start + direction * alpha; }
 
-  Point3 startP() { return start; }
+  constexpr Point3T<T> startP() const { return start; }
 
-  Vector3 directionV() { return direction; }
+  constexpr Vector3T<T> directionV() const { return direction; }
 
   /*
    * Overidden operators
    */
-  Ray3 &operator=(Ray3 rhs);
-
-  bool operator==(Ray3 rhs);
+  bool operator==(const Ray3T &rhs) const {
+    return start == rhs.start && direction == rhs.direction;
+  }
 
-  bool operator!=(Ray3 rhs);
+  bool operator!=(const Ray3T &rhs) const { return !(*this == rhs); }
 };
 
 /*
  * A line is defined by two points
  */
-class Line3 {
+template <typename T> class Line3T {
 
   // Private data
-  Point3 p1;
-  Point3 p2;
+  Point3T<T> p1;
+  Point3T<T> p2;
 
 public:
   /*
    * Line3 constructor
    */
-  Line3() {}
-  Line3(Point3 p1, Point3 p2);
+  Line3T() {}
+  constexpr Line3T(const Point3T<T> &p1, const Point3T<T> &p2)
+      : p1(p1), p2(p2) {}
 
   /*
    * Point at position alpha on the line
    */
-  Point3 pos(double alpha);
+  constexpr Point3T<T> pos(T alpha) const { return p1 + (p2 - p1) * alpha; }
 
   /*
    * Overidden operators
    */
-  Line3 &operator=(Line3 rhs);
+  bool operator==(const Line3T &rhs) const {
+    return p1 == rhs.p1 && p2 == rhs.p2;
+  }
 
-  bool operator==(Line3 rhs);
-
-  bool operator!=(Line3 rhs);
+  bool operator!=(const Line3T &rhs) const { return !(*this == rhs); }
 };
 
+typedef Point3T<double> Point3;
+typedef Vector3T<double> Vector3;
+typedef Ray3T<double> Ray3;
+typedef Line3T<double> Line3;
+
+typedef Point3T<float> Point3f;
+typedef Vector3T<float> Vector3f;
+typedef Ray3T<float> Ray3f;
+typedef Line3T<float> Line3f;
+
 /*
  * Global functions
  */
 
-double dot(Vector3 v1, Vector3 v2);
+template <typename T>
+constexpr T dot(const Vector3T<T> &v1, const Vector3T<T> &v2) {
+  return v1.dot(v2);
+}
 
-Vector3 cross(Vector3 v1, Vector3 v2);
+template <typename T>
+constexpr Vector3T<T> cross(const Vector3T<T> &v1, const Vector3T<T> &v2) {
+  return v1.cross(v2);
+}
 
-double length(Vector3 v);
+template <typename T> inline T length(const Vector3T<T> &v) {
+  return std::sqrt(v.dot(v));
+}
 
-Vector3 unit(Vector3 v);
+template <typename T> inline Vector3T<T> unit(const Vector3T<T> &v) {
+  return v / length(v);
+}
 
-Vector3 norm(Vector3 v);
+template <typename T> inline Vector3T<T> norm(const Vector3T<T> &v) {
+  return unit(v);
+}
 
+/*
+ * Conformance test for the geometry classes, asserts on failure
+ * Runs in both double and single precision
+ */
 int testGeom();
 
-Vector3 left(double distance);
-Vector3 right(double distance);
-Vector3 up(double distance);
-Vector3 down(double distance);
-Vector3 far(double distance);
-Vector3 near(double distance);
+constexpr Vector3 left(double distance) { return Vector3(-1, 0, 0); }
+constexpr Vector3 right(double distance) { return Vector3(1, 0, 0); }
+constexpr Vector3 up(double distance) { return Vector3(0, 1, 0); }
+constexpr Vector3 down(double distance) { return Vector3(0, -1, 0); }
+constexpr Vector3 far(double distance) { return Vector3(0, 0, -1); }
+constexpr Vector3 near(double distance) { return Vector3(0, 0, 1); }
@@ -1,6 +1,6 @@
 #include "Illumination.h"
 
-Vector3 Lighting::direction() { return lightDirection; }
+#include <limits>
 
 double Lighting::ambient() { return ambientIntensity; }
 
@@ -13,28 +13,189 @@ DirectionLight::DirectionLight(double intensity, Vector3 direction,
 
 double DirectionLight::intensity(Point3 p) { return lightIntensity; }
 
+bool DirectionLight::constants(LightConstants &c) {
+  c.kind = LightConstants::DIRECTION;
+  c.direction = lightDirection;
+  c.intensity = lightIntensity;
+  return true;
+}
+
+// Direction lights are infinitely far away
+double DirectionLight::distance(Point3 p) {
+  return numeric_limits<double>::infinity();
+}
+
 SpotLight::SpotLight(double intensity, Vector3 direction, double ambient,
-                     Point3 origin, double attenuation) {
+                     Point3 origin, double attenuation, double range) {
   this->lightIntensity = intensity;
   this->lightDirection = direction;
   this->ambientIntensity = ambient;
   this->origin = origin;
   this->attn = attenuation;
+  this->range = range;
+
+  // Without attenuation the light is the same in every direction
+  cosCutoff = attenuation > 0 ? pow(SPOT_CUTOFF, 1 / attenuation) : -1;
 }
 
 /*
  * Attenuates light by cos^attenuation(theta)
- * Reduces intensity as distance from direct hit increases
+ * Reduces intensity as distance from direct hit increases, with a window
+ * (1 - (d / range)^2)^2 that falls smoothly to 0 at range
  */
 double SpotLight::intensity(Point3 p) {
   Vector3 vToHit = p - this->origin;
 
-  double intens = max(dot(-unit(this->lightDirection), unit(vToHit)), 0.0);
-  intens = pow(intens, attn);
+  double cosine = dot(-unit(this->lightDirection), unit(vToHit));
+  if (cosCutoff >= 0 && cosine < cosCutoff) {
+    return 0;
+  }
+  double intens = pow(max(cosine, 0.0), attn);
+
+  if (range > 0) {
+    double d2 = vToHit.dot(vToHit) / (range * range);
+    intens *= d2 < 1 ? (1 - d2) * (1 - d2) : 0;
+  }
 
   return intens;
 }
 
+/*
+ * The cone out to range is held in the box of its apex and the disc
+ * across its end, clipped to the sphere of radius range
+ */
+bool SpotLight::bounds(BBox &box) {
+  if (range <= 0) {
+    return false;
+  }
+
+  double o[3] = {origin.getX(), origin.getY(), origin.getZ()};
+  Vector3 axis = -unit(lightDirection);
+  double a[3] = {axis.getXDir(), axis.getYDir(), axis.getZDir()};
+  for (int i = 0; i < 3; i++) {
+    box.min[i] = o[i] - range;
+    box.max[i] = o[i] + range;
+  }
+  if (cosCutoff <= 0) {
+    return true;
+  }
+
+  double radius = range * sqrt(1 - cosCutoff * cosCutoff) / cosCutoff;
+  for (int i = 0; i < 3; i++) {
+    double end = o[i] + a[i] * range;
+    double spread = radius * sqrt(max(1 - a[i] * a[i], 0.0));
+    box.min[i] = max(box.min[i], min(o[i], end - spread));
+    box.max[i] = min(box.max[i], max(o[i], end + spread));
+  }
+  return true;
+}
+
+bool SpotLight::reaches(Point3 p) {
+  Vector3 vToHit = p - this->origin;
+  double length2 = vToHit.dot(vToHit);
+  if (range > 0 && length2 >= range * range) {
+    return false;
+  }
+  return cosCutoff < 0 ||
+         dot(-unit(this->lightDirection), vToHit) >= cosCutoff * sqrt(length2);
+}
+
+bool SpotLight::constants(LightConstants &c) {
+  c.kind = LightConstants::SPOT;
+  c.direction = lightDirection;
+  c.intensity = 1;
+  c.origin = origin;
+  c.attenuation = attn;
+  c.cosCutoff = cosCutoff;
+  c.range = range;
+  return true;
+}
+
+/*
+ * Shadow rays leave along the light's direction, so only geometry
+ * between p and the plane through the light's origin can block them
+ */
+double SpotLight::distance(Point3 p) {
+  return dot(origin - p, unit(lightDirection));
+}
+
+RectLight::RectLight(double intensity, Point3 corner, Vector3 edge1,
+                     Vector3 edge2, double ambient) {
+  this->lightIntensity = intensity;
+  this->ambientIntensity = ambient;
+  this->corner = corner;
+  this->edge1 = edge1;
+  this->edge2 = edge2;
+  this->centre = corner + (edge1 + edge2) / 2;
+  this->normal = unit(cross(edge1, edge2));
+  this->lightDirection = -normal;
+}
+
+double RectLight::intensity(Point3 p) {
+  return reaches(p) ? lightIntensity : 0;
+}
+
+Vector3 RectLight::direction(Point3 p) { return unit(centre - p); }
+
+double RectLight::distance(Point3 p) { return (centre - p).length(); }
+
+bool RectLight::reaches(Point3 p) { return dot(p - centre, normal) > 0; }
+
+Point3 RectLight::samplePoint(Point3 p, double u, double v) {
+  return corner + edge1 * u + edge2 * v;
+}
+
+SphereLight::SphereLight(double intensity, Point3 centre, double radius,
+                         double ambient) {
+  this->lightIntensity = intensity;
+  this->ambientIntensity = ambient;
+  this->centre = centre;
+  this->radius = radius;
+  this->lightDirection = Vector3(0, -1, 0);
+}
+
+double SphereLight::intensity(Point3 p) {
+  return reaches(p) ? lightIntensity : 0;
+}
+
+Vector3 SphereLight::direction(Point3 p) { return unit(centre - p); }
+
+double SphereLight::distance(Point3 p) {
+  return (centre - p).length() - radius;
+}
+
+// Points inside the ball aren't lit by it
+bool SphereLight::reaches(Point3 p) {
+  Vector3 toP = p - centre;
+  return toP.dot(toP) > radius * radius;
+}
+
+/*
+ * Maps u, v onto the disc facing p with Shirley and Chiu's concentric
+ * mapping, which keeps strata compact and sends the corners of the
+ * square to the rim of the disc
+ */
+Point3 SphereLight::samplePoint(Point3 p, double u, double v) {
+  Vector3 axis = unit(centre - p);
+  Vector3 helper =
+      fabs(axis.getXDir()) < 0.9 ? Vector3(1, 0, 0) : Vector3(0, 1, 0);
+  Vector3 s = unit(cross(axis, helper));
+  Vector3 t = cross(axis, s);
+
+  double a = 2 * u - 1;
+  double b = 2 * v - 1;
+  double r = 0;
+  double phi = 0;
+  if (fabs(a) > fabs(b)) {
+    r = a;
+    phi = (PI / 4) * (b / a);
+  } else if (b != 0) {
+    r = b;
+    phi = (PI / 2) - (PI / 4) * (a / b);
+  }
+  return centre + (s * cos(phi) + t * sin(phi)) * (r * radius);
+}
+
 Material::Material(Colour diffuse, Colour specular, double shininess,
                    double reflectiveness, double alpha,
                    double refractiveIndex) {
@@ -44,13 +205,14 @@ Material::Material(Colour diffuse, Colour specular, double shininess,
   this->reflectCoef = reflectiveness;
   this->alpha = alpha;
   this->refract = refractiveIndex;
+  texture = NULL;
   isTexture = false;
 }
 
-Material::Material(STGA texture, Colour specular, double shininess,
+Material::Material(int texture, Colour specular, double shininess,
                    double reflectiveness, double alpha,
                    double refractiveIndex) {
-  this->texture = texture;
+  this->texture = TextureCache::instance().get(texture);
   this->specularColour = specular;
   this->shininessAmount = shininess;
   this->reflectCoef = reflectiveness;
@@ -59,34 +221,55 @@ Material::Material(STGA texture, Colour specular, double shininess,
   isTexture = true;
 }
 
-Colour Material::lit_colour(Point3 pos, double u, double v, Vector3 normal,
-                            Lighting *light, Vector3 view, bool isShadowed) {
-  // I = Ka Ia + Kd Is max(0, L . N) + Ks Is (max(0, H.N)) ^ n
-  Colour i;
+// Texture lookups go into a local so materials can be shared
+// between threads
+Colour Material::baseColour(double u, double v, double footprintU,
+                            double footprintV) {
   if (isTexture) {
-    diffuseColour = posColour(u, v, texture);
-  }
-
-  // Ka * Ia ambient
-  i = diffuseColour * light->ambient();
-
-  if (isShadowed) {
-    return i;
+    return posColour(u, v, footprintU, footprintV);
   }
+  return diffuseColour;
+}
 
+void Material::addDirect(Colour &i, Colour base, Point3 pos, Vector3 normal,
+                         Lighting *light, Vector3 view) {
   // Kd * Is diffuse
-  i += (diffuseColour * light->intensity(pos)) *
-       max(0.0, (light->direction().dot(normal)));
+  Vector3 toLight = light->direction(pos);
+  i += (base * light->intensity(pos)) * max(0.0, (toLight.dot(normal)));
 
   if (shininessAmount == 0) {
-    return i;
+    return;
   }
 
   // Ks * Is specular
-  Vector3 h = norm(light->direction() + view);
+  Vector3 h = norm(toLight + view);
   i += (specularColour * light->intensity(pos)) *
        pow(max(0.0, h.dot(normal)), shininessAmount);
+}
+
+Colour Material::lit_colour(Point3 pos, double u, double v, Vector3 normal,
+                            Lighting *light, Vector3 view, bool isShadowed,
+                            double footprintU, double footprintV) {
+  // I = Ka Ia + Kd Is max(0, L . N) + Ks Is (max(0, H.N)) ^ n
+  Colour base = baseColour(u, v, footprintU, footprintV);
+
+  // Ka * Ia ambient
+  Colour i = base * light->ambient();
+
+  if (!isShadowed) {
+    addDirect(i, base, pos, normal, light, view);
+  }
+  return i;
+}
 
+Colour Material::shaded_colour(double u, double v, double ambient,
+                               double diffuse, double specular,
+                               double footprintU, double footprintV) {
+  // I = Ka Ia + Kd sum(Is max(0, L . N)) + Ks sum(Is max(0, H.N) ^ n)
+  Colour i = baseColour(u, v, footprintU, footprintV) * (ambient + diffuse);
+  if (specular > 0) {
+    i += specularColour * specular;
+  }
   return i;
 }
 
@@ -98,30 +281,17 @@ double Material::shininess() { return shininessAmount; }
 
 double Material::reflCoef() { return reflectCoef; }
 
-/*
- * Returns the colour at a position u, v on a texture
- */
-Colour Material::posColour(double u, double v, STGA texture) {
-  Colour c;
-  int texWidth = texture.width;
-  int texHeight = texture.height;
-
-  // This allows us to loop a texture if we aren't using uv 0 - 1
-  int xOffset = (int)abs(floor(u * texWidth)) % texWidth;
-  int yOffset = (int)abs(floor(v * texHeight)) % texHeight;
-
-  // Get the index in 1d array for our position, multiply by 3 to account for
-  // each channel
-  int index = 3 * (yOffset * texWidth + xOffset);
-
-  // TGA stores in BGR order
-  float b = ((float)texture.data[index]) / 255.0f;
-  float g = ((float)texture.data[index + 1]) / 255.0f;
-  float r = ((float)texture.data[index + 2]) / 255.0f;
+double Material::opacity() { return alpha; }
 
-  c = Colour(r, g, b);
+double Material::refractiveIndex() { return refract; }
 
-  return c;
+/*
+ * Returns the colour at a position u, v on a texture, filtered over the
+ * footprint of the sample
+ */
+Colour Material::posColour(double u, double v, double footprintU,
+                           double footprintV) {
+  return texture->sample(u, v, footprintU, footprintV);
 }
 
 bool Material::isTex() { return isTexture; }
@@ -5,11 +5,27 @@
 
 #pragma once
 
+#include "BBox.h"
 #include "Colour.h"
 #include "GeomX.h"
 #include "TGAReader.h"
+#include "TextureCache.h"
 #include "pi.h"
 
+/*
+ * LightConstants
+ * What LightTable needs to light points with a light without calling it
+ */
+struct LightConstants {
+  enum Kind { DIRECTION, SPOT } kind;
+  Vector3 direction; // Towards the light
+  double intensity;  // Of a direction light, spot lights peak at 1
+  Point3 origin;     // The rest are for spot lights only
+  double attenuation;
+  double cosCutoff; // Below 0 if the cone has no edge
+  double range;     // 0 for no range
+};
+
 /*
  * Abstract class Lighting
  * Contains an intensity, direction and ambient
@@ -27,16 +43,60 @@ public:
    */
   virtual double intensity(Point3 p) = 0;
   /*
-   * direction()
-   * @return Vector3 a vector pointing towards the light
+   * direction(Point3 p)
+   * @return Vector3 a unit vector from p pointing towards the light
    */
-  Vector3 direction();
+  virtual Vector3 direction(Point3 p) { return lightDirection; }
 
   /*
    * ambient()
    * @return double the level of ambient light
    */
   double ambient();
+
+  /*
+   * distance(Point3 p)
+   * @return double how far along direction(p) from p the light is,
+   * anything further can't shadow p
+   */
+  virtual double distance(Point3 p) = 0;
+
+  /*
+   * bounds(BBox &box)
+   * Sets box around everywhere the light reaches, returns false if the
+   * light isn't bounded, as a direction light isn't
+   */
+  virtual bool bounds(BBox &box) { return false; }
+
+  /*
+   * reaches(Point3 p)
+   * @return bool false if intensity(p) is 0, a quick test before shading
+   */
+  virtual bool reaches(Point3 p) { return true; }
+
+  /*
+   * isArea()
+   * @return bool true if the light has a surface, so casts soft shadows
+   * sampled through samplePoint rather than one shadow ray along
+   * direction(p)
+   */
+  virtual bool isArea() { return false; }
+
+  /*
+   * samplePoint(Point3 p, double u, double v)
+   * @return Point3 the point of the light's surface, as seen from p, at
+   * u, v in [0, 1) x [0, 1). Only area lights have one
+   */
+  virtual Point3 samplePoint(Point3 p, double u, double v) { return p; }
+
+  /*
+   * constants(LightConstants &c)
+   * Fills in c, returning false if the light can't be described by
+   * constants and must be asked for its intensity and direction
+   */
+  virtual bool constants(LightConstants &c) { return false; }
+
+  virtual ~Lighting() {}
 };
 
 /*
@@ -48,21 +108,79 @@ class DirectionLight : public Lighting {
 public:
   DirectionLight(double intensity, Vector3 direction, double ambient);
   double intensity(Point3 p);
+  double distance(Point3 p);
+  bool constants(LightConstants &c);
 };
 
+// Fraction of its peak below which a spot light counts as dark, which
+// gives its cone an edge
+#define SPOT_CUTOFF 0.001
+
 /*
  * SpotLight
  * concrete subclass of lighting
- * attenuates light by cos^attn(theta)
+ * attenuates light by cos^attn(theta), and to nothing at range from its
+ * origin if it has one
  */
 class SpotLight : public Lighting {
   Point3 origin;
   double attn;
+  double range;     // 0 for no falloff with distance
+  double cosCutoff; // Cosine of the angle where the cone goes dark
 
 public:
   SpotLight(double intensity, Vector3 direction, double ambient, Point3 origin,
-            double attenuation);
+            double attenuation, double range);
+  double intensity(Point3 p);
+  double distance(Point3 p);
+  bool bounds(BBox &box);
+  bool reaches(Point3 p);
+  bool constants(LightConstants &c);
+};
+
+/*
+ * RectLight
+ * concrete subclass of lighting
+ * A parallelogram corner + s edge1 + t edge2 that shines from the side
+ * edge1 x edge2 points to, casting soft shadows
+ */
+class RectLight : public Lighting {
+  Point3 corner;
+  Vector3 edge1;
+  Vector3 edge2;
+  Point3 centre;
+  Vector3 normal; // Unit, on the lit side
+
+public:
+  RectLight(double intensity, Point3 corner, Vector3 edge1, Vector3 edge2,
+            double ambient);
   double intensity(Point3 p);
+  Vector3 direction(Point3 p);
+  double distance(Point3 p);
+  bool reaches(Point3 p);
+  bool isArea() { return true; }
+  Point3 samplePoint(Point3 p, double u, double v);
+};
+
+/*
+ * SphereLight
+ * concrete subclass of lighting
+ * A glowing ball lighting every direction, casting soft shadows. Seen
+ * from far off relative to its radius it is sampled as the disc it looks
+ * like
+ */
+class SphereLight : public Lighting {
+  Point3 centre;
+  double radius;
+
+public:
+  SphereLight(double intensity, Point3 centre, double radius, double ambient);
+  double intensity(Point3 p);
+  Vector3 direction(Point3 p);
+  double distance(Point3 p);
+  bool reaches(Point3 p);
+  bool isArea() { return true; }
+  Point3 samplePoint(Point3 p, double u, double v);
 };
 
 /*
@@ -71,7 +189,7 @@ public:
  * Is responsible for calculating the colour at a point
  */
 class Material {
-  STGA texture;
+  const Texture *texture; // Shared through the TextureCache
   Colour diffuseColour;
   Colour specularColour;
   double shininessAmount;
@@ -79,7 +197,13 @@ class Material {
   double alpha;
   double refract;
   bool isTexture;
-  Colour posColour(double u, double v, STGA texture);
+
+  // Diffuse colour at u, v, from the texture if there is one
+  Colour baseColour(double u, double v, double footprintU, double footprintV);
+
+  // Adds the diffuse and specular light from one light to i
+  void addDirect(Colour &i, Colour base, Point3 pos, Vector3 normal,
+                 Lighting *light, Vector3 view);
 
 public:
   // Empty constructor allows us to pass Material instances into methods
@@ -87,15 +211,27 @@ public:
   // Constructs a Material with a base colour
   Material(Colour diffuse, Colour specular, double shininess,
            double reflectiveness, double alpha, double refractiveIndex);
-  // Constructs a Material with a texture file
-  Material(STGA texture, Colour specular, double shininess,
+  // Constructs a Material with a texture from the TextureCache
+  Material(int texture, Colour specular, double shininess,
            double reflectiveness, double transparency, double refractiveIndex);
   // Calculates the colour at a given point
+  // footprintU and footprintV are the width of texture covered by the
+  // sample, in u and in v units
   Colour lit_colour(Point3 pos, double u, double v, Vector3 normal,
-                    Lighting *light, Vector3 view, bool isShadowed);
+                    Lighting *light, Vector3 view, bool isShadowed,
+                    double footprintU, double footprintV);
+  // Colour from the ambient, diffuse and specular levels of all of a
+  // point's lights together, as summed by LightTable::shade
+  Colour shaded_colour(double u, double v, double ambient, double diffuse,
+                       double specular, double footprintU, double footprintV);
+  // Texture colour at u, v, only meaningful if isTex() is true
+  Colour posColour(double u, double v, double footprintU, double footprintV);
   Colour diffuse();
   Colour specular();
   double shininess();
   double reflCoef();
+  // 1 for an opaque material, 0 lets all light through
+  double opacity();
+  double refractiveIndex();
   bool isTex();
 };
@@ -0,0 +1,260 @@
+#include "ImageOutput.h"
+#include "Stats.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// TGA packets hold up to 128 pixels
+#define TGA_PACKET 128
+
+ImageOutput::ImageOutput(bool compress) {
+  this->compress = compress;
+  writing = false;
+  stopping = false;
+  failed = false;
+  worker = thread(&ImageOutput::run, this);
+}
+
+ImageFormat ImageOutput::format(const string &fileName) {
+  size_t dot = fileName.rfind('.');
+  string extension = dot == string::npos ? "" : fileName.substr(dot);
+  if (extension == ".ppm" || extension == ".PPM") {
+    return IMAGE_PPM;
+  }
+  if (extension == ".pfm" || extension == ".PFM") {
+    return IMAGE_PFM;
+  }
+  return compress ? IMAGE_TGA_RLE : IMAGE_TGA;
+}
+
+void ImageOutput::write(TGAWriter *image, const string &fileName, bool fill) {
+  Job *job = new Job();
+  job->fileName = fileName;
+  job->format = format(fileName);
+  job->width = image->getWidth();
+  job->height = image->getHeight();
+  if (job->format == IMAGE_PFM) {
+    image->toFloats(job->radiance, fill);
+  } else {
+    image->toBytes(job->pixels, fill);
+  }
+  queue(job);
+}
+
+void ImageOutput::write(int width, int height,
+                        const vector<unsigned char> &pixels,
+                        const string &fileName) {
+  Job *job = new Job();
+  job->fileName = fileName;
+  job->format = format(fileName);
+  job->width = width;
+  job->height = height;
+  if (job->format == IMAGE_PFM) {
+    job->radiance.resize(pixels.size());
+    for (size_t i = 0; i < pixels.size(); i += 3) {
+      job->radiance[i] = pixels[i + 2] / 255.0f;
+      job->radiance[i + 1] = pixels[i + 1] / 255.0f;
+      job->radiance[i + 2] = pixels[i] / 255.0f;
+    }
+  } else {
+    job->pixels = pixels;
+  }
+  queue(job);
+}
+
+void ImageOutput::queue(Job *job) {
+  {
+    lock_guard<mutex> guard(lock);
+    jobs.push_back(job);
+  }
+  queued.notify_one();
+}
+
+bool ImageOutput::finish() {
+  unique_lock<mutex> guard(lock);
+  finished.wait(guard, [this] { return jobs.empty() && !writing; });
+  bool ok = !failed;
+  failed = false;
+  return ok;
+}
+
+void ImageOutput::run() {
+  unique_lock<mutex> guard(lock);
+  while (true) {
+    queued.wait(guard, [this] { return !jobs.empty() || stopping; });
+    if (jobs.empty()) {
+      return;
+    }
+
+    Job *job = jobs.front();
+    jobs.pop_front();
+    writing = true;
+
+    guard.unlock();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool ok = save(job);
+    Stats::addPhase("write", chrono::duration<double>(
+                                 chrono::steady_clock::now() - start)
+                                 .count());
+    delete job;
+    guard.lock();
+
+    writing = false;
+    if (!ok) {
+      failed = true;
+    }
+    if (jobs.empty()) {
+      finished.notify_all();
+    }
+  }
+}
+
+/*
+ * Appends the pixels of one row as TGA packets. Runs of two or more equal
+ * pixels become run packets, everything between them raw packets.
+ * Packets never cross rows, as the format recommends.
+ */
+static void encodeRow(const unsigned char *row, int width,
+                      vector<unsigned char> &out) {
+  int x = 0;
+  while (x < width) {
+    // Length of the run of equal pixels starting at x
+    int run = 1;
+    while (x + run < width && run < TGA_PACKET &&
+           memcmp(row + 3 * x, row + 3 * (x + run), 3) == 0) {
+      run++;
+    }
+
+    if (run > 1) {
+      out.push_back((unsigned char)(0x80 | (run - 1)));
+      out.insert(out.end(), row + 3 * x, row + 3 * x + 3);
+      x += run;
+      continue;
+    }
+
+    // Raw pixels until the next run starts
+    int count = 1;
+    while (x + count < width && count < TGA_PACKET &&
+           (x + count + 1 >= width ||
+            memcmp(row + 3 * (x + count), row + 3 * (x + count + 1), 3) !=
+                0)) {
+      count++;
+    }
+    out.push_back((unsigned char)(count - 1));
+    out.insert(out.end(), row + 3 * x, row + 3 * (x + count));
+    x += count;
+  }
+}
+
+bool ImageOutput::save(Job *job) {
+  int width = job->width;
+  int height = job->height;
+  vector<unsigned char> header;
+  vector<unsigned char> encoded;
+  const unsigned char *body = job->pixels.data();
+  size_t bodySize = job->pixels.size();
+
+  if (job->format == IMAGE_PFM) {
+    // PFM stores floats bottom row first, a negative scale marking them
+    // as little endian
+    uint16_t order = 1;
+    bool little = *(unsigned char *)&order == 1;
+    char text[64];
+    snprintf(text, sizeof(text), "PF\n%d %d\n%s\n", width, height,
+             little ? "-1.0" : "1.0");
+    header.assign(text, text + strlen(text));
+
+    body = (const unsigned char *)job->radiance.data();
+    bodySize = job->radiance.size() * sizeof(float);
+  } else if (job->format == IMAGE_PPM) {
+    // PPM stores RGB from the top row down
+    char text[64];
+    snprintf(text, sizeof(text), "P6\n%d %d\n255\n", width, height);
+    header.assign(text, text + strlen(text));
+
+    encoded.resize(bodySize);
+    for (int y = 0; y < height; y++) {
+      const unsigned char *in = body + 3 * (size_t)(height - 1 - y) * width;
+      unsigned char *out = &encoded[3 * (size_t)y * width];
+      for (int x = 0; x < width; x++) {
+        out[3 * x] = in[3 * x + 2];
+        out[3 * x + 1] = in[3 * x + 1];
+        out[3 * x + 2] = in[3 * x];
+      }
+    }
+    body = encoded.data();
+  } else {
+    unsigned char tga[18] = {0};
+    tga[2] = job->format == IMAGE_TGA_RLE ? 10 : 2;
+    tga[12] = (unsigned char)(width & 0x00FF);
+    tga[13] = (unsigned char)((width & 0xFF00) / 256);
+    tga[14] = (unsigned char)(height & 0x00FF);
+    tga[15] = (unsigned char)((height & 0xFF00) / 256);
+    tga[16] = 24;
+    header.assign(tga, tga + sizeof(tga));
+
+    if (job->format == IMAGE_TGA_RLE) {
+      encoded.reserve(bodySize / 2);
+      for (int y = 0; y < height; y++) {
+        encodeRow(body + 3 * (size_t)y * width, width, encoded);
+      }
+      body = encoded.data();
+      bodySize = encoded.size();
+    }
+  }
+
+  string partName = job->fileName + ".part";
+  int fd = open(partName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  // Header and body go out in one call, resumed after short writes and
+  // interruptions. A file that can't be finished is removed
+  struct iovec parts[2];
+  parts[0].iov_base = header.data();
+  parts[0].iov_len = header.size();
+  parts[1].iov_base = (void *)body;
+  parts[1].iov_len = bodySize;
+  int first = 0;
+  while (first < 2) {
+    ssize_t written = writev(fd, parts + first, 2 - first);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written < 0) {
+      close(fd);
+      unlink(partName.c_str());
+      return false;
+    }
+    while (first < 2 && (size_t)written >= parts[first].iov_len) {
+      written -= parts[first].iov_len;
+      first++;
+    }
+    if (first < 2) {
+      parts[first].iov_base = (char *)parts[first].iov_base + written;
+      parts[first].iov_len -= written;
+    }
+  }
+
+  if (close(fd) != 0 || rename(partName.c_str(), job->fileName.c_str()) != 0) {
+    unlink(partName.c_str());
+    return false;
+  }
+  return true;
+}
+
+ImageOutput::~ImageOutput() {
+  {
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+  }
+  queued.notify_one();
+  worker.join();
+}
@@ -0,0 +1,92 @@
+/*
+ * ImageOutput.h
+ * Contains the ImageOutput class, which encodes and writes images on a
+ * background thread so rendering doesn't wait for the disk.
+ *
+ * An image is converted to bytes when it is queued, so its TGAWriter can
+ * be reused straight away. Encoding and writing happen on the output
+ * thread, in the order images were queued. Files are written beside
+ * their destination and renamed into place, so readers never see one
+ * half written. Time spent writing is added to the "write" phase of the
+ * render statistics.
+ */
+
+#pragma once
+
+#include "TGAWriter.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+enum ImageFormat {
+  IMAGE_TGA,     // Uncompressed TGA, type 2
+  IMAGE_TGA_RLE, // Run length encoded TGA, type 10
+  IMAGE_PPM,     // Binary PPM, P6
+  IMAGE_PFM      // Float RGB PFM, PF, keeping radiance above one
+};
+
+class ImageOutput {
+
+  // An image waiting to be written
+  struct Job {
+    string fileName;
+    ImageFormat format;
+    int width;
+    int height;
+    vector<unsigned char> pixels; // BGR, bottom row first
+    vector<float> radiance;       // RGB, bottom row first, for PFM files
+  };
+
+  bool compress; // Run length encode TGA files
+
+  thread worker;
+  mutex lock;
+  condition_variable queued;   // Signalled when a job is queued
+  condition_variable finished; // Signalled when the queue empties
+  deque<Job *> jobs;
+  bool writing;  // The worker holds a job taken from the queue
+  bool stopping; // The worker should exit once the queue is empty
+  bool failed;   // Any image since the last finish couldn't be written
+
+  void run();
+
+  void queue(Job *job);
+
+  // Encodes and writes a job, returns false if the file can't be written
+  static bool save(Job *job);
+
+  ImageOutput(const ImageOutput &);
+  ImageOutput &operator=(const ImageOutput &);
+
+public:
+  // TGA files are run length encoded if compress is set
+  ImageOutput(bool compress);
+
+  // Format a file is written in, picked from its extension
+  ImageFormat format(const string &fileName);
+
+  /*
+   * Queues the image to be written to fileName, returning once it has
+   * been converted. fill allows an unfinished image, as TGAWriter::toBytes.
+   * PFM files get the image's radiance, everything else its tone mapped
+   * bytes
+   */
+  void write(TGAWriter *image, const string &fileName, bool fill);
+
+  // Queues an image already in bytes, 8 bit BGR bottom row first.
+  // Written as PFM it only holds the 0 - 1 range of the bytes
+  void write(int width, int height, const vector<unsigned char> &pixels,
+             const string &fileName);
+
+  // Waits for every queued image, returns false if any couldn't be written
+  bool finish();
+
+  // Writes anything still queued before returning
+  ~ImageOutput();
+};
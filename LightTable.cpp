@@ -0,0 +1,123 @@
+#include "LightTable.h"
+
+#include <cmath>
+
+LightTable::LightTable(const vector<Lighting *> &sceneLights) {
+  lights = sceneLights;
+  totalAmbient = 0;
+
+  int count = (int)lights.size();
+  kind.resize(count);
+  dirX.resize(count);
+  dirY.resize(count);
+  dirZ.resize(count);
+  level.resize(count);
+  originX.resize(count);
+  originY.resize(count);
+  originZ.resize(count);
+  axisX.resize(count);
+  axisY.resize(count);
+  axisZ.resize(count);
+  attenuation.resize(count);
+  cosCutoff.resize(count);
+  rangeScale.resize(count);
+
+  for (int i = 0; i < count; i++) {
+    totalAmbient += lights[i]->ambient();
+
+    LightConstants c;
+    if (!lights[i]->constants(c)) {
+      kind[i] = -1;
+      continue;
+    }
+    kind[i] = c.kind;
+    Vector3 direction = unit(c.direction);
+    dirX[i] = direction.getXDir();
+    dirY[i] = direction.getYDir();
+    dirZ[i] = direction.getZDir();
+    level[i] = c.intensity;
+    if (c.kind != LightConstants::SPOT) {
+      continue;
+    }
+
+    // A spot light shines back along its direction
+    originX[i] = c.origin.getX();
+    originY[i] = c.origin.getY();
+    originZ[i] = c.origin.getZ();
+    axisX[i] = -dirX[i];
+    axisY[i] = -dirY[i];
+    axisZ[i] = -dirZ[i];
+    attenuation[i] = c.attenuation;
+    cosCutoff[i] = c.cosCutoff;
+    rangeScale[i] = c.range > 0 ? 1 / (c.range * c.range) : 0;
+  }
+}
+
+void LightTable::shade(Point3 p, Vector3 normal, Vector3 view,
+                       double shininess, const LightChoice *chosen, int count,
+                       double &diffuse, double &specular) const {
+  double px = p.getX(), py = p.getY(), pz = p.getZ();
+  double nx = normal.getXDir(), ny = normal.getYDir(), nz = normal.getZDir();
+  double vx = view.getXDir(), vy = view.getYDir(), vz = view.getZDir();
+
+  diffuse = 0;
+  specular = 0;
+  for (int k = 0; k < count; k++) {
+    if (chosen[k].weight <= 0) {
+      continue;
+    }
+    int l = chosen[k].light;
+
+    double lx = dirX[l], ly = dirY[l], lz = dirZ[l];
+    double intensity = level[l];
+    if (kind[l] == LightConstants::SPOT) {
+      // cos^attenuation of the angle off the axis, cut off at the cone's
+      // edge, in the window (1 - (d / range)^2)^2
+      double tx = px - originX[l], ty = py - originY[l], tz = pz - originZ[l];
+      double d2 = tx * tx + ty * ty + tz * tz;
+      if (d2 == 0) {
+        // At the origin the light has no direction to p
+        continue;
+      }
+      double cosine =
+          (axisX[l] * tx + axisY[l] * ty + axisZ[l] * tz) / sqrt(d2);
+      if (cosCutoff[l] >= 0 && cosine < cosCutoff[l]) {
+        continue;
+      }
+      intensity = pow(max(cosine, 0.0), attenuation[l]);
+      if (rangeScale[l] > 0) {
+        double r2 = d2 * rangeScale[l];
+        intensity *= r2 < 1 ? (1 - r2) * (1 - r2) : 0;
+      }
+    } else if (kind[l] < 0) {
+      Vector3 toLight = lights[l]->direction(p);
+      lx = toLight.getXDir();
+      ly = toLight.getYDir();
+      lz = toLight.getZDir();
+      intensity = lights[l]->intensity(p);
+    }
+
+    intensity *= chosen[k].weight;
+    if (intensity == 0) {
+      continue;
+    }
+
+    // Kd * Is diffuse
+    diffuse += intensity * max(0.0, lx * nx + ly * ny + lz * nz);
+    if (shininess == 0) {
+      continue;
+    }
+
+    // Ks * Is specular, about the half vector between light and view
+    double hx = lx + vx, hy = ly + vy, hz = lz + vz;
+    double h2 = hx * hx + hy * hy + hz * hz;
+    if (h2 == 0) {
+      // Light and view are opposite, with no half vector between them
+      continue;
+    }
+    double hn = (hx * nx + hy * ny + hz * nz) / sqrt(h2);
+    if (hn > 0) {
+      specular += intensity * pow(hn, shininess);
+    }
+  }
+}
@@ -0,0 +1,66 @@
+/*
+ * LightTable.h
+ * Contains the LightTable class, the scene's lights laid out for shading
+ * a hit by all of its lights in one pass.
+ *
+ * The constants each light needs to light a point, its unit direction,
+ * its intensity and for spot lights the origin, cone axis, cutoff and
+ * range, are worked out once when the scene is built and kept one array
+ * per field. The kernel reads them straight from the arrays instead of
+ * calling through Lighting twice for every light at every hit. Lights
+ * without constants, such as area lights, are still asked through
+ * Lighting.
+ *
+ * Lights are white, so the kernel only sums two levels over a hit's
+ * lights: the diffuse and the specular light reaching it. The material
+ * turns them into a colour once, so a texture is sampled once per hit
+ * rather than once per light.
+ */
+
+#pragma once
+
+#include "GeomX.h"
+#include "Illumination.h"
+
+#include <vector>
+
+using namespace std;
+
+// A light to shade a point with, and the weight to give its light
+struct LightChoice {
+  int light; // Index in scene order
+  double weight;
+};
+
+class LightTable {
+  vector<Lighting *> lights; // In scene order, owned by the scene
+  vector<int> kind;          // A LightConstants::Kind, or -1 to ask the light
+  vector<double> dirX, dirY, dirZ;          // Unit, towards the light
+  vector<double> level;                     // Intensity of direction lights
+  vector<double> originX, originY, originZ; // Spot lights from here on
+  vector<double> axisX, axisY, axisZ;       // Unit, down the middle of the cone
+  vector<double> attenuation;
+  vector<double> cosCutoff;
+  vector<double> rangeScale; // 1 / range^2, 0 for no range
+  double totalAmbient;
+
+public:
+  LightTable(const vector<Lighting *> &sceneLights);
+
+  /*
+   * Sums the light from count chosen lights reaching p on a surface with
+   * the given normal and shininess, seen from the direction view. Each
+   * light's is scaled by its choice's weight, which for shading is its
+   * sampling weight times the share of it not in shadow.
+   *
+   * diffuse is set to the sum of weight * intensity * max(0, L . N), and
+   * specular to the sum of weight * intensity * max(0, H . N)^shininess,
+   * or 0 for a surface without shininess
+   */
+  void shade(Point3 p, Vector3 normal, Vector3 view, double shininess,
+             const LightChoice *chosen, int count, double &diffuse,
+             double &specular) const;
+
+  // Ambient level of every light together
+  double ambient() const { return totalAmbient; }
+};
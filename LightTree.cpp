@@ -0,0 +1,111 @@
+#include "LightTree.h"
+#include "RayTree.h"
+#include "Stats.h"
+
+#include <algorithm>
+
+// Salt for the hash placing light samples
+#define SALT_LIGHTS 0x4c69676874730000ULL
+
+// Share of a light's importance kept when it faces away from the normal,
+// as its specular light can still reach the viewer
+#define IMPORTANCE_FLOOR 0.1
+
+LightTree::LightTree(const list<Lighting *> &sceneLights)
+    : lights(sceneLights.begin(), sceneLights.end()), lightTable(lights) {
+  tree = NULL;
+
+  vector<BBox> boxes;
+  for (int i = 0; i < (int)lights.size(); i++) {
+    BBox box;
+    if (lights[i]->bounds(box)) {
+      bounded.push_back(i);
+      boxes.push_back(box);
+    } else {
+      unbounded.push_back(i);
+    }
+  }
+
+  if (!boxes.empty()) {
+    tree = new BVH(boxes);
+  }
+}
+
+bool LightTree::choose(Point3 p, Vector3 normal, const Ray3 &ray,
+                       int maxLights, vector<LightChoice> &chosen) {
+  chosen.clear();
+  for (size_t i = 0; i < unbounded.size(); i++) {
+    if (lights[unbounded[i]]->reaches(p)) {
+      chosen.push_back({unbounded[i], 1.0});
+    }
+  }
+  if (tree != NULL) {
+    size_t first = chosen.size();
+    tree->query(p, [&](int index) {
+      if (lights[bounded[index]]->reaches(p)) {
+        chosen.push_back({bounded[index], 1.0});
+      }
+    });
+    // Lights are shaded in scene order whichever way they were found
+    if (chosen.size() > first) {
+      sort(chosen.begin(), chosen.end(),
+           [](const LightChoice &a, const LightChoice &b) {
+             return a.light < b.light;
+           });
+    }
+  }
+  threadStats.lightsCulled += lights.size() - chosen.size();
+
+  int count = (int)chosen.size();
+  if (maxLights <= 0 || count <= maxLights) {
+    return false;
+  }
+
+  // Importance of each light, how brightly it might light p
+  static thread_local vector<double> importance;
+  static thread_local vector<LightChoice> candidates;
+  importance.resize(count);
+  double total = 0;
+  for (int i = 0; i < count; i++) {
+    Lighting *light = lights[chosen[i].light];
+    importance[i] =
+        light->intensity(p) *
+        (max(0.0, light->direction(p).dot(normal)) + IMPORTANCE_FLOOR);
+    total += importance[i];
+  }
+
+  candidates.swap(chosen);
+  chosen.clear();
+  if (total <= 0) {
+    threadStats.lightsUnsampled += count;
+    return true;
+  }
+
+  // Stratified draws, one in each of maxLights equal slices of the total
+  // importance, so bright lights are drawn about as often as they should
+  // be. A light drawn more than once is shaded once at the summed weight
+  double random = rayRandom(ray, SALT_LIGHTS);
+  int c = 0;
+  double cumulative = importance[0];
+  for (int k = 0; k < maxLights; k++) {
+    double u = (k + random) / maxLights * total;
+    while (u >= cumulative && c + 1 < count) {
+      c++;
+      cumulative += importance[c];
+    }
+    if (importance[c] <= 0) {
+      continue;
+    }
+
+    double weight = total / (maxLights * importance[c]);
+    if (!chosen.empty() && chosen.back().light == candidates[c].light) {
+      chosen.back().weight += weight;
+    } else {
+      chosen.push_back({candidates[c].light, weight});
+    }
+  }
+  threadStats.lightsUnsampled += count - chosen.size();
+  return true;
+}
+
+LightTree::~LightTree() { delete tree; }
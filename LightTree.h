@@ -0,0 +1,63 @@
+/*
+ * LightTree.h
+ * Contains the LightTree class, which finds the lights worth shading a
+ * point with, so scenes with many lights don't shade and shadow test
+ * every light at every hit.
+ *
+ * Lights that report bounds, such as spot lights with a range, are put
+ * in a BVH over their boxes and found by a point query. The rest are
+ * checked one by one. Either way a light is only kept if it reaches the
+ * point, so spot lights are skipped outside their cones.
+ *
+ * Lights that are skipped still add their ambient light, which doesn't
+ * depend on where they are, through the ambient level of the LightTable
+ * the tree holds for shading.
+ */
+
+#pragma once
+
+#include "BVH.h"
+#include "GeomX.h"
+#include "Illumination.h"
+#include "LightTable.h"
+
+#include <list>
+#include <vector>
+
+using namespace std;
+
+class LightTree {
+  vector<Lighting *> lights; // In scene order, owned by the scene
+  vector<int> unbounded;     // Lights checked at every point
+  vector<int> bounded;       // Light held by each primitive of the tree
+  BVH *tree;                 // Over the bounded lights, NULL if none
+  LightTable lightTable;     // The same lights, for shading
+
+  LightTree(const LightTree &);
+  LightTree &operator=(const LightTree &);
+
+public:
+  LightTree(const list<Lighting *> &sceneLights);
+
+  /*
+   * Finds the lights to shade p with.
+   *
+   * Normally every light that reaches p is chosen with weight 1, to be
+   * shaded in full, and false is returned.
+   *
+   * With maxLights above 0 and more lights than that reaching p, true is
+   * returned and maxLights draws are made instead, picking lights in
+   * proportion to how brightly they might light p. Their weights make
+   * the expected sum of their diffuse and specular light the full sum.
+   * The draws are placed by a hash of ray, the ray
+   * that hit p, so they don't depend on the thread or renderer.
+   */
+  bool choose(Point3 p, Vector3 normal, const Ray3 &ray, int maxLights,
+              vector<LightChoice> &chosen);
+
+  Lighting *light(int index) { return lights[index]; }
+  const LightTable &table() const { return lightTable; }
+  int size() { return (int)lights.size(); }
+
+  ~LightTree();
+};
@@ -0,0 +1,49 @@
+#include "MappedFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile() {
+  mapping = NULL;
+  length = 0;
+}
+
+bool MappedFile::open(const char *filename) {
+  close();
+
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+
+  void *address =
+      mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping holds its own reference to the file
+  ::close(fd);
+
+  if (address == MAP_FAILED) {
+    return false;
+  }
+
+  mapping = (const char *)address;
+  length = (size_t)info.st_size;
+  return true;
+}
+
+void MappedFile::close() {
+  if (mapping != NULL) {
+    munmap((void *)mapping, length);
+  }
+  mapping = NULL;
+  length = 0;
+}
+
+MappedFile::~MappedFile() { close(); }
@@ -0,0 +1,33 @@
+/*
+ * MappedFile.h
+ * Contains the MappedFile class, a read only memory mapping of a file.
+ * Loaders parse straight out of the mapping instead of reading the file
+ * into their own buffers.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+class MappedFile {
+  const char *mapping;
+  size_t length;
+
+  // Mappings can't be shared, so copying is not allowed
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+
+public:
+  MappedFile();
+
+  // Maps the whole file, returns false if it can't be opened
+  bool open(const char *filename);
+
+  // Unmaps the file, called automatically on destruction
+  void close();
+
+  const char *data() { return mapping; }
+  size_t size() { return length; }
+
+  ~MappedFile();
+};
@@ -0,0 +1,55 @@
+/*
+ * Merge.cpp
+ * Assembles a frame from the partial images written by raxar -k, one for
+ * every shard, and writes it like raxar would
+ */
+
+#include "ImageOutput.h"
+#include "PartialImage.h"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+int main(int argc, char *argv[]) {
+  const char *outputFile = "output.tga";
+  bool compress = false;
+  vector<const char *> partials;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      outputFile = argv[++i];
+    } else if (strcmp(argv[i], "-z") == 0) {
+      compress = true;
+    } else if (argv[i][0] == '-') {
+      partials.clear();
+      break;
+    } else {
+      partials.push_back(argv[i]);
+    }
+  }
+
+  if (partials.empty()) {
+    cout << "Usage: " << argv[0]
+         << " [-o output.tga|output.ppm] [-z] partial..." << endl;
+    return 1;
+  }
+
+  int width, height;
+  vector<unsigned char> pixels;
+  string error;
+  if (!mergePartials(partials, width, height, pixels, error)) {
+    cout << error << endl;
+    return 1;
+  }
+
+  ImageOutput output(compress);
+  output.write(width, height, pixels, outputFile);
+  if (!output.finish()) {
+    cout << "Error writing " << outputFile << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,681 @@
+#include "MeshLoader.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Chunks of an OBJ file handed to each thread
+#define CHUNKS_PER_THREAD 4
+
+/*
+ * Runs work(i) for i in [0, count) across up to threads threads
+ */
+static void parallelFor(int count, int threads, function<void(int)> work) {
+  threads = max(1, min(threads, count));
+  atomic<int> next(0);
+
+  vector<thread> pool;
+  for (int t = 0; t < threads; t++) {
+    pool.push_back(thread([&]() {
+      for (int i = next++; i < count; i = next++) {
+        work(i);
+      }
+    }));
+  }
+  for (vector<thread>::iterator it = pool.begin(); it != pool.end(); it++) {
+    it->join();
+  }
+}
+
+/*
+ * Text parsing helpers
+ * These work on [p, end) of the mapping, which is not null terminated
+ */
+
+static const char *skipSpaces(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  return p;
+}
+
+static const char *nextLine(const char *p, const char *end) {
+  const char *newline = (const char *)memchr(p, '\n', end - p);
+  return newline != NULL ? newline + 1 : end;
+}
+
+static bool isLineEnd(const char *p, const char *end) {
+  return p >= end || *p == '\n' || *p == '\r' || *p == '#';
+}
+
+static bool parseInt(const char *&p, const char *end, long &value) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+  if (p >= end || *p < '0' || *p > '9') {
+    return false;
+  }
+  value = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    value = value * 10 + (*p - '0');
+    p++;
+  }
+  if (negative) {
+    value = -value;
+  }
+  return true;
+}
+
+/*
+ * Parses a decimal float, much faster than strtod as it skips locale
+ * handling and exact rounding, which single precision vertices don't need
+ */
+static bool parseFloat(const char *&p, const char *end, float &value) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+
+  double result = 0;
+  bool digits = false;
+  while (p < end && *p >= '0' && *p <= '9') {
+    result = result * 10 + (*p - '0');
+    digits = true;
+    p++;
+  }
+  if (p < end && *p == '.') {
+    p++;
+    double scale = 0.1;
+    while (p < end && *p >= '0' && *p <= '9') {
+      result += (*p - '0') * scale;
+      scale *= 0.1;
+      digits = true;
+      p++;
+    }
+  }
+  if (!digits) {
+    return false;
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    p++;
+    long exponent;
+    if (!parseInt(p, end, exponent)) {
+      return false;
+    }
+    result *= pow(10.0, (double)exponent);
+  }
+
+  value = (float)(negative ? -result : result);
+  return true;
+}
+
+/*
+ * OBJ
+ */
+
+/*
+ * A chunk of whole lines in an OBJ file
+ * The first pass counts what the chunk holds, so the second pass can
+ * write its vertices and triangles straight into the shared arrays
+ */
+struct OBJChunk {
+  const char *start;
+  const char *end;
+  long vertexCount;
+  long triangleCount;
+  long vertexOffset;
+  long triangleOffset;
+  bool valid;
+};
+
+// Returns 'v' for a vertex line, 'f' for a face line, or 0 for others
+static char objLineType(const char *&p, const char *end) {
+  p = skipSpaces(p, end);
+  if (end - p >= 2 && (p[1] == ' ' || p[1] == '\t')) {
+    if (p[0] == 'v' || p[0] == 'f') {
+      char type = p[0];
+      p += 2;
+      return type;
+    }
+  }
+  return 0;
+}
+
+static void countOBJChunk(OBJChunk &chunk) {
+  chunk.vertexCount = 0;
+  chunk.triangleCount = 0;
+
+  for (const char *line = chunk.start; line < chunk.end;
+       line = nextLine(line, chunk.end)) {
+    const char *p = line;
+    char type = objLineType(p, chunk.end);
+    if (type == 'v') {
+      chunk.vertexCount++;
+    } else if (type == 'f') {
+      // Count the vertex references, a polygon of n fans to n - 2 triangles
+      int corners = 0;
+      p = skipSpaces(p, chunk.end);
+      while (!isLineEnd(p, chunk.end)) {
+        corners++;
+        while (!isLineEnd(p, chunk.end) && *p != ' ' && *p != '\t') {
+          p++;
+        }
+        p = skipSpaces(p, chunk.end);
+      }
+      chunk.triangleCount += max(corners - 2, 0);
+    }
+  }
+}
+
+/*
+ * Converts an OBJ index, which counts from 1 or backwards from the
+ * latest vertex when negative, to an index into the vertex array
+ */
+static bool objIndex(long index, long verticesSoFar, long vertexTotal,
+                     int &result) {
+  long resolved = index > 0 ? index - 1 : verticesSoFar + index;
+  if (index == 0 || resolved < 0 || resolved >= vertexTotal) {
+    return false;
+  }
+  result = (int)resolved;
+  return true;
+}
+
+static void parseOBJChunk(OBJChunk &chunk, MeshData &mesh) {
+  long vertex = chunk.vertexOffset;
+  int *tri = &mesh.indices[0] + 3 * chunk.triangleOffset;
+  long vertexTotal = (long)mesh.vertices.size();
+  chunk.valid = true;
+
+  for (const char *line = chunk.start; line < chunk.end;
+       line = nextLine(line, chunk.end)) {
+    const char *p = line;
+    char type = objLineType(p, chunk.end);
+
+    if (type == 'v') {
+      float c[3];
+      for (int a = 0; a < 3; a++) {
+        p = skipSpaces(p, chunk.end);
+        if (!parseFloat(p, chunk.end, c[a])) {
+          chunk.valid = false;
+          return;
+        }
+      }
+      mesh.vertices[vertex++] = Point3f(c[0], c[1], c[2]);
+    } else if (type == 'f') {
+      int first = 0;
+      int previous = 0;
+      int corners = 0;
+
+      p = skipSpaces(p, chunk.end);
+      while (!isLineEnd(p, chunk.end)) {
+        // Only the position is used from v/vt/vn
+        long index;
+        int resolved;
+        if (!parseInt(p, chunk.end, index) ||
+            !objIndex(index, vertex, vertexTotal, resolved)) {
+          chunk.valid = false;
+          return;
+        }
+        while (!isLineEnd(p, chunk.end) && *p != ' ' && *p != '\t') {
+          p++;
+        }
+        p = skipSpaces(p, chunk.end);
+
+        if (corners == 0) {
+          first = resolved;
+        } else if (corners >= 2) {
+          tri[0] = first;
+          tri[1] = previous;
+          tri[2] = resolved;
+          tri += 3;
+        }
+        previous = resolved;
+        corners++;
+      }
+    }
+  }
+}
+
+bool loadOBJ(const char *filename, MeshData &mesh, int threads) {
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  MappedFile file;
+  if (!file.open(filename)) {
+    return false;
+  }
+  const char *data = file.data();
+  const char *end = data + file.size();
+
+  // Split the file into chunks of whole lines
+  int chunkCount = max(1, threads * CHUNKS_PER_THREAD);
+  vector<OBJChunk> chunks;
+  const char *chunkStart = data;
+  for (int i = 1; i <= chunkCount && chunkStart < end; i++) {
+    const char *chunkEnd = data + (file.size() * i) / chunkCount;
+    if (i == chunkCount) {
+      chunkEnd = end;
+    } else {
+      chunkEnd = nextLine(max(chunkEnd, chunkStart), end);
+    }
+    OBJChunk chunk;
+    chunk.start = chunkStart;
+    chunk.end = chunkEnd;
+    chunks.push_back(chunk);
+    chunkStart = chunkEnd;
+  }
+
+  parallelFor((int)chunks.size(), threads,
+              [&](int i) { countOBJChunk(chunks[i]); });
+
+  // Each chunk's place in the arrays follows from the ones before it
+  long vertices = 0;
+  long triangles = 0;
+  for (vector<OBJChunk>::iterator it = chunks.begin(); it != chunks.end();
+       it++) {
+    it->vertexOffset = vertices;
+    it->triangleOffset = triangles;
+    vertices += it->vertexCount;
+    triangles += it->triangleCount;
+  }
+
+  if (triangles == 0) {
+    return false;
+  }
+
+  mesh.vertices.resize(vertices);
+  mesh.indices.resize(3 * triangles);
+
+  parallelFor((int)chunks.size(), threads,
+              [&](int i) { parseOBJChunk(chunks[i], mesh); });
+
+  for (vector<OBJChunk>::iterator it = chunks.begin(); it != chunks.end();
+       it++) {
+    if (!it->valid) {
+      return false;
+    }
+  }
+
+  mesh.bytes = file.size();
+  mesh.seconds =
+      chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  return true;
+}
+
+/*
+ * PLY
+ */
+
+struct PLYProperty {
+  string name;
+  int type;      // Size in bytes, negative for signed integers
+  bool isFloat;  // type is then 4 or 8
+  bool isList;   // A count of countType followed by that many values
+  int countType;
+};
+
+struct PLYElement {
+  string name;
+  long count;
+  vector<PLYProperty> properties;
+};
+
+/*
+ * Parses a PLY scalar type name, returning the size in bytes, negated
+ * for signed integers, or 0 if the name is unknown
+ */
+static int plyType(const string &name, bool &isFloat) {
+  isFloat = false;
+  if (name == "char" || name == "int8")
+    return -1;
+  if (name == "uchar" || name == "uint8")
+    return 1;
+  if (name == "short" || name == "int16")
+    return -2;
+  if (name == "ushort" || name == "uint16")
+    return 2;
+  if (name == "int" || name == "int32")
+    return -4;
+  if (name == "uint" || name == "uint32")
+    return 4;
+  isFloat = true;
+  if (name == "float" || name == "float32")
+    return 4;
+  if (name == "double" || name == "float64")
+    return 8;
+  return 0;
+}
+
+/*
+ * Reads a scalar of the given type, swapping bytes if the file's
+ * endianness differs from ours
+ */
+static double plyValue(const char *p, int type, bool isFloat, bool swap) {
+  unsigned char bytes[8];
+  int size = abs(type);
+  for (int i = 0; i < size; i++) {
+    bytes[i] = p[swap ? size - 1 - i : i];
+  }
+
+  if (isFloat) {
+    if (size == 4) {
+      float f;
+      memcpy(&f, bytes, 4);
+      return f;
+    }
+    double d;
+    memcpy(&d, bytes, 8);
+    return d;
+  }
+
+  switch (type) {
+  case -1: {
+    signed char v;
+    memcpy(&v, bytes, 1);
+    return v;
+  }
+  case 1:
+    return bytes[0];
+  case -2: {
+    short v;
+    memcpy(&v, bytes, 2);
+    return v;
+  }
+  case 2: {
+    unsigned short v;
+    memcpy(&v, bytes, 2);
+    return v;
+  }
+  case -4: {
+    int v;
+    memcpy(&v, bytes, 4);
+    return v;
+  }
+  default: {
+    unsigned int v;
+    memcpy(&v, bytes, 4);
+    return v;
+  }
+  }
+}
+
+/*
+ * Checks the elements' counts against the bytes after the header, where
+ * a record is at least its scalars and the counts of its lists, so a
+ * header can't claim more records than the file holds
+ */
+static bool plyFits(const vector<PLYElement> &elements, long bytes) {
+  for (vector<PLYElement>::const_iterator element = elements.begin();
+       element != elements.end(); element++) {
+    long record = 0;
+    for (vector<PLYProperty>::const_iterator prop =
+             element->properties.begin();
+         prop != element->properties.end(); prop++) {
+      record += abs(prop->isList ? prop->countType : prop->type);
+    }
+    if (record == 0) {
+      continue;
+    }
+    if (element->count > bytes / record) {
+      return false;
+    }
+    bytes -= element->count * record;
+  }
+  return true;
+}
+
+/*
+ * Reads the header up to end_header, leaving p at the binary data
+ */
+static bool parsePLYHeader(const char *&p, const char *end, bool &swap,
+                           vector<PLYElement> &elements) {
+  bool first = true;
+  bool hasFormat = false;
+
+  while (p < end) {
+    const char *lineEnd = (const char *)memchr(p, '\n', end - p);
+    if (lineEnd == NULL) {
+      return false;
+    }
+    string line(p, lineEnd);
+    p = lineEnd + 1;
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+
+    vector<string> words;
+    size_t pos = 0;
+    while (pos < line.size()) {
+      size_t wordEnd = line.find(' ', pos);
+      if (wordEnd == string::npos)
+        wordEnd = line.size();
+      if (wordEnd > pos)
+        words.push_back(line.substr(pos, wordEnd - pos));
+      pos = wordEnd + 1;
+    }
+    if (words.empty()) {
+      continue;
+    }
+
+    if (first) {
+      if (words[0] != "ply")
+        return false;
+      first = false;
+    } else if (words[0] == "format" && words.size() >= 2) {
+      // Check our own byte order against the file's
+      unsigned int probe = 1;
+      unsigned char little;
+      memcpy(&little, &probe, 1);
+      if (words[1] == "binary_little_endian") {
+        swap = little != 1;
+      } else if (words[1] == "binary_big_endian") {
+        swap = little == 1;
+      } else {
+        return false; // ASCII PLY is not supported
+      }
+      hasFormat = true;
+    } else if (words[0] == "element" && words.size() >= 3) {
+      PLYElement element;
+      element.name = words[1];
+      char *countEnd;
+      element.count = strtol(words[2].c_str(), &countEnd, 10);
+      if (*countEnd != '\0' || element.count < 0)
+        return false;
+      elements.push_back(element);
+    } else if (words[0] == "property" && !elements.empty()) {
+      PLYProperty property;
+      if (words.size() >= 5 && words[1] == "list") {
+        bool countFloat;
+        property.isList = true;
+        property.countType = plyType(words[2], countFloat);
+        property.type = plyType(words[3], property.isFloat);
+        property.name = words[4];
+        if (countFloat || property.countType == 0)
+          return false;
+      } else if (words.size() >= 3) {
+        property.isList = false;
+        property.countType = 0;
+        property.type = plyType(words[1], property.isFloat);
+        property.name = words[2];
+      } else {
+        return false;
+      }
+      if (property.type == 0)
+        return false;
+      elements.back().properties.push_back(property);
+    } else if (words[0] == "end_header") {
+      return hasFormat && plyFits(elements, end - p);
+    }
+  }
+
+  return false;
+}
+
+bool loadPLY(const char *filename, MeshData &mesh, int threads) {
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  MappedFile file;
+  if (!file.open(filename)) {
+    return false;
+  }
+  const char *p = file.data();
+  const char *end = p + file.size();
+
+  bool swap = false;
+  vector<PLYElement> elements;
+  if (!parsePLYHeader(p, end, swap, elements)) {
+    return false;
+  }
+
+  long vertexTotal = 0;
+  for (vector<PLYElement>::iterator element = elements.begin();
+       element != elements.end(); element++) {
+
+    // Work out where x, y and z sit, and whether records are fixed size
+    int stride = 0;
+    int offsets[3] = {-1, -1, -1};
+    bool fixed = true;
+    for (vector<PLYProperty>::iterator prop = element->properties.begin();
+         prop != element->properties.end(); prop++) {
+      if (prop->isList) {
+        fixed = false;
+        break;
+      }
+      if (prop->name == "x")
+        offsets[0] = stride;
+      if (prop->name == "y")
+        offsets[1] = stride;
+      if (prop->name == "z")
+        offsets[2] = stride;
+      stride += abs(prop->type);
+    }
+
+    if (element->name == "vertex") {
+      if (!fixed || offsets[0] < 0 || offsets[1] < 0 || offsets[2] < 0 ||
+          end - p < (long)stride * element->count) {
+        return false;
+      }
+
+      // Fixed size records, so the vertices split evenly across threads
+      const PLYProperty *props[3] = {NULL, NULL, NULL};
+      for (vector<PLYProperty>::iterator prop = element->properties.begin();
+           prop != element->properties.end(); prop++) {
+        for (int a = 0; a < 3; a++) {
+          if (prop->name == string(1, (char)('x' + a)))
+            props[a] = &*prop;
+        }
+      }
+
+      long count = element->count;
+      long offset = (long)mesh.vertices.size();
+      mesh.vertices.resize(offset + count);
+      const char *base = p;
+      int chunkCount = max(1, threads * CHUNKS_PER_THREAD);
+      parallelFor(chunkCount, threads, [&](int chunk) {
+        long first = (count * chunk) / chunkCount;
+        long last = (count * (chunk + 1)) / chunkCount;
+        for (long v = first; v < last; v++) {
+          const char *record = base + v * stride;
+          float c[3];
+          for (int a = 0; a < 3; a++) {
+            c[a] = (float)plyValue(record + offsets[a], props[a]->type,
+                                   props[a]->isFloat, swap);
+          }
+          mesh.vertices[offset + v] = Point3f(c[0], c[1], c[2]);
+        }
+      });
+
+      vertexTotal = (long)mesh.vertices.size();
+      p += (long)stride * count;
+    } else if (fixed) {
+      // Skip elements we don't use
+      if (end - p < (long)stride * element->count) {
+        return false;
+      }
+      p += (long)stride * element->count;
+    } else {
+      // Face lists vary in length, so are read in order
+      bool isFace = element->name == "face";
+      if (isFace) {
+        mesh.indices.reserve(mesh.indices.size() + 3 * element->count);
+      }
+
+      for (long f = 0; f < element->count; f++) {
+        for (vector<PLYProperty>::iterator prop = element->properties.begin();
+             prop != element->properties.end(); prop++) {
+          int size = abs(prop->type);
+          if (!prop->isList) {
+            if (end - p < size)
+              return false;
+            p += size;
+            continue;
+          }
+
+          int countSize = abs(prop->countType);
+          if (end - p < countSize)
+            return false;
+          long corners = (long)plyValue(p, prop->countType, false, swap);
+          p += countSize;
+          if (corners < 0 || end - p < corners * size)
+            return false;
+
+          bool isIndices = isFace && (prop->name == "vertex_indices" ||
+                                      prop->name == "vertex_index");
+          if (isIndices && corners > 0) {
+            // Fan the polygon into triangles
+            long first = (long)plyValue(p, prop->type, prop->isFloat, swap);
+            long previous = first;
+            for (long c = 0; c < corners; c++) {
+              long index = (long)plyValue(p + c * size, prop->type,
+                                          prop->isFloat, swap);
+              if (index < 0 || index >= vertexTotal)
+                return false;
+              if (c >= 2) {
+                mesh.indices.push_back((int)first);
+                mesh.indices.push_back((int)previous);
+                mesh.indices.push_back((int)index);
+              }
+              previous = index;
+            }
+          }
+          p += corners * size;
+        }
+      }
+    }
+  }
+
+  if (mesh.indices.empty()) {
+    return false;
+  }
+
+  mesh.bytes = file.size();
+  mesh.seconds =
+      chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  return true;
+}
+
+bool loadMesh(const char *filename, MeshData &mesh, int threads) {
+  string name = filename;
+  size_t dot = name.rfind('.');
+  string extension = dot == string::npos ? "" : name.substr(dot + 1);
+  transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+  if (extension == "obj") {
+    return loadOBJ(filename, mesh, threads);
+  }
+  if (extension == "ply") {
+    return loadPLY(filename, mesh, threads);
+  }
+  return false;
+}
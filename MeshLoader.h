@@ -0,0 +1,41 @@
+/*
+ * MeshLoader.h
+ * Loads OBJ and binary PLY files straight into the vertex and index
+ * arrays used by Mesh. Files are memory mapped and parsed in parallel
+ * chunks, without allocating anything per triangle.
+ */
+
+#pragma once
+
+#include "GeomX.h"
+
+#include <stddef.h>
+#include <vector>
+
+using namespace std;
+
+struct MeshData {
+  vector<Point3f> vertices;
+  vector<int> indices; // Three vertices per triangle, polygons are fanned
+  size_t bytes;        // Size of the file
+  double seconds;      // Time taken to load it
+
+  MeshData() {
+    bytes = 0;
+    seconds = 0;
+  }
+
+  // Load throughput in megabytes (10^6 bytes) per second
+  double throughput() {
+    return seconds > 0 ? (bytes / 1e6) / seconds : 0;
+  }
+};
+
+// Loads a Wavefront OBJ file, using up to threads threads
+bool loadOBJ(const char *filename, MeshData &mesh, int threads);
+
+// Loads a binary (little or big endian) PLY file
+bool loadPLY(const char *filename, MeshData &mesh, int threads);
+
+// Picks the loader from the file extension
+bool loadMesh(const char *filename, MeshData &mesh, int threads);
@@ -0,0 +1,131 @@
+#include "PartialImage.h"
+#include "BinaryIO.h"
+#include "MappedFile.h"
+#include "TileScheduler.h"
+
+#include <cstdio>
+
+static const char PARTIAL_MAGIC[8] = {'R', 'A', 'X', 'A', 'R', 'P', 'R', 'T'};
+static const uint32_t PARTIAL_VERSION = 1;
+
+bool writePartial(const char *fileName, TGAWriter *image, int tileSize,
+                  int shard, int shards) {
+  int width = image->getWidth();
+  int height = image->getHeight();
+
+  // Written beside the destination and renamed into place, so a merge
+  // never reads a shard that is half written
+  string partName = string(fileName) + ".part";
+  {
+    BinaryWriter out(partName.c_str());
+    if (!out.ok()) {
+      return false;
+    }
+
+    out.writeBytes(PARTIAL_MAGIC, sizeof(PARTIAL_MAGIC));
+    out.write(PARTIAL_VERSION);
+    out.write(width);
+    out.write(height);
+    out.write(tileSize);
+    out.write(shard);
+    out.write(shards);
+
+    // Converted a tile at a time, so only the shard's tiles are ever
+    // held in memory
+    vector<Tile> tiles =
+        TileScheduler::split(width, height, tileSize, shard, shards);
+    vector<unsigned char> bytes;
+    for (vector<Tile>::iterator it = tiles.begin(); it != tiles.end(); it++) {
+      image->toBytes(it->x0, it->y0, it->x1, it->y1, bytes);
+      out.writeBytes(bytes.data(), bytes.size());
+    }
+
+    if (!out.ok()) {
+      return false;
+    }
+  }
+  return rename(partName.c_str(), fileName) == 0;
+}
+
+bool mergePartials(const vector<const char *> &fileNames, int &width,
+                   int &height, vector<unsigned char> &pixels, string &error) {
+  int tileSize = 0;
+  int shards = 0;
+  vector<bool> merged;
+
+  for (size_t i = 0; i < fileNames.size(); i++) {
+    const char *fileName = fileNames[i];
+    MappedFile file;
+    if (!file.open(fileName)) {
+      error = string("Can't open ") + fileName;
+      return false;
+    }
+    BinaryReader in(file.data(), file.size());
+
+    const char *magic = in.readBytes(sizeof(PARTIAL_MAGIC));
+    if (magic == NULL ||
+        memcmp(magic, PARTIAL_MAGIC, sizeof(PARTIAL_MAGIC)) != 0 ||
+        in.read<uint32_t>() != PARTIAL_VERSION) {
+      error = string(fileName) + " is not a partial image";
+      return false;
+    }
+
+    int fileWidth = in.read<int>();
+    int fileHeight = in.read<int>();
+    int fileTileSize = in.read<int>();
+    int shard = in.read<int>();
+    int fileShards = in.read<int>();
+    if (!in.ok() || fileWidth < 1 || fileHeight < 1 || fileWidth > 65535 ||
+        fileHeight > 65535 || fileTileSize < 1 || fileShards < 1 ||
+        shard < 0 || shard >= fileShards) {
+      error = string(fileName) + " is corrupt";
+      return false;
+    }
+
+    // Every shard must come from the same frame
+    if (i == 0) {
+      width = fileWidth;
+      height = fileHeight;
+      tileSize = fileTileSize;
+      shards = fileShards;
+      pixels.assign(3 * (size_t)width * height, 0);
+      merged.assign(shards, false);
+    } else if (fileWidth != width || fileHeight != height ||
+               fileTileSize != tileSize || fileShards != shards) {
+      error = string(fileName) + " is from a different frame";
+      return false;
+    }
+    if (merged[shard]) {
+      error = string(fileName) + " repeats shard " + to_string(shard);
+      return false;
+    }
+
+    vector<Tile> tiles =
+        TileScheduler::split(width, height, tileSize, shard, shards);
+    for (vector<Tile>::iterator it = tiles.begin(); it != tiles.end(); it++) {
+      for (int y = it->y0; y < it->y1; y++) {
+        size_t rowSize = 3 * (it->x1 - it->x0);
+        const char *row = in.readBytes(rowSize);
+        if (row == NULL) {
+          error = string(fileName) + " is truncated";
+          return false;
+        }
+        memcpy(&pixels[3 * ((size_t)y * width + it->x0)], row, rowSize);
+      }
+    }
+    merged[shard] = true;
+  }
+
+  if (fileNames.empty()) {
+    error = "No partial images to merge";
+    return false;
+  }
+  for (int shard = 0; shard < shards; shard++) {
+    if (!merged[shard]) {
+      error = "Shard " + to_string(shard) + " of " + to_string(shards) +
+              " is missing";
+      return false;
+    }
+  }
+  return true;
+}
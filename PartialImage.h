@@ -0,0 +1,37 @@
+/*
+ * PartialImage.h
+ * Shards of a frame rendered by separate processes
+ *
+ * Each process renders one shard, every shards'th tile of the frame, and
+ * saves just those tiles to a partial image:
+ *
+ *   magic, version
+ *   width, height, tileSize, shard, shards
+ *   BGR bytes of each tile in the shard, in tile order, bottom row first
+ *
+ * mergePartials reads one partial image for every shard back into the
+ * whole frame. Values are stored in native byte order, like compiled
+ * scenes, so shards must be rendered on the same machine type.
+ */
+
+#pragma once
+
+#include "TGAWriter.h"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Saves the tiles of one shard of the image, returns false if the file
+// can't be written
+bool writePartial(const char *fileName, TGAWriter *image, int tileSize,
+                  int shard, int shards);
+
+/*
+ * Assembles a frame from a partial image of each of its shards, as 8 bit
+ * BGR bottom row first. Returns false with error set if a file can't be
+ * read, the files are from different frames, or a shard is missing
+ */
+bool mergePartials(const vector<const char *> &fileNames, int &width,
+                   int &height, vector<unsigned char> &pixels, string &error);
@@ -7,12 +7,26 @@
 
 #include "GeomX.h"
 #include "Illumination.h"
+#include "ImageOutput.h"
+#include "MeshLoader.h"
+#include "PartialImage.h"
+#include "Renderer.h"
+#include "Scene.h"
 #include "Shapes.h"
+#include "Stats.h"
 #include "TGAReader.h"
 #include "TGAWriter.h"
+#include "TextureCache.h"
 #include "View.h"
 
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <list>
+#include <string>
+#include <thread>
 #include <vector>
 
 // Image size definition
@@ -48,6 +62,9 @@
 #define MATT_EARTH Material(earthTGA, Colour(0, 0, 0), 0, 0, 1.0, 1.0)
 #define MATT_CHECK Material(checkerTGA, Colour(0, 0, 0), 0, 0, 1.0, 1.0)
 
+// Material for meshes loaded with -m
+#define MESH_MATERIAL SHINY_BLUE
+
 // Mirror material
 #define MIRROR                                                                 \
   Material(Colour(0.5, 0.5, 0.5), Colour(0, 0, 0), 0, 0.9, 1.0, 1.0)
@@ -55,205 +72,395 @@
 // Recursion depth level
 #define REC_DEPTH 10
 
-// Antialiasing ifdef flags
-// #define SUPER_SAMPLE
-// #define JITTER_AA
+// Rays traced below each camera ray, enough for a chain to reach the
+// recursion depth with room for glass to branch
+#define RAY_BUDGET 64
+
+// Weight below which reflections and refractions play Russian roulette
+#define ROULETTE_WEIGHT 0.01
+
+// Shadow rays at a hit in the penumbra of an area light
+#define SHADOW_SAMPLES 16
+
+// Largest difference in any colour channel between neighbouring samples
+// before adaptive antialiasing splits them
+#define AA_THRESHOLD 0.1
+
+// Tile edge length in pixels for the parallel renderer
+#define TILE_SIZE 32
+
+/*
+ * Prints command line usage
+ */
+void usage(const char *name) {
+  cout << "Usage: " << name
+       << " [-t threads] [-s tileSize] [-p] [-w] [-r seconds] [-S] [-j]"
+       << " [-a depth] [-e threshold] [-o output.tga|output.ppm|output.pfm]"
+       << " [-z] [-E stops] [-T clamp|reinhard] [-B rays] [-R weight]"
+       << " [-L lights] [-A samples]"
+       << " [-k shard/shards]"
+       << " [-f scene] [-c compiled]"
+       << " [-J stats.json] [-m mesh.obj|mesh.ply]..." << endl;
+}
+
+/*
+ * Adds the wall clock time since phaseStart to a phase's statistics,
+ * and restarts phaseStart for the next phase
+ */
+void endPhase(const char *phase,
+              chrono::steady_clock::time_point &phaseStart) {
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  Stats::addPhase(phase, chrono::duration<double>(now - phaseStart).count());
+  phaseStart = now;
+}
+
+/*
+ * Name of one frame of an animation. The last run of # in the pattern is
+ * replaced by the frame number, zero padded to its length. A pattern
+ * without one has #### added before its extension.
+ */
+string frameFile(const string &pattern, int frame) {
+  string name = pattern;
+  size_t last = name.rfind('#');
+  if (last == string::npos) {
+    size_t dot = name.rfind('.');
+    if (dot == string::npos || name.find('/', dot) != string::npos) {
+      dot = name.size();
+    }
+    name.insert(dot, "####");
+    last = dot + 3;
+  }
+  size_t first = last;
+  while (first > 0 && name[first - 1] == '#') {
+    first--;
+  }
 
-// Random generator for jitter AA (bytes.com)
-float jitRand(float min, float max) {
-  return min + (max - min) * rand() / ((float)RAND_MAX);
+  size_t digits = last - first + 1;
+  string number = to_string(frame);
+  if (number.size() < digits) {
+    number.insert(0, digits - number.size(), '0');
+  }
+  return name.replace(first, digits, number);
 }
 
-int main() {
+int main(int argc, char *argv[]) {
   // assert(testGeom() == 0);
 
-  // Start point to time the render
-  double time_taken = clock();
+  RenderSettings settings;
+  settings.width = WIDTH;
+  settings.height = HEIGHT;
+  settings.recursionDepth = REC_DEPTH;
+  settings.rayBudget = RAY_BUDGET;
+  settings.rouletteWeight = ROULETTE_WEIGHT;
+  settings.maxLights = 0;
+  settings.shadowSamples = SHADOW_SAMPLES;
+  settings.superSample = false;
+  settings.jitter = false;
+  settings.adaptiveDepth = 0;
+  settings.adaptiveThreshold = AA_THRESHOLD;
+  settings.threads = max((int)thread::hardware_concurrency(), 1);
+  settings.tileSize = TILE_SIZE;
+  settings.packets = false;
+  settings.wavefront = false;
+  settings.previewInterval = 0;
+  settings.outputFile = "output.tga";
+  settings.shard = 0;
+  settings.shards = 1;
+
+  // Run length encode TGA output
+  bool compress = false;
+
+  // How radiance is brought into the range of 8 bit images
+  ToneMapping toneMapping = TONE_CLAMP;
+  double exposureStops = 0;
+
+  // Meshes to load into the scene
+  vector<const char *> meshFiles;
+
+  // Scene file to load instead of the built in scene, and where to
+  // write the compiled scene if it should be compiled
+  const char *sceneFile = NULL;
+  const char *compiledFile = NULL;
+
+  // Antialiasing from the command line, which overrides the scene file's
+  bool superSample = false;
+  bool jitter = false;
+  int adaptiveDepth = -1;
+
+  // Where to write the render statistics as JSON, if anywhere
+  const char *statsFile = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      settings.threads = max(atoi(argv[++i]), 1);
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      settings.tileSize = max(atoi(argv[++i]), 1);
+    } else if (strcmp(argv[i], "-p") == 0) {
+      settings.packets = true;
+    } else if (strcmp(argv[i], "-w") == 0) {
+      settings.wavefront = true;
+    } else if (strcmp(argv[i], "-S") == 0) {
+      superSample = true;
+    } else if (strcmp(argv[i], "-j") == 0) {
+      jitter = true;
+    } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+      adaptiveDepth = max(atoi(argv[++i]), 0);
+    } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+      settings.adaptiveThreshold = max(atof(argv[++i]), 0.0);
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      settings.previewInterval = max(atof(argv[++i]), 0.0);
+    } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      meshFiles.push_back(argv[++i]);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      settings.outputFile = argv[++i];
+    } else if (strcmp(argv[i], "-z") == 0) {
+      compress = true;
+    } else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc) {
+      settings.rayBudget = max(atoi(argv[++i]), 0);
+    } else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+      settings.rouletteWeight = max(atof(argv[++i]), 0.0);
+    } else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) {
+      settings.maxLights = max(atoi(argv[++i]), 0);
+    } else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc) {
+      settings.shadowSamples = max(atoi(argv[++i]), 1);
+    } else if (strcmp(argv[i], "-E") == 0 && i + 1 < argc) {
+      exposureStops = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "clamp") == 0) {
+        toneMapping = TONE_CLAMP;
+      } else if (strcmp(argv[i], "reinhard") == 0) {
+        toneMapping = TONE_REINHARD;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%d/%d", &settings.shard, &settings.shards) != 2 ||
+          settings.shards < 1 || settings.shard < 0 ||
+          settings.shard >= settings.shards) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "-J") == 0 && i + 1 < argc) {
+      statsFile = argv[++i];
+    } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      sceneFile = argv[++i];
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      compiledFile = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  // A shard only has part of the frame, and every shard would be writing
+  // its previews over the same output file
+  if (settings.shards > 1 && settings.previewInterval > 0) {
+    cout << "Previews are off when rendering a shard of a frame" << endl;
+    settings.previewInterval = 0;
+  }
+
+  // Start point to time the render, measured in wall clock time
+  // as CPU time adds up across threads
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  chrono::steady_clock::time_point phaseStart = start;
+
+  Scene scene;
+
+  if (sceneFile != NULL) {
+    if (!scene.load(sceneFile, settings.threads)) {
+      cout << scene.error() << endl;
+      return 1;
+    }
+    cout << sceneFile << ": "
+         << chrono::duration<double>(chrono::steady_clock::now() - start)
+                    .count() *
+                1000
+         << " ms" << endl;
+  } else {
+    // Loading our texture files into the shared texture cache
+    TextureCache &textures = TextureCache::instance();
+
+    int grassTGA = textures.load("grass.tga");
+    if (grassTGA < 0) {
+      return 1;
+    }
+
+    int earthTGA = textures.load("earth.tga");
+    if (earthTGA < 0) {
+      return 1;
+    }
+
+    int checkerTGA = textures.load("checkerboard.tga");
+    if (checkerTGA < 0) {
+      return 1;
+    }
+
+    // The lights that are active on our scene
+    scene.add(new DirectionLight(LIGHT_INTENS, LIGHT_DIR2, AMBIENT));
 
-  // imageWriter to store pixel values
-  TGAWriter *imageWriter = new TGAWriter(WIDTH, HEIGHT);
+    // Spotlight
+    scene.add(
+        new SpotLight(LIGHT_INTENS, LIGHT_DIR, AMBIENT, Point3(2, 4, 2), 8, 0));
 
-  // Loading our texture files into STGA
-  STGA grassTGA;
-  if (!loadTGA("grass.tga", grassTGA)) {
-    return 1;
+    // Scene definition
+    scene.add(new Sphere(Point3(0.35, 1, -2), 0.5, SHINY_RED));
+    scene.add(new Sphere(Point3(0.75, 0.4, -1.6), 0.3, MATT_BLUE));
+    scene.add(new Plane(Point3(0, 0, 0), Vector3(0, 1, 0), MATT_GRASS));
+
+    vector<Triangle *> pyramid;
+    pyramid.push_back(new Triangle(Point3(-1, 0, 0), Point3(0, 0, 1),
+                                   Point3(0, 1, 0), SHINY_BLUE));
+    pyramid.push_back(new Triangle(Point3(0, 0, 1), Point3(1, 0, 0),
+                                   Point3(0, 1, 0), SHINY_BLUE));
+    pyramid.push_back(new Triangle(Point3(1, 0, 0), Point3(0, 0, -1),
+                                   Point3(0, 1, 0), SHINY_BLUE));
+    pyramid.push_back(new Triangle(Point3(0, 0, -1), Point3(-1, 0, 0),
+                                   Point3(0, 1, 0), SHINY_BLUE));
+
+    Polyhedron *p = new Polyhedron(pyramid, MATT_CYAN);
+    p->removeBackFaces(EYEPOINT);
+    scene.add(p);
+
+    scene.add(new Sphere(Point3(-1, 1, 1), 0.7, MATT_EARTH));
+
+    // Camera definition
+    scene.setCamera(EYEPOINT, LOOKAT, VIEW_UP, FOV);
+  }
+
+  // Textures are decoded while the scene loads and timed as a phase of
+  // their own, so their time is taken out of the scene's
+  phaseStart += chrono::duration_cast<chrono::steady_clock::duration>(
+      chrono::duration<double>(Stats::phaseTime("texture load")));
+  endPhase("scene load", phaseStart);
+
+  // Meshes are loaded straight into their vertex and index arrays
+  for (vector<const char *>::iterator it = meshFiles.begin();
+       it != meshFiles.end(); it++) {
+    MeshData data;
+    if (!loadMesh(*it, data, settings.threads)) {
+      cout << "Error loading mesh " << *it << endl;
+      return 1;
+    }
+    Mesh *mesh =
+        new Mesh(move(data.vertices), move(data.indices), MESH_MATERIAL);
+    cout << *it << ": " << mesh->triangleCount() << " triangles, "
+         << data.seconds * 1000 << " ms, " << data.throughput() << " MB/s"
+         << endl;
+    scene.add(mesh);
   }
+  endPhase("mesh load", phaseStart);
 
-  STGA earthTGA;
-  if (!loadTGA("earth.tga", earthTGA)) {
-    return 1;
+  scene.build();
+  endPhase("scene build", phaseStart);
+
+  if (compiledFile != NULL) {
+    if (!scene.compile(compiledFile)) {
+      cout << scene.error() << endl;
+      return 1;
+    }
+    return 0;
   }
 
-  STGA checkerTGA;
-  if (!loadTGA("checkerboard.tga", checkerTGA)) {
-    return 1;
+  // The scene file may give its own image size and antialiasing
+  scene.apply(settings);
+  if (superSample) {
+    settings.superSample = true;
+  }
+  if (jitter) {
+    settings.jitter = true;
+  }
+  if (adaptiveDepth >= 0) {
+    settings.adaptiveDepth = adaptiveDepth;
   }
 
-  // The lights that are active on our scene
-  list<Lighting *> lights;
-
-  lights.push_back(new DirectionLight(LIGHT_INTENS, LIGHT_DIR2, AMBIENT));
-
-  // Spotlight
-  lights.push_back(
-      new SpotLight(LIGHT_INTENS, LIGHT_DIR, AMBIENT, Point3(2, 4, 2), 8));
-
-  // Scene definition
-  list<Shape *> scene;
-
-  scene.push_back(new Sphere(Point3(0.35, 1, -2), 0.5, SHINY_RED));
-  scene.push_back(new Sphere(Point3(0.75, 0.4, -1.6), 0.3, MATT_BLUE));
-  scene.push_back(new Plane(Point3(0, 0, 0), Vector3(0, 1, 0), MATT_GRASS));
-
-  vector<Triangle *> pyramid;
-  pyramid.push_back(new Triangle(Point3(-1, 0, 0), Point3(0, 0, 1),
-                                 Point3(0, 1, 0), SHINY_BLUE));
-  pyramid.push_back(new Triangle(Point3(0, 0, 1), Point3(1, 0, 0),
-                                 Point3(0, 1, 0), SHINY_BLUE));
-  pyramid.push_back(new Triangle(Point3(1, 0, 0), Point3(0, 0, -1),
-                                 Point3(0, 1, 0), SHINY_BLUE));
-  pyramid.push_back(new Triangle(Point3(0, 0, -1), Point3(-1, 0, 0),
-                                 Point3(0, 1, 0), SHINY_BLUE));
-
-  Polyhedron *p = new Polyhedron(pyramid, MATT_CYAN);
-  p->removeBackFaces(EYEPOINT);
-  scene.push_back(p);
-
-  scene.push_back(new Sphere(Point3(-1, 1, 1), 0.7, MATT_EARTH));
-
-  // Camera definition
-  View view = View(EYEPOINT, LOOKAT, VIEW_UP, FOV, WIDTH, HEIGHT);
-
-  // The main loop
-  // Iterate Y axis first
-  for (float y = 0.0f; y < HEIGHT; y++) {
-    for (float x = 0.0f; x < WIDTH; x++) {
-
-      Colour colour = Colour(0.0, 0.0, 0.0);
-
-#ifdef SUPER_SAMPLE
-      // Allows us to increase the samples per pixel to four
-      for (float fragmentx = x; fragmentx < x + 1.0f; fragmentx += 0.5f) {
-        for (float fragmenty = y; fragmenty < y + 1.0f; fragmenty += 0.5f) {
-          double coef = 0.25;
-#else
-      float fragmentx = x;
-      float fragmenty = y;
-      double coef = 1.0;
-#endif
-
-#ifdef JITTER_AA
-          // Offset our ray so it doesnt always travel through the
-          // center of the pixel / pixelfragment
-          float rx = fragmentx + jitRand(-0.125, 0.125);
-          float ry = fragmenty + jitRand(-0.125, 0.125);
-          Ray3 ray = view.createRay(rx, ry);
-#else
-          Ray3 ray = view.createRay(fragmentx, fragmenty);
-#endif
-
-          int level = 0; // Recursion level
-
-          // Main loop
-          do {
-
-            // Test each shape in the scene list for an intersection
-            // store the closest shape
-            double bestHit = -1;
-
-            Shape *shape = NULL;
-            for (list<Shape *>::iterator it = scene.begin(); it != scene.end();
-                 it++) {
-              Shape *itShape = *it;
-              double intersect = itShape->intersect(ray);
-              if (intersect > 0) {
-                if (bestHit < 0 || (bestHit > 0 && intersect < bestHit)) {
-                  bestHit = intersect;
-                  shape = itShape;
-                }
-              }
-            }
-
-            // Stop this iteration if there was no intersections
-            if (shape == NULL) {
-              // Sky Blue Background?
-              // Looks a bit weird as reflections still have a black sky
-              if (level == 0) {
-                colour = colour + (Colour(0.529, 0.808, 0.922) * coef);
-              }
-              break;
-            }
-
-            // The location of our hit
-            Point3 hit = ray.startP() + (ray.directionV() * bestHit);
-
-            // The normal at this position
-            Vector3 normal = shape->normal(hit);
-
-            // Iterate through each light, accumulating values
-            for (list<Lighting *>::iterator it = lights.begin();
-                 it != lights.end(); it++) {
-              Lighting *light = *it;
-              // Calculate shadowed
-              bool isShadowed = false;
-
-              // Generate a shadow ray
-              Ray3 shadowRay = Ray3(hit + (unit(light->direction()) / 100),
-                                    unit(light->direction()));
-
-              // Check the shadow ray against our scene
-              for (list<Shape *>::iterator it = scene.begin();
-                   it != scene.end(); it++) {
-                Shape *itShape = *it;
-                double intersect = itShape->intersect(shadowRay);
-                if (intersect > 0) {
-                  isShadowed = true; // Can exit after first hit
-                  break;
-                }
-              }
-
-              // Colour at this intersection
-              Colour hitColour = shape->getColour(
-                  hit, normal, light, -ray.directionV(), isShadowed);
-
-              // Accumulate colour values multiplying by the
-              // supersampling coeffecient
-              colour = colour + (hitColour * coef);
-            }
-
-            // Get the next reflection coefficeint
-            coef *= shape->getMaterial().reflCoef();
-
-            // Reflect and generate a new ray
-            if (coef > 0.0) {
-              Vector3 reflection =
-                  (normal * (ray.directionV().dot(normal)) * -2) +
-                  ray.directionV();
-              ray = Ray3(hit + (unit(reflection) / 100), unit(reflection));
-            }
-
-            // Increase our recursion level counter
-            level++;
-          } while (coef > 0.0 && level < REC_DEPTH);
-// Stop iterating if no reflections or at recurision limit
-#ifdef SUPER_SAMPLE
-        }
+  // Images are encoded and written on their own thread
+  ImageOutput output(compress);
+
+  // An animation renders each of its frames to a numbered file in turn,
+  // with the scene, its textures and its BVH kept from frame to frame.
+  // Writing a frame carries on while the next one renders
+  bool animated = scene.animated();
+  int frames = animated ? scene.frames() : 1;
+  for (int frame = 0; frame < frames; frame++) {
+    chrono::steady_clock::time_point frameStart = chrono::steady_clock::now();
+    string outputFile = settings.outputFile;
+    if (animated) {
+      scene.setFrame(frame);
+      outputFile = frameFile(settings.outputFile, frame);
+      endPhase("animate", phaseStart);
+    }
+    RenderSettings frameSettings = settings;
+    frameSettings.outputFile = outputFile.c_str();
+
+    // imageWriter to store pixel values, only those of our own tiles if
+    // the frame is split across processes
+    TGAWriter *imageWriter =
+        new TGAWriter(settings.width, settings.height, settings.tileSize,
+                      settings.shard, settings.shards);
+    imageWriter->setToneMap(toneMapping, (float)pow(2.0, exposureStops));
+
+    // Render the image across our worker threads
+    Renderer renderer(&scene, frameSettings);
+    renderer.render(imageWriter, &output);
+    endPhase("render", phaseStart);
+
+    // A shard of a frame saves its tiles for raxar-merge
+    if (settings.shards > 1) {
+      string partial = outputFile + ".shard" + to_string(settings.shard);
+      if (!writePartial(partial.c_str(), imageWriter, settings.tileSize,
+                        settings.shard, settings.shards)) {
+        std::cout << "Error writing " << partial << endl;
+        return -1;
+      }
+      endPhase("write", phaseStart);
+    } else {
+      // Convert our image and queue it to be written, which carries on
+      // while the next frame renders
+      if (!imageWriter->complete()) {
+        std::cout << "Error writing image" << endl;
+        return -1;
       }
-#endif
-      // Push our final pixel into the imageWriter
-      imageWriter->putNextPixel(colour);
+      output.write(imageWriter, outputFile, false);
+      endPhase("convert", phaseStart);
+    }
+    delete imageWriter;
+
+    if (animated) {
+      cout << outputFile << ": "
+           << chrono::duration<double>(chrono::steady_clock::now() -
+                                       frameStart)
+                      .count() *
+                  1000
+           << " ms" << endl;
     }
   }
 
+  // Only the texels the render sampled are resident
+  TextureCache::instance().report(cout);
+
+  // The last images are written before the summary, so it has their
+  // write times
+  bool written = output.finish();
+
   // Time measurement
-  time_taken = (clock() - time_taken) / (double)CLOCKS_PER_SEC;
+  double time_taken =
+      chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  int lightCount = (int)scene.getLights().size();
+  Stats::print(cout, settings.recursionDepth, lightCount);
+  if (statsFile != NULL &&
+      !Stats::writeJSON(statsFile, settings.recursionDepth, lightCount)) {
+    std::cout << "Error writing " << statsFile << endl;
+  }
 
-  // Write our image to a file
-  if (imageWriter->writeImage()) {
-    std::cout << time_taken * 1000 << endl;
-    return 0;
-  } else {
-    std::cout << "Error writing image" << endl;
+  if (!written) {
+    std::cout << "Error writing " << (animated ? "frames" : settings.outputFile)
+              << endl;
     return -1;
   }
+
+  std::cout << time_taken * 1000 << endl;
+  return 0;
 }
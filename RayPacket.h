@@ -0,0 +1,110 @@
+/*
+ * RayPacket.h
+ * Contains the RayPacket struct, a group of coherent rays traced together.
+ *
+ * Rays are stored as a structure of arrays in single precision, so the
+ * packet versions of the intersection tests compile to SSE, AVX2 or
+ * AVX-512 code, one ray per lane. The packet width follows the widest
+ * instruction set the compiler targets.
+ */
+
+#pragma once
+
+#include "GeomX.h"
+#include "Stats.h"
+
+#include <limits>
+
+using namespace std;
+
+class Shape;
+
+#if defined(__AVX512F__)
+#define PACKET_SIZE 16
+#define PACKET_WIDTH 4
+#elif defined(__AVX__)
+#define PACKET_SIZE 8
+#define PACKET_WIDTH 4
+#else
+#define PACKET_SIZE 4
+#define PACKET_WIDTH 2
+#endif
+
+// Pixels covered by a packet of primary rays
+#define PACKET_HEIGHT (PACKET_SIZE / PACKET_WIDTH)
+
+// Slack in the single precision barycentric test, so a ray through a
+// vertex or edge shared by two triangles still hits one of them
+#define TRIANGLE_EDGE_EPSILON 1e-5f
+
+struct RayPacket {
+  alignas(64) float ox[PACKET_SIZE];
+  alignas(64) float oy[PACKET_SIZE];
+  alignas(64) float oz[PACKET_SIZE];
+  alignas(64) float dx[PACKET_SIZE];
+  alignas(64) float dy[PACKET_SIZE];
+  alignas(64) float dz[PACKET_SIZE];
+  alignas(64) float invDx[PACKET_SIZE];
+  alignas(64) float invDy[PACKET_SIZE];
+  alignas(64) float invDz[PACKET_SIZE];
+
+  // Closest hit so far, infinity for no hit and -1 for an empty lane
+  alignas(64) float t[PACKET_SIZE];
+  Shape *shape[PACKET_SIZE];
+
+  // Original rays, used by shapes without a packet intersection
+  Ray3 rays[PACKET_SIZE];
+
+  // Starts with every lane empty
+  RayPacket() {
+    for (int i = 0; i < PACKET_SIZE; i++) {
+      ox[i] = oy[i] = oz[i] = 0;
+      dx[i] = dy[i] = dz[i] = 1;
+      invDx[i] = invDy[i] = invDz[i] = 1;
+      t[i] = -1;
+      shape[i] = NULL;
+    }
+  }
+
+  // Places a ray in a lane, ready to be traced
+  void set(int lane, Ray3 r) {
+    Point3 o = r.startP();
+    Vector3 d = r.directionV();
+    ox[lane] = (float)o.getX();
+    oy[lane] = (float)o.getY();
+    oz[lane] = (float)o.getZ();
+    dx[lane] = (float)d.getXDir();
+    dy[lane] = (float)d.getYDir();
+    dz[lane] = (float)d.getZDir();
+    invDx[lane] = 1 / dx[lane];
+    invDy[lane] = 1 / dy[lane];
+    invDz[lane] = 1 / dz[lane];
+    t[lane] = numeric_limits<float>::infinity();
+    shape[lane] = NULL;
+    rays[lane] = r;
+  }
+
+  bool active(int lane) const { return t[lane] >= 0; }
+
+  /*
+   * Records hits from a packet intersection, where tHit holds each
+   * lane's distance to the shape or -1 for a miss
+   */
+  void update(const float *tHit, Shape *s) {
+    for (int i = 0; i < PACKET_SIZE; i++) {
+      if (tHit[i] > 0 && tHit[i] < t[i]) {
+        t[i] = tHit[i];
+        shape[i] = s;
+      }
+    }
+  }
+
+  // Counts a packet intersection as one test per active lane
+  void count(StatShape kind, const float *tHit) const {
+    for (int i = 0; i < PACKET_SIZE; i++) {
+      if (active(i)) {
+        countTest(kind, tHit[i]);
+      }
+    }
+  }
+};
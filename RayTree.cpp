@@ -0,0 +1,179 @@
+#include "RayTree.h"
+#include "Stats.h"
+
+#include <cmath>
+#include <cstring>
+
+// Salts keeping each random choice about a ray independent
+#define SALT_ROULETTE 0x526f756c65747465ULL
+#define SALT_BUDGET 0x4275646765740000ULL
+
+// splitmix64's finaliser, spreading every input bit over the output
+static uint64_t mix(uint64_t h) {
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+
+double rayRandom(const Ray3 &ray, uint64_t salt) {
+  Point3 o = ray.startP();
+  Vector3 d = ray.directionV();
+  double values[6] = {o.getX(),    o.getY(),    o.getZ(),
+                      d.getXDir(), d.getYDir(), d.getZDir()};
+  uint64_t h = salt;
+  for (int i = 0; i < 6; i++) {
+    uint64_t bits;
+    memcpy(&bits, &values[i], sizeof(bits));
+    h = mix(h ^ bits);
+  }
+  // The top 53 bits fill a double's mantissa
+  return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double imageRandom(float x, float y, uint64_t salt) {
+  uint32_t bits[2];
+  memcpy(&bits[0], &x, sizeof(bits[0]));
+  memcpy(&bits[1], &y, sizeof(bits[1]));
+  uint64_t h = mix(salt ^ ((uint64_t)bits[0] << 32 | bits[1]));
+  return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+Branch rootBranch(const Ray3 &ray, double coef,
+                  const RenderSettings &settings) {
+  Branch root;
+  root.ray = ray;
+  root.weight = coef;
+  root.distance = 0;
+  root.level = 0;
+  root.budget = settings.rayBudget;
+  root.refracted = false;
+  root.seesSky = true;
+  return root;
+}
+
+/*
+ * Direction of d bent through a surface with normal n between air and a
+ * material of refractive index index, from whichever side d arrives.
+ * Returns false when d is totally internally reflected
+ */
+static bool refractDirection(Vector3 d, Vector3 n, double index,
+                             Vector3 &refraction) {
+  n = unit(n);
+  double cosIn = -dot(d, n);
+  double eta = 1 / index;
+  if (cosIn < 0) {
+    // Leaving the material
+    n = -n;
+    cosIn = -cosIn;
+    eta = index;
+  }
+
+  double k = 1 - eta * eta * (1 - cosIn * cosIn);
+  if (k < 0) {
+    return false;
+  }
+  refraction = unit(d * eta + n * (eta * cosIn - sqrt(k)));
+  return true;
+}
+
+// A ray leaving branch's hit in direction, offset so it misses the surface
+static Branch childBranch(const Branch &branch, const Hit &hit,
+                          Vector3 direction, double weight, bool refracted) {
+  Branch child;
+  child.ray = Ray3(hit.point + (unit(direction) / 100), unit(direction));
+  child.weight = weight;
+  child.distance = branch.distance + hit.t;
+  child.level = branch.level + 1;
+  child.budget = 0;
+  child.refracted = refracted;
+  child.seesSky = refracted && branch.seesSky;
+  return child;
+}
+
+/*
+ * Russian roulette on a dim branch. Survivors are brought up to the
+ * threshold, so on average the branch still adds its full weight
+ */
+static bool survives(Branch &branch, double threshold) {
+  if (branch.weight >= threshold) {
+    return true;
+  }
+  if (rayRandom(branch.ray, SALT_ROULETTE) * threshold >= branch.weight) {
+    threadStats.rouletteEnds++;
+    return false;
+  }
+  branch.weight = threshold;
+  return true;
+}
+
+int splitBranch(const Branch &branch, const Hit &hit,
+                const RenderSettings &settings, Branch children[2]) {
+  if (branch.level + 1 >= settings.recursionDepth) {
+    return 0;
+  }
+
+  Material &material = hit.shape->getMaterial();
+  double reflectWeight = branch.weight * material.reflCoef();
+  double refractWeight = branch.weight * (1 - material.opacity());
+
+  Vector3 direction = branch.ray.directionV();
+  Vector3 normal = hit.normal;
+  Vector3 refraction = direction;
+  if (refractWeight > 0 &&
+      !refractDirection(direction, normal, material.refractiveIndex(),
+                        refraction)) {
+    // Light that can't get out is reflected back in
+    reflectWeight += refractWeight;
+    refractWeight = 0;
+  }
+
+  int count = 0;
+  if (reflectWeight > 0) {
+    Vector3 reflection =
+        (normal * (direction.dot(normal)) * -2) + direction;
+    children[count++] =
+        childBranch(branch, hit, reflection, reflectWeight, false);
+  }
+  if (refractWeight > 0) {
+    children[count++] =
+        childBranch(branch, hit, refraction, refractWeight, true);
+  }
+
+  int kept = 0;
+  for (int i = 0; i < count; i++) {
+    if (survives(children[i], settings.rouletteWeight)) {
+      children[kept++] = children[i];
+    }
+  }
+  count = kept;
+
+  if (count > branch.budget) {
+    threadStats.budgetEnds += count - branch.budget;
+    if (branch.budget == 0) {
+      return 0;
+    }
+    // Room for one more ray: follow one branch, picked in proportion to
+    // its weight and carrying both, which keeps the average unbiased
+    double total = children[0].weight + children[1].weight;
+    if (rayRandom(branch.ray, SALT_BUDGET) * total >= children[0].weight) {
+      children[0] = children[1];
+    }
+    children[0].weight = total;
+    count = 1;
+  }
+
+  // The rays left are shared out by weight
+  int spare = branch.budget - count;
+  if (count == 1) {
+    children[0].budget = spare;
+  } else if (count == 2) {
+    int share = (int)(spare * children[0].weight /
+                      (children[0].weight + children[1].weight));
+    children[0].budget = share;
+    children[1].budget = spare - share;
+  }
+  return count;
+}
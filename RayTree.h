@@ -0,0 +1,57 @@
+/*
+ * RayTree.h
+ * How a sample's rays branch below each surface they hit.
+ *
+ * A hit can send on a reflection, weighted by the material's
+ * reflectiveness, and a refraction through it, weighted by its
+ * transparency (1 - alpha). Together they make a tree of rays under
+ * each camera ray, which is kept from growing without bound three ways:
+ *
+ *   depth     no branch goes past the recursion depth
+ *   budget    each camera ray may trace a fixed number of rays below it,
+ *             shared between branches in proportion to their weight
+ *   roulette  a branch weighing less than the threshold carries on with
+ *             probability weight / threshold at the threshold's weight,
+ *             so dim branches end early without darkening the average
+ *
+ * Random choices are drawn from a hash of the ray they decide, rather
+ * than a generator, so the same sample takes the same branches whichever
+ * thread, shard or renderer traces it.
+ */
+
+#pragma once
+
+#include "GeomX.h"
+#include "RenderSettings.h"
+#include "Shapes.h"
+
+#include <stdint.h>
+
+// A ray in the tree, with what it carries down from its parents
+struct Branch {
+  Ray3 ray;
+  double weight;   // Share of the sample's colour it contributes
+  double distance; // Length of the path up to the ray's start
+  int level;       // Surfaces hit before the ray
+  int budget;      // Rays that may still be traced below this one
+  bool refracted;  // Made by refraction rather than reflection
+  bool seesSky;    // Reached only through refraction, so a miss is sky
+};
+
+// Camera ray at the root of a tree, weighted by coef
+Branch rootBranch(const Ray3 &ray, double coef, const RenderSettings &settings);
+
+/*
+ * Fills children with the rays leaving branch's hit, returning how many
+ * there are, 0 to 2, after the depth, budget and roulette have had
+ * their say
+ */
+int splitBranch(const Branch &branch, const Hit &hit,
+                const RenderSettings &settings, Branch children[2]);
+
+// Uniform value in [0, 1) drawn from the ray, salted for separate choices
+double rayRandom(const Ray3 &ray, uint64_t salt);
+
+// Uniform value in [0, 1) drawn from a point on the image, salted for
+// separate choices
+double imageRandom(float x, float y, uint64_t salt);
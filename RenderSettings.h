@@ -0,0 +1,52 @@
+/*
+ * RenderSettings.h
+ * Image size, antialiasing and threading options for a render
+ */
+
+#pragma once
+
+struct RenderSettings {
+  int width;
+  int height;
+  int recursionDepth;
+
+  // Rays each camera ray may trace below it, shared by its reflections
+  // and refractions, and the weight below which a branch is subject to
+  // Russian roulette. A threshold of 0 turns roulette off
+  int rayBudget;
+  double rouletteWeight;
+
+  // Lights shaded at each hit, sampled by how brightly they might light
+  // it when more reach it. 0 shades every light that reaches the hit
+  int maxLights;
+
+  // Shadow rays for an area light at a hit in its penumbra, as a square
+  // grid over the light. Hits it lights fully or not at all take four
+  int shadowSamples;
+  bool superSample; // Four samples per pixel
+  bool jitter;      // Offset each sample randomly within its fragment
+
+  // Adaptive antialiasing splits pixels that differ from a neighbour by
+  // more than adaptiveThreshold in any channel into quarters, up to
+  // adaptiveDepth times. 0 turns it off
+  int adaptiveDepth;
+  double adaptiveThreshold;
+  int threads;
+  int tileSize;
+  bool packets; // Trace primary rays in SIMD packets
+
+  // Trace each tile's rays a stage at a time rather than pixel by pixel
+  bool wavefront;
+
+  // Seconds between previews of a progressive render, which traces a
+  // coarse subset of pixels first. 0 renders the image in one pass
+  double previewInterval;
+
+  // Where the image and its previews are written
+  const char *outputFile;
+
+  // Frames split across processes render every shards'th tile, starting
+  // from tile shard. A whole frame is shard 0 of 1
+  int shard;
+  int shards;
+};
@@ -0,0 +1,503 @@
+#include "Renderer.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+// Rank of each pixel of a 4x4 block, an ordered dither matrix so every
+// pass spreads its pixels evenly over the image
+static const int PROGRESSIVE_ORDER[PROGRESSIVE_BLOCK][PROGRESSIVE_BLOCK] = {
+    {0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+
+// Passes of a progressive render, each tracing ranks up to the next.
+// Every pass doubles the pixels traced so far
+static const int PROGRESSIVE_PASSES[] = {0, 1, 4, 8, PROGRESSIVE_RANKS};
+
+// Lights past this many don't cache their last occluder
+#define OCCLUDER_CACHE_LIGHTS 32
+
+// The shape that last blocked a shadow ray from each light on this thread.
+// Cleared at the start of every tile, as the shapes near one tile say
+// little about the next
+static thread_local Shape *lastOccluder[OCCLUDER_CACHE_LIGHTS];
+
+static void clearOccluders() {
+  for (int i = 0; i < OCCLUDER_CACHE_LIGHTS; i++) {
+    lastOccluder[i] = NULL;
+  }
+}
+
+// Salts keeping the jitter along each axis independent
+#define SALT_JITTER_X 0x4a69747465725800ULL
+#define SALT_JITTER_Y 0x4a69747465725900ULL
+
+// Jitters the sample at x, y by up to radius along each axis. The offsets
+// are drawn from the sample's place on the image, so a pixel's samples
+// move the same way whichever pass, thread or tile traces them
+static void jitter(float &x, float &y, float radius) {
+  float sampleX = x;
+  float sampleY = y;
+  x += radius * (float)(2 * imageRandom(sampleX, sampleY, SALT_JITTER_X) - 1);
+  y += radius * (float)(2 * imageRandom(sampleX, sampleY, SALT_JITTER_Y) - 1);
+}
+
+Renderer::Renderer(Scene *scene, RenderSettings settings) {
+  this->scene = scene;
+  this->view = scene->view(settings.width, settings.height);
+  this->settings = settings;
+
+  // Adaptive antialiasing starts from one sample per pixel
+  if (settings.adaptiveDepth > 0) {
+    this->settings.superSample = false;
+  }
+
+  // Supersamples each cover half a pixel
+  spread = view.pixelAngle() * (this->settings.superSample ? 0.5 : 1.0);
+}
+
+Colour Renderer::trace(Ray3 ray, double coef) {
+  // Find the closest shape in the scene
+  Hit hit;
+  scene->closestHit(ray, hit);
+  threadStats.primaryRays++;
+
+  return traceFrom(ray, hit, coef);
+}
+
+/*
+ * The ray tree is walked depth first from a stack of branches still to
+ * trace, kept per thread so samples don't allocate
+ */
+Colour Renderer::traceFrom(Ray3 ray, Hit hit, double coef) {
+  static thread_local vector<Branch> pending;
+  Colour colour = Colour(0.0, 0.0, 0.0);
+
+  pending.clear();
+  pending.push_back(rootBranch(ray, coef, settings));
+  bool traced = true; // The root's hit is already known
+
+  while (!pending.empty()) {
+    Branch branch = pending.back();
+    pending.pop_back();
+
+    if (!traced) {
+      scene->closestHit(branch.ray, hit);
+      if (branch.refracted) {
+        threadStats.refractionRays++;
+      } else {
+        threadStats.reflectionRays++;
+      }
+    }
+    traced = false;
+
+    // Stop this branch if there was no intersections
+    if (hit.shape == NULL) {
+      // Sky Blue Background?
+      // Looks a bit weird as reflections still have a black sky
+      if (branch.seesSky) {
+        colour = colour + (SKY_COLOUR * branch.weight);
+      }
+      countDepth(branch.level);
+      continue;
+    }
+
+    // Width of the sample's cone where it meets the surface, stretched
+    // as the surface turns away from the ray
+    Vector3 normal = hit.normal;
+    double footprint = spread * (branch.distance + hit.t) /
+                       max(fabs(dot(branch.ray.directionV(), normal)), 0.01);
+
+    // Light let through a transparent surface is traced by refraction
+    // rather than shaded here
+    double surfaceCoef =
+        branch.weight * hit.shape->getMaterial().opacity();
+
+    // Only lights that reach the hit are shaded and shadow tested, the
+    // ambient light of the rest is still added
+    LightTree &lightTree = scene->getLightTree();
+    static thread_local vector<LightChoice> chosen;
+    lightTree.choose(hit.point, normal, branch.ray, settings.maxLights,
+                     chosen);
+
+    // Each choice's weight is scaled by how much of its light the hit
+    // sees, past anything in the way
+    for (size_t c = 0; c < chosen.size(); c++) {
+      int lightIndex = chosen[c].light;
+      chosen[c].weight *= scene->visibility(
+          lightTree.light(lightIndex), hit.point, branch.ray,
+          settings.shadowSamples,
+          lightIndex < OCCLUDER_CACHE_LIGHTS ? &lastOccluder[lightIndex]
+                                             : NULL);
+      countShading(lightIndex);
+    }
+
+    // Every light is summed in one pass and the surface coloured once,
+    // multiplying by the supersampling coeffecient
+    const LightTable &table = lightTree.table();
+    double diffuse, specular;
+    table.shade(hit.point, normal, -branch.ray.directionV(),
+                hit.shape->getMaterial().shininess(), chosen.data(),
+                (int)chosen.size(), diffuse, specular);
+    colour = colour + (hit.shape->getShaded(hit, table.ambient(), diffuse,
+                                            specular, footprint) *
+                       surfaceCoef);
+
+    // Queue the reflection and refraction leaving this surface, if the
+    // tree may grow any further
+    Branch children[2];
+    int count = splitBranch(branch, hit, settings, children);
+    if (count == 0) {
+      countDepth(branch.level + 1);
+    }
+    for (int i = count - 1; i >= 0; i--) {
+      pending.push_back(children[i]);
+    }
+  }
+
+  return colour;
+}
+
+Colour Renderer::tracePixel(float x, float y) {
+  Colour colour = Colour(0.0, 0.0, 0.0);
+
+  // Supersampling splits the pixel into four fragments
+  float step = settings.superSample ? 0.5f : 1.0f;
+  double coef = settings.superSample ? 0.25 : 1.0;
+
+  for (float fragmentx = x; fragmentx < x + 1.0f; fragmentx += step) {
+    for (float fragmenty = y; fragmenty < y + 1.0f; fragmenty += step) {
+      float rx = fragmentx;
+      float ry = fragmenty;
+
+      if (settings.jitter) {
+        // Offset our ray so it doesnt always travel through the
+        // center of the pixel / pixelfragment
+        jitter(rx, ry, 0.125f);
+      }
+
+      colour = colour + trace(view.createRay(rx, ry), coef);
+    }
+  }
+
+  return colour;
+}
+
+Colour Renderer::traceSample(float x, float y, float size) {
+  if (settings.jitter) {
+    jitter(x, y, size / 4);
+  }
+  return trace(view.createRay(x, y), 1.0);
+}
+
+// Largest difference between two colours in any channel, as far as a
+// display can show it
+static double contrast(Colour a, Colour b) {
+  a = a.clamped();
+  b = b.clamped();
+  return max(fabs(a.red() - b.red()),
+             max(fabs(a.green() - b.green()), fabs(a.blue() - b.blue())));
+}
+
+/*
+ * The quarters are sampled at their corners, so one level of refinement
+ * takes the same samples as fixed supersampling
+ */
+Colour Renderer::refine(float x, float y, float size, Colour first,
+                        int depth) {
+  float half = size / 2;
+  float offsetX[4] = {0, half, 0, half};
+  float offsetY[4] = {0, 0, half, half};
+
+  Colour samples[4];
+  samples[0] = first;
+  for (int i = 1; i < 4; i++) {
+    samples[i] = traceSample(x + offsetX[i], y + offsetY[i], half);
+  }
+
+  Colour colour = Colour(0.0, 0.0, 0.0);
+  for (int i = 0; i < 4; i++) {
+    bool split = false;
+    for (int j = 0; depth > 1 && j < 4 && !split; j++) {
+      split = contrast(samples[i], samples[j]) > settings.adaptiveThreshold;
+    }
+
+    if (split) {
+      colour += refine(x + offsetX[i], y + offsetY[i], half, samples[i],
+                       depth - 1) *
+                0.25;
+    } else {
+      colour += samples[i] * 0.25;
+    }
+  }
+
+  return colour;
+}
+
+/*
+ * Primary rays for neighbouring pixels are traced as one packet, one
+ * pixel per lane. Each ray then leaves the packet at its first hit and
+ * is shaded and reflected on its own, as reflections rarely stay coherent.
+ */
+void Renderer::tracePacket(int x0, int y0, const Tile &tile,
+                           TGAWriter *imageWriter) {
+  Colour colours[PACKET_SIZE];
+  for (int i = 0; i < PACKET_SIZE; i++) {
+    colours[i] = Colour(0.0, 0.0, 0.0);
+  }
+
+  float step = settings.superSample ? 0.5f : 1.0f;
+  double coef = settings.superSample ? 0.25 : 1.0;
+
+  for (float offsetx = 0.0f; offsetx < 1.0f; offsetx += step) {
+    for (float offsety = 0.0f; offsety < 1.0f; offsety += step) {
+      RayPacket packet;
+
+      for (int i = 0; i < PACKET_SIZE; i++) {
+        int x = x0 + i % PACKET_WIDTH;
+        int y = y0 + i / PACKET_WIDTH;
+        if (x >= tile.x1 || y >= tile.y1) {
+          continue; // Lane falls outside the tile, leave it empty
+        }
+
+        float rx = x + offsetx;
+        float ry = y + offsety;
+        if (settings.jitter) {
+          jitter(rx, ry, 0.125f);
+        }
+        packet.set(i, view.createRay(rx, ry));
+      }
+
+      scene->closestHit(packet);
+      for (int i = 0; i < PACKET_SIZE; i++) {
+        threadStats.primaryRays += packet.active(i) ? 1 : 0;
+      }
+
+      for (int i = 0; i < PACKET_SIZE; i++) {
+        if (!packet.active(i)) {
+          continue;
+        }
+
+        // Refine the hit in double precision, falling back to a single
+        // ray if the packet's single precision hit doesn't hold up
+        Ray3 ray = packet.rays[i];
+        Hit hit;
+        if (packet.shape[i] != NULL) {
+          hit.t = packet.shape[i]->intersectPrimitive(ray, hit.primitive);
+          if (hit.t > 0) {
+            packet.shape[i]->completeHit(ray, hit);
+          } else {
+            scene->closestHit(ray, hit);
+          }
+        }
+
+        colours[i] = colours[i] + traceFrom(ray, hit, coef);
+      }
+    }
+  }
+
+  for (int i = 0; i < PACKET_SIZE; i++) {
+    int x = x0 + i % PACKET_WIDTH;
+    int y = y0 + i / PACKET_WIDTH;
+    if (x < tile.x1 && y < tile.y1) {
+      imageWriter->putPixel(x, y, colours[i]);
+    }
+  }
+}
+
+/*
+ * Samples are queued in the order tracePixel traces them, then summed
+ * per pixel once traced
+ */
+void Renderer::traceWavefront(const Tile &tile, TGAWriter *imageWriter,
+                              int firstRank,
+                              int lastRank) {
+  // Each thread keeps its queues' memory from tile to tile
+  static thread_local Wavefront wavefront;
+  wavefront.begin(scene, settings, spread);
+
+  float step = settings.superSample ? 0.5f : 1.0f;
+  double coef = settings.superSample ? 0.25 : 1.0;
+
+  vector<int> pixels; // x, y pairs, each followed by its samples in turn
+  for (int y = tile.y0; y < tile.y1; y++) {
+    for (int x = tile.x0; x < tile.x1; x++) {
+      int rank =
+          PROGRESSIVE_ORDER[y % PROGRESSIVE_BLOCK][x % PROGRESSIVE_BLOCK];
+      if (rank < firstRank || rank >= lastRank) {
+        continue;
+      }
+      pixels.push_back(x);
+      pixels.push_back(y);
+
+      for (float fragmentx = x; fragmentx < x + 1.0f; fragmentx += step) {
+        for (float fragmenty = y; fragmenty < y + 1.0f; fragmenty += step) {
+          float rx = fragmentx;
+          float ry = fragmenty;
+          if (settings.jitter) {
+            jitter(rx, ry, 0.125f);
+          }
+          wavefront.add(view.createRay(rx, ry), coef);
+        }
+      }
+    }
+  }
+
+  wavefront.trace();
+
+  int samples = settings.superSample ? 4 : 1;
+  for (size_t i = 0; i < pixels.size(); i += 2) {
+    Colour colour = Colour(0.0, 0.0, 0.0);
+    int first = (int)(i / 2) * samples;
+    for (int s = 0; s < samples; s++) {
+      colour = colour + wavefront.colour(first + s);
+    }
+    imageWriter->putPixel(pixels[i], pixels[i + 1], colour);
+  }
+}
+
+void Renderer::renderTile(const Tile &tile, TGAWriter *imageWriter,
+                          int firstRank, int lastRank) {
+  clearOccluders();
+
+  if (settings.wavefront) {
+    traceWavefront(tile, imageWriter, firstRank, lastRank);
+    Stats::flush();
+    return;
+  }
+
+  // Packets cover whole blocks of pixels, so only full passes use them
+  if (settings.packets && firstRank == 0 && lastRank == PROGRESSIVE_RANKS) {
+    for (int y = tile.y0; y < tile.y1; y += PACKET_HEIGHT) {
+      for (int x = tile.x0; x < tile.x1; x += PACKET_WIDTH) {
+        tracePacket(x, y, tile, imageWriter);
+      }
+    }
+    Stats::flush();
+    return;
+  }
+
+  for (int y = tile.y0; y < tile.y1; y++) {
+    for (int x = tile.x0; x < tile.x1; x++) {
+      int rank =
+          PROGRESSIVE_ORDER[y % PROGRESSIVE_BLOCK][x % PROGRESSIVE_BLOCK];
+      if (rank < firstRank || rank >= lastRank) {
+        continue;
+      }
+      imageWriter->putPixel(x, y, tracePixel((float)x, (float)y));
+    }
+  }
+  Stats::flush();
+}
+
+void Renderer::renderPass(TGAWriter *imageWriter, int firstRank,
+                          int lastRank) {
+  TileScheduler scheduler(settings.width, settings.height, settings.tileSize,
+                          settings.threads, settings.shard, settings.shards);
+
+  scheduler.run(
+      [this, imageWriter, firstRank, lastRank](int worker, const Tile &tile) {
+        renderTile(tile, imageWriter, firstRank, lastRank);
+      });
+}
+
+/*
+ * Pixels are picked from the one sample per pixel image before any are
+ * refined, so the result doesn't depend on the order tiles finish in.
+ * A shard of a frame only has its own tiles, so pixels are only compared
+ * with neighbours it rendered, and edges are marked by where each pixel
+ * is kept in the image rather than over the whole frame.
+ */
+void Renderer::renderAdaptive(TGAWriter *imageWriter) {
+  int width = settings.width;
+  int height = settings.height;
+
+  vector<bool> edges(imageWriter->slotCount(), false);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      if (!imageWriter->isStored(x, y)) {
+        continue;
+      }
+      Colour colour = imageWriter->getPixel(x, y);
+      // Each pair of neighbours is compared once, marking both
+      if (x + 1 < width && imageWriter->isStored(x + 1, y) &&
+          contrast(colour, imageWriter->getPixel(x + 1, y)) >
+              settings.adaptiveThreshold) {
+        edges[imageWriter->slot(x, y)] = true;
+        edges[imageWriter->slot(x + 1, y)] = true;
+      }
+      if (y + 1 < height && imageWriter->isStored(x, y + 1) &&
+          contrast(colour, imageWriter->getPixel(x, y + 1)) >
+              settings.adaptiveThreshold) {
+        edges[imageWriter->slot(x, y)] = true;
+        edges[imageWriter->slot(x, y + 1)] = true;
+      }
+    }
+  }
+
+  TileScheduler scheduler(width, height, settings.tileSize, settings.threads,
+                          settings.shard, settings.shards);
+
+  scheduler.run([this, imageWriter, &edges](int worker, const Tile &tile) {
+    clearOccluders();
+
+    for (int y = tile.y0; y < tile.y1; y++) {
+      for (int x = tile.x0; x < tile.x1; x++) {
+        if (edges[imageWriter->slot(x, y)]) {
+          imageWriter->putPixel(x, y,
+                                refine((float)x, (float)y, 1.0f,
+                                       imageWriter->getPixel(x, y),
+                                       settings.adaptiveDepth));
+        }
+      }
+    }
+    Stats::flush();
+  });
+}
+
+/*
+ * Each pixel is traced once, in the pass given by its rank, so later
+ * passes add to the samples of earlier ones rather than redoing them.
+ * Previews are written from their own thread while the passes run.
+ */
+void Renderer::renderProgressive(TGAWriter *imageWriter,
+                                 ImageOutput *output) {
+  mutex lock;
+  condition_variable finished;
+  bool done = false;
+
+  thread previews([this, imageWriter, output, &lock, &finished, &done]() {
+    chrono::duration<double> interval(settings.previewInterval);
+    unique_lock<mutex> guard(lock);
+    while (!finished.wait_for(guard, interval, [&done] { return done; })) {
+      output->write(imageWriter, settings.outputFile, true);
+    }
+  });
+
+  int passes = sizeof(PROGRESSIVE_PASSES) / sizeof(PROGRESSIVE_PASSES[0]) - 1;
+  for (int pass = 0; pass < passes; pass++) {
+    renderPass(imageWriter, PROGRESSIVE_PASSES[pass],
+               PROGRESSIVE_PASSES[pass + 1]);
+  }
+  if (settings.adaptiveDepth > 0) {
+    renderAdaptive(imageWriter);
+  }
+
+  {
+    lock_guard<mutex> guard(lock);
+    done = true;
+  }
+  finished.notify_one();
+  previews.join();
+}
+
+void Renderer::render(TGAWriter *imageWriter, ImageOutput *output) {
+  if (settings.previewInterval > 0) {
+    renderProgressive(imageWriter, output);
+    return;
+  }
+
+  renderPass(imageWriter, 0, PROGRESSIVE_RANKS);
+  if (settings.adaptiveDepth > 0) {
+    renderAdaptive(imageWriter);
+  }
+}
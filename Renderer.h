@@ -0,0 +1,90 @@
+/*
+ * Renderer.h
+ * Contains the Renderer class, which holds the tracing iteration
+ * and renders the image in tiles across worker threads.
+ */
+
+#pragma once
+
+#include "GeomX.h"
+#include "Illumination.h"
+#include "ImageOutput.h"
+#include "RayPacket.h"
+#include "RayTree.h"
+#include "RenderSettings.h"
+#include "Scene.h"
+#include "Shapes.h"
+#include "Stats.h"
+#include "TGAWriter.h"
+#include "TileScheduler.h"
+#include "View.h"
+#include "Wavefront.h"
+
+#include <list>
+
+/*
+ * Order pixels are traced in by a progressive render, repeating every
+ * 4x4 block. The first pass traces 1/16 of the pixels on a grid, and
+ * each later pass fills in between the pixels already traced.
+ */
+#define PROGRESSIVE_BLOCK 4
+#define PROGRESSIVE_RANKS (PROGRESSIVE_BLOCK * PROGRESSIVE_BLOCK)
+
+class Renderer {
+  Scene *scene;
+  View view;
+  RenderSettings settings;
+  double spread; // Angle covered by one sample, for texture filtering
+
+  // Traces a single pixel
+  Colour tracePixel(float x, float y);
+
+  // Traces one sample of an adaptively antialiased pixel, jittered
+  // within the square of the given size at x, y
+  Colour traceSample(float x, float y, float size);
+
+  /*
+   * Splits the square at x, y into quarters and samples them, reusing
+   * first as the sample of the first quarter. Quarters that differ from
+   * another by more than the threshold are split again, up to depth times
+   */
+  Colour refine(float x, float y, float size, Colour first, int depth);
+
+  // Traces the block of pixels covered by one packet of primary rays
+  void tracePacket(int x0, int y0, const Tile &tile, TGAWriter *imageWriter);
+
+  // Traces the pixels in a tile whose progressive rank is in
+  // [firstRank, lastRank) together through a Wavefront
+  void traceWavefront(const Tile &tile, TGAWriter *imageWriter, int firstRank,
+                      int lastRank);
+
+  // Renders the pixels in a tile whose progressive rank is in
+  // [firstRank, lastRank) into the imageWriter
+  void renderTile(const Tile &tile, TGAWriter *imageWriter, int firstRank,
+                  int lastRank);
+
+  // Renders the pixels of every tile with ranks in [firstRank, lastRank)
+  void renderPass(TGAWriter *imageWriter, int firstRank, int lastRank);
+
+  // Refines the pixels of a finished image that differ from a neighbour
+  // by more than the adaptive threshold
+  void renderAdaptive(TGAWriter *imageWriter);
+
+  // Renders in passes from coarse to fine, writing previews as it goes
+  void renderProgressive(TGAWriter *imageWriter, ImageOutput *output);
+
+public:
+  // The scene must already be built
+  Renderer(Scene *scene, RenderSettings settings);
+
+  // Follows a ray and the tree of reflections and refractions below it,
+  // weighting the colour by coef
+  Colour trace(Ray3 ray, double coef);
+
+  // Same as trace, for a ray whose first hit is already known
+  Colour traceFrom(Ray3 ray, Hit hit, double coef);
+
+  // Renders the whole image, filling the imageWriter
+  // Previews of a progressive render are queued on output
+  void render(TGAWriter *imageWriter, ImageOutput *output);
+};
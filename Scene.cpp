@@ -0,0 +1,883 @@
+#include "Scene.h"
+#include "MeshLoader.h"
+#include "RayTree.h"
+#include "Stats.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+// Salt for the hash jittering area light samples within their cells
+#define SALT_SHADOWS 0x536861646f770000ULL
+
+Scene::Scene() {
+  bvh = NULL;
+  lightTree = NULL;
+  eyePoint = Point3(0, 0, 1);
+  lookPoint = Point3(0, 0, 0);
+  viewUp = Vector3(0, 1, 0);
+  fov = 60;
+  width = -1;
+  height = -1;
+  recursionDepth = -1;
+  superSample = -1;
+  jitter = -1;
+  adaptiveDepth = -1;
+  frameCount = -1;
+}
+
+void Scene::add(Shape *shape) {
+  shapes.push_back(shape);
+
+  // A restored BVH no longer covers every shape
+  delete bvh;
+  bvh = NULL;
+}
+
+void Scene::add(Lighting *light) {
+  lights.push_back(light);
+  delete lightTree;
+  lightTree = NULL;
+}
+
+void Scene::setCamera(Point3 eyePosition, Point3 lookAtPoint,
+                      Vector3 upVector, double fieldOfView) {
+  eyePoint = eyePosition;
+  lookPoint = lookAtPoint;
+  viewUp = upVector;
+  fov = fieldOfView;
+}
+
+View Scene::view(int imageWidth, int imageHeight) {
+  return View(eyePoint, lookPoint, viewUp, fov, imageWidth, imageHeight);
+}
+
+void Scene::apply(RenderSettings &settings) {
+  if (width > 0)
+    settings.width = width;
+  if (height > 0)
+    settings.height = height;
+  if (recursionDepth > 0)
+    settings.recursionDepth = recursionDepth;
+  if (superSample >= 0)
+    settings.superSample = superSample == 1;
+  if (jitter >= 0)
+    settings.jitter = jitter == 1;
+  if (adaptiveDepth >= 0)
+    settings.adaptiveDepth = adaptiveDepth;
+}
+
+bool Scene::fail(const string &message) {
+  lastError = message;
+  return false;
+}
+
+vector<Shape *> Scene::boundedShapes() {
+  vector<Shape *> bounded;
+  planes.clear();
+  for (list<Shape *>::iterator it = shapes.begin(); it != shapes.end(); it++) {
+    Shape *itShape = *it;
+    if (itShape->bounded()) {
+      bounded.push_back(itShape);
+    } else {
+      planes.push_back(itShape);
+    }
+  }
+  return bounded;
+}
+
+void Scene::build() {
+  if (lightTree == NULL) {
+    lightTree = new LightTree(lights);
+  }
+  if (bvh != NULL) {
+    return;
+  }
+  bvh = new BVH(boundedShapes());
+}
+
+int Scene::frames() {
+  if (frameCount > 0) {
+    return frameCount;
+  }
+  int last = 0;
+  for (vector<CameraKey>::iterator it = cameraKeys.begin();
+       it != cameraKeys.end(); it++) {
+    last = max(last, it->frame);
+  }
+  for (vector<MoveKey>::iterator it = moveKeys.begin(); it != moveKeys.end();
+       it++) {
+    last = max(last, it->frame);
+  }
+  return last + 1;
+}
+
+/*
+ * Finds the keys either side of frame among keys [first, end), which are
+ * in frame order, returning how far frame is from the first to the second
+ * Frames before the first key or after the last hold that key
+ */
+template <typename Key>
+static double bracket(const vector<Key> &keys, size_t first, size_t end,
+                      int frame, size_t &from, size_t &to) {
+  from = first;
+  to = first;
+  while (to + 1 < end && keys[to].frame < frame) {
+    from = to;
+    to++;
+  }
+  if (keys[to].frame <= frame) {
+    from = to;
+  }
+  if (from == to) {
+    return 0;
+  }
+  return (double)(frame - keys[from].frame) /
+         (keys[to].frame - keys[from].frame);
+}
+
+void Scene::setFrame(int frame) {
+  size_t from, to;
+  if (!cameraKeys.empty()) {
+    double s = bracket(cameraKeys, 0, cameraKeys.size(), frame, from, to);
+    const CameraKey &a = cameraKeys[from];
+    const CameraKey &b = cameraKeys[to];
+    setCamera(a.eye + (b.eye - a.eye) * s, a.look + (b.look - a.look) * s,
+              a.up + (b.up - a.up) * s, a.fov + (b.fov - a.fov) * s);
+  }
+
+  // Shapes are moved by the change in their offset since the last frame
+  offsets.resize(shapeEntries.size(), Vector3(0));
+  bool moved = false;
+  for (size_t first = 0; first < moveKeys.size();) {
+    int shape = moveKeys[first].shape;
+    size_t end = first;
+    while (end < moveKeys.size() && moveKeys[end].shape == shape) {
+      end++;
+    }
+
+    double s = bracket(moveKeys, first, end, frame, from, to);
+    Vector3 offset = moveKeys[from].offset +
+                     (moveKeys[to].offset - moveKeys[from].offset) * s;
+    if (offset != offsets[shape]) {
+      entryShapes[shape]->translate(offset - offsets[shape]);
+      offsets[shape] = offset;
+      moved = moved || entryShapes[shape]->bounded();
+    }
+    first = end;
+  }
+
+  if (moved && bvh != NULL) {
+    bvh->refit();
+  }
+}
+
+double Scene::closestHit(Ray3 ray, Hit &hit) {
+  hit = Hit();
+  double bestHit = bvh->intersect(ray, hit);
+
+  for (vector<Shape *>::iterator it = planes.begin(); it != planes.end();
+       it++) {
+    Shape *itShape = *it;
+    double intersect = itShape->intersect(ray);
+    countTest(itShape->kind, intersect);
+    if (intersect > 0) {
+      if (bestHit < 0 || (bestHit > 0 && intersect < bestHit)) {
+        bestHit = intersect;
+        hit.shape = itShape;
+        hit.primitive = -1;
+      }
+    }
+  }
+
+  hit.t = bestHit;
+  if (hit.shape != NULL) {
+    hit.shape->completeHit(ray, hit);
+  }
+  return bestHit;
+}
+
+void Scene::closestHit(RayPacket &packet) {
+  bvh->intersect(packet);
+
+  float tHit[PACKET_SIZE];
+  for (vector<Shape *>::iterator it = planes.begin(); it != planes.end();
+       it++) {
+    (*it)->intersectPacket(packet, tHit);
+    packet.count((*it)->kind, tHit);
+    packet.update(tHit, *it);
+  }
+}
+
+bool Scene::occluded(Ray3 ray, double tMax, Shape **lastOccluder) {
+  // Neighbouring shadow rays are usually blocked by the same shape
+  if (lastOccluder != NULL && *lastOccluder != NULL) {
+    bool blocked = (*lastOccluder)->occludes(ray, tMax);
+    countTest((*lastOccluder)->kind, blocked ? 1.0 : -1.0);
+    if (blocked) {
+      threadStats.occluderCacheHits++;
+      return true;
+    }
+  }
+
+  Shape *occluder = NULL;
+  for (vector<Shape *>::iterator it = planes.begin(); it != planes.end();
+       it++) {
+    bool blocked = (*it)->occludes(ray, tMax);
+    countTest((*it)->kind, blocked ? 1.0 : -1.0);
+    if (blocked) {
+      occluder = *it;
+      break;
+    }
+  }
+  if (occluder == NULL) {
+    bvh->occluded(ray, tMax, &occluder);
+  }
+
+  if (lastOccluder != NULL) {
+    *lastOccluder = occluder;
+  }
+  return occluder != NULL;
+}
+
+void Scene::addEntryShape(const ShapeEntry &entry, Shape *shape) {
+  entryShapes.push_back(shape);
+  if (entry.name.empty()) {
+    shapes.push_back(shape);
+  } else {
+    objects.push_back(shape);
+  }
+}
+
+Material Scene::createMaterial(const MaterialEntry &entry) {
+  const double *v = entry.values;
+  if (entry.texture >= 0) {
+    return Material(textures[entry.texture].handle, Colour(v[3], v[4], v[5]),
+                    v[6], v[7], v[8], v[9]);
+  }
+  return Material(Colour(v[0], v[1], v[2]), Colour(v[3], v[4], v[5]), v[6],
+                  v[7], v[8], v[9]);
+}
+
+double Scene::visibility(Lighting *light, Point3 p, const Ray3 &ray,
+                         int samples, Shape **lastOccluder) {
+  if (!light->isArea()) {
+    Vector3 direction = light->direction(p);
+    double tMax = light->distance(p) - 0.01;
+    if (tMax <= 0) {
+      return 1;
+    }
+    threadStats.shadowRays++;
+    return occluded(Ray3(p + (direction / 100), direction), tMax,
+                    lastOccluder)
+               ? 0
+               : 1;
+  }
+
+  int grid = max((int)floor(sqrt((double)samples) + 0.5), 1);
+  auto blocked = [&](int cell) {
+    double u = (cell % grid + rayRandom(ray, SALT_SHADOWS + 2 * cell)) / grid;
+    double v =
+        (cell / grid + rayRandom(ray, SALT_SHADOWS + 2 * cell + 1)) / grid;
+    Vector3 toLight = light->samplePoint(p, u, v) - p;
+    double length = toLight.length();
+    if (length <= 0.02) {
+      return false;
+    }
+    Vector3 direction = toLight / length;
+    threadStats.shadowRays++;
+    return occluded(Ray3(p + (direction / 100), direction), length - 0.02,
+                    lastOccluder);
+  };
+
+  // The corners first. Most points see all of a light or none of it, and
+  // when its corners agree the rest of it nearly always does
+  threadStats.softShadows++;
+  int corners[4] = {0, grid - 1, grid * (grid - 1), grid * grid - 1};
+  int probes = grid > 1 ? 4 : 1;
+  int lit = 0;
+  for (int k = 0; k < probes; k++) {
+    lit += blocked(corners[k]) ? 0 : 1;
+  }
+  if (lit == 0 || lit == probes) {
+    return lit == 0 ? 0 : 1;
+  }
+
+  threadStats.penumbras++;
+  for (int cell = 1; cell < grid * grid - 1; cell++) {
+    if (cell != grid - 1 && cell != grid * (grid - 1)) {
+      lit += blocked(cell) ? 0 : 1;
+    }
+  }
+  return (double)lit / (grid * grid);
+}
+
+Lighting *Scene::createLight(const LightEntry &entry) {
+  const double *v = entry.values;
+  if (entry.type == LIGHT_RECT) {
+    return new RectLight(v[0], Point3(v[1], v[2], v[3]),
+                         Vector3(v[5], v[6], v[7]), Vector3(v[8], v[9], v[10]),
+                         v[4]);
+  }
+  if (entry.type == LIGHT_SPHERE) {
+    return new SphereLight(v[0], Point3(v[1], v[2], v[3]), v[5], v[4]);
+  }
+  // Light directions are normalised, as the renderer expects
+  Vector3 direction = unit(Vector3(v[1], v[2], v[3]));
+  if (entry.type == LIGHT_SPOT) {
+    return new SpotLight(v[0], direction, v[4], Point3(v[5], v[6], v[7]),
+                         v[8], v[9]);
+  }
+  return new DirectionLight(v[0], direction, v[4]);
+}
+
+bool Scene::validLight(const LightEntry &entry) {
+  const double *v = entry.values;
+  switch (entry.type) {
+  case LIGHT_DIRECTION:
+    return true;
+  case LIGHT_SPOT:
+    return v[9] >= 0;
+  case LIGHT_RECT:
+    return cross(Vector3(v[5], v[6], v[7]), Vector3(v[8], v[9], v[10]))
+               .length() > 0;
+  case LIGHT_SPHERE:
+    return v[5] > 0;
+  }
+  return false;
+}
+
+Shape *Scene::createShape(const ShapeEntry &entry) {
+  const double *v = &entry.values[0];
+  Material mat = createMaterial(materials[entry.material]);
+
+  switch (entry.type) {
+  case SHAPE_SPHERE:
+    return new Sphere(Point3(v[0], v[1], v[2]), v[3], mat);
+  case SHAPE_PLANE:
+    return new Plane(Point3(v[0], v[1], v[2]), Vector3(v[3], v[4], v[5]),
+                     mat);
+  case SHAPE_TRIANGLE:
+    return new Triangle(Point3(v[0], v[1], v[2]), Point3(v[3], v[4], v[5]),
+                        Point3(v[6], v[7], v[8]), mat);
+  case SHAPE_SQUARE:
+    return new Square(Point3(v[0], v[1], v[2]), Point3(v[3], v[4], v[5]),
+                      Vector3(v[6], v[7], v[8]), mat);
+  case SHAPE_CUBE: {
+    Cube *cube = new Cube(Point3(v[0], v[1], v[2]), v[3], mat);
+    if (entry.cull) {
+      cube->removeBackFaces(eyePoint);
+    }
+    return cube;
+  }
+  case SHAPE_POLYHEDRON: {
+    vector<Triangle *> faces;
+    for (size_t i = 0; i + 9 <= entry.values.size(); i += 9) {
+      faces.push_back(new Triangle(Point3(v[i], v[i + 1], v[i + 2]),
+                                   Point3(v[i + 3], v[i + 4], v[i + 5]),
+                                   Point3(v[i + 6], v[i + 7], v[i + 8]),
+                                   mat));
+    }
+    Polyhedron *polyhedron = new Polyhedron(faces, mat);
+    if (entry.cull) {
+      polyhedron->removeBackFaces(eyePoint);
+    }
+    return polyhedron;
+  }
+  case SHAPE_INSTANCE:
+    return new Instance(entryShapes[entry.object],
+                        Transform(Point3(v[0], v[1], v[2]),
+                                  Vector3(v[3], v[4], v[5]), v[6]));
+  }
+  return NULL;
+}
+
+bool Scene::load(const char *filename, int threads) {
+  ifstream file(filename, ios_base::binary);
+  if (!file) {
+    return fail(string("Can't open scene ") + filename);
+  }
+
+  char magic[8] = {0};
+  file.read(magic, sizeof(magic));
+  file.close();
+
+  if (memcmp(magic, "RAXARSCN", sizeof(magic)) == 0) {
+    return loadCompiled(filename);
+  }
+  return loadText(filename, threads);
+}
+
+/*
+ * Text scene descriptions
+ *
+ * One statement per line, arguments in the same order as the matching
+ * constructor. Points and vectors are three numbers, # starts a comment.
+ *
+ *   resolution <width> <height>
+ *   depth <recursion depth>
+ *   antialias [none] [supersample] [jitter] [adaptive <depth>]
+ *   camera <eye> <look at> <up> <fov>
+ *   texture <name> <file.tga>
+ *   material <name> <diffuse colour> <specular colour> <shininess>
+ *            <reflectiveness> <alpha> <refractive index>
+ *   material <name> <texture name> <specular colour> ...
+ *
+ * alpha is a material's opacity: below 1 the rest of the light passes
+ * through it, bent by the refractive index, which is relative to air.
+ *   light direction <intensity> <direction> <ambient>
+ *   light spot <intensity> <direction> <ambient> <origin> <attenuation>
+ *              [<range>]
+ *   light rect <intensity> <corner> <ambient> <edge> <edge>
+ *   light sphere <intensity> <centre> <ambient> <radius>
+ *   sphere <centre> <radius> <material>
+ *   plane <point> <normal> <material>
+ *   triangle <point> <point> <point> <material>
+ *   square <corner> <corner> <normal> <material>
+ *   cube <centre> <size> <material> [cull]
+ *   polyhedron <material> [cull]
+ *     face <point> <point> <point>
+ *   end
+ *   mesh <file.obj|file.ply> <material>
+ *
+ * Rect and sphere lights are area lights casting soft shadows. A rect
+ * light shines from the side its first edge crossed with its second
+ * points to.
+ *
+ * A shape named by object isn't put in the scene itself, but placed any
+ * number of times by instances, which rotate it by degrees about the x,
+ * then y, then z axis, scale it and move it to position. Objects can be
+ * any bounded shape, and are never culled.
+ *
+ *   object <name>
+ *     <shape statement>
+ *   instance <object name> <position> [<rotation> [<scale>]]
+ *
+ * Animations number their frames from 0, and hold the first and last
+ * keys before and after them. Keys are interpolated linearly and must be
+ * given in frame order. A shape's keys follow it, and move it from where
+ * it was placed. A polyhedron's keys follow its end, and an object is
+ * moved by keys after each of its instances rather than after the object
+ * itself. Culling is skipped when the camera or the shape moves.
+ *
+ *   frames <count>
+ *   key camera <frame> <eye> <look at> <up> <fov>
+ *   key move <frame> <offset>
+ */
+
+// Reads count numbers from the words starting at index
+static bool readNumbers(const vector<string> &words, size_t &index, int count,
+                        double *values) {
+  for (int i = 0; i < count; i++, index++) {
+    if (index >= words.size()) {
+      return false;
+    }
+    char *end;
+    values[i] = strtod(words[index].c_str(), &end);
+    if (*end != '\0' || end == words[index].c_str()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool isNumber(const string &word) {
+  char *end;
+  strtod(word.c_str(), &end);
+  return *end == '\0' && end != word.c_str();
+}
+
+bool Scene::loadText(const char *filename, int threads) {
+  ifstream file(filename);
+  if (!file) {
+    return fail(string("Can't open scene ") + filename);
+  }
+
+  ShapeEntry *polyhedron = NULL; // Polyhedron taking faces, if any
+  string objectName;             // Name for the next shape, if any
+  string line;
+  int lineNumber = 0;
+
+  while (getline(file, line)) {
+    lineNumber++;
+
+    size_t comment = line.find('#');
+    if (comment != string::npos) {
+      line.erase(comment);
+    }
+
+    vector<string> words;
+    istringstream stream(line);
+    string word;
+    while (stream >> word) {
+      words.push_back(word);
+    }
+    if (words.empty()) {
+      continue;
+    }
+
+    ostringstream where;
+    where << filename << ":" << lineNumber << ": ";
+
+    const string &command = words[0];
+    size_t index = 1;
+    double values[12];
+
+    // Looks up a material by name
+    int material = -1;
+    if (command != "material" && command != "texture" &&
+        words.size() >= 2) {
+      const string &name = words.back() == "cull" && words.size() >= 3
+                               ? words[words.size() - 2]
+                               : words.back();
+      for (size_t m = 0; m < materials.size(); m++) {
+        if (materials[m].name == name) {
+          material = (int)m;
+        }
+      }
+    }
+
+    if (polyhedron != NULL && command == "key") {
+      return fail(where.str() + "keys go after a polyhedron's end");
+    }
+    if (polyhedron != NULL && command != "face" && command != "end") {
+      return fail(where.str() + "expected face or end in polyhedron");
+    }
+
+    if (command == "resolution") {
+      if (!readNumbers(words, index, 2, values) || values[0] < 1 ||
+          values[1] < 1) {
+        return fail(where.str() + "resolution <width> <height>");
+      }
+      width = (int)values[0];
+      height = (int)values[1];
+    } else if (command == "depth") {
+      if (!readNumbers(words, index, 1, values) || values[0] < 1) {
+        return fail(where.str() + "depth <recursion depth>");
+      }
+      recursionDepth = (int)values[0];
+    } else if (command == "antialias") {
+      superSample = 0;
+      jitter = 0;
+      adaptiveDepth = 0;
+      for (; index < words.size(); index++) {
+        if (words[index] == "supersample") {
+          superSample = 1;
+        } else if (words[index] == "jitter") {
+          jitter = 1;
+        } else if (words[index] == "adaptive") {
+          index++;
+          if (!readNumbers(words, index, 1, values) || values[0] < 0) {
+            return fail(where.str() + "adaptive <depth>");
+          }
+          adaptiveDepth = (int)values[0];
+          index--;
+        } else if (words[index] != "none") {
+          return fail(where.str() + "unknown antialiasing " + words[index]);
+        }
+      }
+    } else if (command == "camera") {
+      if (!readNumbers(words, index, 10, values)) {
+        return fail(where.str() + "camera <eye> <look at> <up> <fov>");
+      }
+      setCamera(Point3(values[0], values[1], values[2]),
+                Point3(values[3], values[4], values[5]),
+                Vector3(values[6], values[7], values[8]), values[9]);
+    } else if (command == "frames") {
+      if (!readNumbers(words, index, 1, values) || values[0] < 1 ||
+          index != words.size()) {
+        return fail(where.str() + "frames <count>");
+      }
+      frameCount = (int)values[0];
+    } else if (command == "key" && words.size() >= 2 &&
+               words[1] == "camera") {
+      index = 2;
+      if (!readNumbers(words, index, 11, values) || index != words.size() ||
+          values[0] < 0) {
+        return fail(where.str() +
+                    "key camera <frame> <eye> <look at> <up> <fov>");
+      }
+      CameraKey key;
+      key.frame = (int)values[0];
+      key.eye = Point3(values[1], values[2], values[3]);
+      key.look = Point3(values[4], values[5], values[6]);
+      key.up = Vector3(values[7], values[8], values[9]);
+      key.fov = values[10];
+      if (!cameraKeys.empty() && key.frame <= cameraKeys.back().frame) {
+        return fail(where.str() + "camera keys must be in frame order");
+      }
+      cameraKeys.push_back(key);
+    } else if (command == "key" && words.size() >= 2 && words[1] == "move") {
+      index = 2;
+      if (!readNumbers(words, index, 4, values) || index != words.size() ||
+          values[0] < 0) {
+        return fail(where.str() + "key move <frame> <offset>");
+      }
+      if (shapeEntries.empty()) {
+        return fail(where.str() + "key move before any shape");
+      }
+      // An object is only placed by its instances, each moved on its own
+      if (!shapeEntries.back().name.empty()) {
+        return fail(where.str() + "key move after an object, move its "
+                                  "instances instead");
+      }
+      MoveKey key;
+      key.shape = (int)shapeEntries.size() - 1;
+      key.frame = (int)values[0];
+      key.offset = Vector3(values[1], values[2], values[3]);
+      if (!moveKeys.empty() && moveKeys.back().shape == key.shape &&
+          key.frame <= moveKeys.back().frame) {
+        return fail(where.str() + "move keys must be in frame order");
+      }
+      moveKeys.push_back(key);
+    } else if (command == "object") {
+      if (words.size() != 2 || !objectName.empty()) {
+        return fail(where.str() + "object <name> followed by a shape");
+      }
+      objectName = words[1];
+    } else if (command == "instance") {
+      size_t count = words.size() - 2;
+      index = 2;
+      double placement[7] = {0, 0, 0, 0, 0, 0, 1};
+      if (words.size() < 2 ||
+          (count != 3 && count != 6 && count != 7) ||
+          !readNumbers(words, index, (int)count, placement) ||
+          placement[6] <= 0) {
+        return fail(where.str() + "instance <object> <position> "
+                                  "[<rotation> [<scale>]]");
+      }
+      ShapeEntry entry;
+      entry.type = SHAPE_INSTANCE;
+      entry.cull = false;
+      entry.object = -1;
+      for (size_t i = 0; i < shapeEntries.size(); i++) {
+        if (shapeEntries[i].name == words[1]) {
+          entry.object = (int)i;
+        }
+      }
+      if (entry.object < 0) {
+        return fail(where.str() + "unknown object " + words[1]);
+      }
+      entry.material = shapeEntries[entry.object].material;
+      entry.values.assign(placement, placement + 7);
+      shapeEntries.push_back(entry);
+    } else if (command == "texture") {
+      if (words.size() != 3) {
+        return fail(where.str() + "texture <name> <file.tga>");
+      }
+      TextureEntry texture;
+      texture.name = words[1];
+      texture.handle = TextureCache::instance().load(words[2].c_str());
+      if (texture.handle < 0) {
+        return fail(where.str() + "can't load texture " + words[2]);
+      }
+      textures.push_back(texture);
+    } else if (command == "material") {
+      MaterialEntry entry;
+      entry.texture = -1;
+      for (int i = 0; i < 3; i++) {
+        entry.values[i] = 0;
+      }
+
+      if (words.size() < 3) {
+        return fail(where.str() + "material <name> <colour|texture> ...");
+      }
+      entry.name = words[1];
+      index = 2;
+
+      bool valid;
+      if (isNumber(words[2])) {
+        valid = readNumbers(words, index, 10, entry.values);
+      } else {
+        for (size_t t = 0; t < textures.size(); t++) {
+          if (textures[t].name == words[2]) {
+            entry.texture = (int)t;
+          }
+        }
+        if (entry.texture < 0) {
+          return fail(where.str() + "unknown texture " + words[2]);
+        }
+        index = 3;
+        valid = readNumbers(words, index, 7, entry.values + 3);
+      }
+      if (!valid || index != words.size()) {
+        return fail(where.str() + "material <name> <colour|texture> "
+                                  "<specular> <shininess> <reflectiveness> "
+                                  "<alpha> <refractive index>");
+      }
+      materials.push_back(entry);
+    } else if (command == "light") {
+      LightEntry entry;
+      for (int i = 0; i < 11; i++) {
+        entry.values[i] = 0;
+      }
+      index = 2;
+      bool valid = false;
+      if (words.size() >= 2 && words[1] == "direction") {
+        entry.type = LIGHT_DIRECTION;
+        valid = readNumbers(words, index, 5, entry.values);
+      } else if (words.size() >= 2 && words[1] == "spot") {
+        entry.type = LIGHT_SPOT;
+        valid = readNumbers(words, index, 9, entry.values);
+        if (valid && index < words.size()) {
+          valid = readNumbers(words, index, 1, entry.values + 9) &&
+                  entry.values[9] >= 0;
+        }
+      } else if (words.size() >= 2 && words[1] == "rect") {
+        entry.type = LIGHT_RECT;
+        valid = readNumbers(words, index, 11, entry.values);
+      } else if (words.size() >= 2 && words[1] == "sphere") {
+        entry.type = LIGHT_SPHERE;
+        valid = readNumbers(words, index, 6, entry.values);
+      }
+      if (valid && !validLight(entry)) {
+        return fail(where.str() + "area light has no area");
+      }
+      if (!valid || index != words.size()) {
+        return fail(where.str() + "light direction|spot <intensity> "
+                                  "<direction> <ambient> [<origin> "
+                                  "<attenuation> [<range>]]\n"
+                                  "or light rect <intensity> <corner> "
+                                  "<ambient> <edge> <edge>\n"
+                                  "or light sphere <intensity> <centre> "
+                                  "<ambient> <radius>");
+      }
+      lightEntries.push_back(entry);
+    } else if (command == "face") {
+      if (polyhedron == NULL || !readNumbers(words, index, 9, values) ||
+          index != words.size()) {
+        return fail(where.str() + "face <point> <point> <point>");
+      }
+      polyhedron->values.insert(polyhedron->values.end(), values, values + 9);
+    } else if (command == "end") {
+      if (polyhedron == NULL || polyhedron->values.empty()) {
+        return fail(where.str() + "end without a polyhedron with faces");
+      }
+      polyhedron = NULL;
+    } else {
+      // Everything else is a shape
+      ShapeEntry entry;
+      entry.cull = words.back() == "cull";
+      entry.object = -1;
+      int count;
+
+      if (command == "sphere") {
+        entry.type = SHAPE_SPHERE;
+        count = 4;
+      } else if (command == "plane") {
+        entry.type = SHAPE_PLANE;
+        count = 6;
+      } else if (command == "triangle") {
+        entry.type = SHAPE_TRIANGLE;
+        count = 9;
+      } else if (command == "square") {
+        entry.type = SHAPE_SQUARE;
+        count = 9;
+      } else if (command == "cube") {
+        entry.type = SHAPE_CUBE;
+        count = 4;
+      } else if (command == "polyhedron") {
+        entry.type = SHAPE_POLYHEDRON;
+        count = 0;
+      } else if (command == "mesh") {
+        entry.type = SHAPE_MESH;
+        count = 0;
+        index = 2;
+        if (words.size() >= 2) {
+          entry.file = words[1];
+        }
+      } else {
+        return fail(where.str() + "unknown statement " + command);
+      }
+
+      if (!readNumbers(words, index, count, values)) {
+        return fail(where.str() + "wrong number of values for " + command);
+      }
+      if (material < 0 || index + 1 + (entry.cull ? 1 : 0) != words.size()) {
+        return fail(where.str() + "expected a material after " + command);
+      }
+      if (entry.cull && entry.type != SHAPE_CUBE &&
+          entry.type != SHAPE_POLYHEDRON) {
+        return fail(where.str() + "only cubes and polyhedra can be culled");
+      }
+
+      if (!objectName.empty()) {
+        if (entry.type == SHAPE_PLANE) {
+          return fail(where.str() + "planes can't be objects");
+        }
+        entry.name = objectName;
+        objectName.clear();
+      }
+
+      entry.material = material;
+      entry.values.assign(values, values + count);
+      shapeEntries.push_back(entry);
+
+      if (entry.type == SHAPE_POLYHEDRON) {
+        polyhedron = &shapeEntries.back();
+      }
+    }
+  }
+
+  if (polyhedron != NULL) {
+    return fail(string(filename) + ": polyhedron missing end");
+  }
+  if (!objectName.empty()) {
+    return fail(string(filename) + ": object " + objectName +
+                " missing its shape");
+  }
+
+  // Culling only holds for the camera and shape it was done with, and
+  // objects are seen from wherever they are placed
+  for (vector<ShapeEntry>::iterator it = shapeEntries.begin();
+       it != shapeEntries.end(); it++) {
+    it->cull = it->cull && it->name.empty();
+  }
+  for (vector<MoveKey>::iterator it = moveKeys.begin(); it != moveKeys.end();
+       it++) {
+    shapeEntries[it->shape].cull = false;
+  }
+  for (size_t i = 0; i < shapeEntries.size() && !cameraKeys.empty(); i++) {
+    shapeEntries[i].cull = false;
+  }
+
+  // Shapes are made once the whole file is read, as culling needs the
+  // final camera position
+  for (vector<LightEntry>::iterator it = lightEntries.begin();
+       it != lightEntries.end(); it++) {
+    lights.push_back(createLight(*it));
+  }
+
+  for (vector<ShapeEntry>::iterator it = shapeEntries.begin();
+       it != shapeEntries.end(); it++) {
+    if (it->type != SHAPE_MESH) {
+      addEntryShape(*it, createShape(*it));
+      continue;
+    }
+
+    MeshData data;
+    if (!loadMesh(it->file.c_str(), data, threads)) {
+      return fail(string("Can't load mesh ") + it->file);
+    }
+    addEntryShape(*it, new Mesh(move(data.vertices), move(data.indices),
+                                createMaterial(materials[it->material])));
+  }
+
+  return true;
+}
+
+Scene::~Scene() {
+  delete bvh;
+  delete lightTree;
+  for (list<Shape *>::iterator it = shapes.begin(); it != shapes.end(); it++) {
+    delete *it;
+  }
+  for (list<Shape *>::iterator it = objects.begin(); it != objects.end();
+       it++) {
+    delete *it;
+  }
+  for (list<Lighting *>::iterator it = lights.begin(); it != lights.end();
+       it++) {
+    delete *it;
+  }
+}
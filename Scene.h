@@ -0,0 +1,259 @@
+/*
+ * Scene.h
+ * Contains the Scene class, which holds the shapes, lights and camera
+ * for a render along with the BVH used to trace rays through them.
+ *
+ * A scene is either built in code, read from a text scene description,
+ * or mapped from a compiled scene. Compiled scenes hold decoded textures
+ * and already built acceleration structures, so they load in
+ * milliseconds for repeated renders of the same scene.
+ *
+ * Shapes named as objects are placed by instances rather than traced
+ * themselves, so the scene BVH holds each instance and each object keeps
+ * its own BVH below it, stored once however often it is placed.
+ *
+ * A scene may also be animated, by keyframing its camera and moving its
+ * shapes. Moving a shape refits the BVH rather than rebuilding it, so
+ * textures, meshes and the tree all stay resident from frame to frame.
+ */
+
+#pragma once
+
+#include "BVH.h"
+#include "BinaryIO.h"
+#include "GeomX.h"
+#include "Illumination.h"
+#include "LightTree.h"
+#include "MappedFile.h"
+#include "RayPacket.h"
+#include "RenderSettings.h"
+#include "Shapes.h"
+#include "TextureCache.h"
+#include "View.h"
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Colour of camera rays that leave the scene without hitting anything
+#define SKY_COLOUR Colour(0.529, 0.808, 0.922)
+
+using namespace std;
+
+class Scene {
+
+  /*
+   * Descriptions of everything a scene file defined
+   * These are kept so the scene can be compiled
+   */
+  struct TextureEntry {
+    string name;
+    int handle; // Into the TextureCache
+  };
+
+  // Diffuse (3), specular (3), shininess, reflectiveness, alpha and
+  // refractive index, with the diffuse colour unused for textures
+  struct MaterialEntry {
+    string name;
+    double values[10];
+    int texture; // Index into textures, or -1 for a plain colour
+  };
+
+  enum LightType { LIGHT_DIRECTION, LIGHT_SPOT, LIGHT_RECT, LIGHT_SPHERE };
+
+  // Intensity, direction (3), ambient, origin (3), attenuation and
+  // range, 0 if the light has none. Area lights keep the intensity and
+  // ambient there, with a rectangle's corner (3) and edges (3, 3) or a
+  // sphere's centre (3) and radius around them
+  struct LightEntry {
+    int type;
+    double values[11];
+  };
+
+  enum ShapeType {
+    SHAPE_SPHERE,
+    SHAPE_PLANE,
+    SHAPE_TRIANGLE,
+    SHAPE_SQUARE,
+    SHAPE_CUBE,
+    SHAPE_POLYHEDRON,
+    SHAPE_MESH,
+    SHAPE_INSTANCE // Position (3), rotation (3) and scale
+  };
+
+  // The shape's constructor arguments, in order
+  struct ShapeEntry {
+    int type;
+    int material;
+    bool cull; // Remove back faces as seen from the camera
+    vector<double> values;
+    string file; // Mesh file
+    string name; // Object name, for shapes only placed by instances
+    int object;  // Entry an instance places, or -1
+  };
+
+  // Camera at a keyframe
+  struct CameraKey {
+    int frame;
+    Point3 eye;
+    Point3 look;
+    Vector3 up;
+    double fov;
+  };
+
+  // Offset of a shape from where the scene placed it, at a keyframe
+  struct MoveKey {
+    int shape; // Index into shapeEntries
+    int frame;
+    Vector3 offset;
+  };
+
+  vector<TextureEntry> textures;
+  vector<MaterialEntry> materials;
+  vector<LightEntry> lightEntries;
+  vector<ShapeEntry> shapeEntries;
+
+  list<Shape *> shapes;
+  list<Lighting *> lights;
+
+  // Shapes placed by instances, which aren't traced directly
+  list<Shape *> objects;
+
+  // The shape made for each entry, placed or not
+  vector<Shape *> entryShapes;
+
+  // Keyframes in frame order, with move keys grouped by shape
+  vector<CameraKey> cameraKeys;
+  vector<MoveKey> moveKeys;
+  int frameCount; // Frames given by the scene, or -1 to end at the last key
+  vector<Vector3> offsets; // Current offset of each shape entry
+
+  BVH *bvh;               // Every bounded shape in the scene
+  LightTree *lightTree;   // Every light, built with the BVH
+  vector<Shape *> planes; // Unbounded shapes, tested one by one
+
+  // A compiled scene's mapping, shared with the TextureCache as it
+  // holds the scene's texels
+  shared_ptr<MappedFile> compiled;
+
+  // Camera
+  Point3 eyePoint;
+  Point3 lookPoint;
+  Vector3 viewUp;
+  double fov;
+
+  // Render settings given by the scene, or -1 where it gives none
+  int width;
+  int height;
+  int recursionDepth;
+  int superSample;
+  int jitter;
+  int adaptiveDepth;
+
+  string lastError;
+
+  bool loadText(const char *filename, int threads);
+  bool loadCompiled(const char *filename);
+
+  Material createMaterial(const MaterialEntry &entry);
+  Lighting *createLight(const LightEntry &entry);
+  // False if the entry's type is unknown or its range or area is bad
+  static bool validLight(const LightEntry &entry);
+  // Creates any shape but a mesh, which is loaded separately
+  Shape *createShape(const ShapeEntry &entry);
+
+  // Puts the shape made for the next entry in the scene, or aside for
+  // instances if the entry is a named object
+  void addEntryShape(const ShapeEntry &entry, Shape *shape);
+
+  // Splits the shapes into planes and the rest, to be put in the BVH
+  vector<Shape *> boundedShapes();
+
+  bool fail(const string &message);
+
+public:
+  Scene();
+
+  // Adds shapes and lights built in code
+  void add(Shape *shape);
+  void add(Lighting *light);
+
+  void setCamera(Point3 eyePosition, Point3 lookAtPoint, Vector3 upVector,
+                 double fieldOfView);
+
+  // The camera for an image of the given size
+  View view(int imageWidth, int imageHeight);
+
+  /*
+   * Loads a scene file, either a text description or a compiled scene
+   * Returns false and sets error() if the file can't be used
+   */
+  bool load(const char *filename, int threads);
+
+  /*
+   * Writes the scene as a compiled scene, building it first if needed
+   * Only scenes loaded from a file can be compiled
+   */
+  bool compile(const char *filename);
+
+  string error() { return lastError; }
+
+  // Overrides any settings the scene file gave
+  void apply(RenderSettings &settings);
+
+  // Builds the BVH, unless it was restored from a compiled scene
+  void build();
+
+  /*
+   * Animation
+   */
+
+  // Number of frames in the animation, 1 for a still scene
+  int frames();
+
+  bool animated() { return !cameraKeys.empty() || !moveKeys.empty(); }
+
+  /*
+   * Moves the camera and shapes to where they are at frame, interpolating
+   * between keyframes, and refits the BVH if any bounded shape moved
+   */
+  void setFrame(int frame);
+
+  /*
+   * Ray queries
+   */
+
+  /*
+   * Finds the closest shape hit by the ray and fills in hit there
+   * Returns the distance, or -1 with hit.shape NULL if nothing is hit
+   */
+  double closestHit(Ray3 ray, Hit &hit);
+
+  // Closest shape hit by each lane of the packet
+  void closestHit(RayPacket &packet);
+
+  /*
+   * Returns true if anything blocks the ray before tMax
+   * lastOccluder, if given, is tried before anything else and is set to
+   * the blocker found, or NULL if there is none
+   */
+  bool occluded(Ray3 ray, double tMax, Shape **lastOccluder);
+
+  /*
+   * Returns how much of light p sees, 0 in shadow to 1 fully lit.
+   * A point or direction light takes one shadow ray. An area light is
+   * split into a grid of about samples cells, one jittered shadow ray
+   * each, but only the corner cells are tried unless they disagree, so
+   * only points in penumbra pay for every cell. ray, the ray that hit
+   * p, places the jitter. lastOccluder is as for occluded()
+   */
+  double visibility(Lighting *light, Point3 p, const Ray3 &ray, int samples,
+                    Shape **lastOccluder);
+
+  list<Lighting *> &getLights() { return lights; }
+  LightTree &getLightTree() { return *lightTree; }
+  list<Shape *> &getShapes() { return shapes; }
+
+  ~Scene();
+};
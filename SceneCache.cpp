@@ -0,0 +1,246 @@
+/*
+ * SceneCache.cpp
+ * Compiled scenes
+ *
+ * A compiled scene is the parsed scene file with the mip pyramid of every
+ * texture and every BVH already built, stored in the order it is read back:
+ *
+ *   magic, version
+ *   settings, camera
+ *   textures  name, file, size, mip pyramid
+ *   materials
+ *   lights
+ *   shapes    entry, followed by the vertices and BVH of meshes, with
+ *             objects before the instances that place them
+ *   keyframes frame count, camera keys, move keys
+ *   scene BVH
+ *
+ * Loading maps the file and reads it in place, mip pyramids are sampled
+ * straight out of the mapping.
+ */
+
+#include "Scene.h"
+
+#include <iostream>
+
+static const char SCENE_MAGIC[8] = {'R', 'A', 'X', 'A', 'R', 'S', 'C', 'N'};
+static const uint32_t SCENE_VERSION = 7;
+
+bool Scene::compile(const char *filename) {
+  // Shapes built in code have no description to save
+  if (shapeEntries.size() != shapes.size() + objects.size() ||
+      lightEntries.size() != lights.size()) {
+    return fail("Only scenes loaded from a scene file can be compiled");
+  }
+
+  build();
+
+  BinaryWriter out(filename);
+  if (!out.ok()) {
+    return fail(string("Can't write compiled scene ") + filename);
+  }
+
+  out.writeBytes(SCENE_MAGIC, sizeof(SCENE_MAGIC));
+  out.write(SCENE_VERSION);
+
+  out.write(width);
+  out.write(height);
+  out.write(recursionDepth);
+  out.write(superSample);
+  out.write(jitter);
+  out.write(adaptiveDepth);
+
+  out.write(eyePoint);
+  out.write(lookPoint);
+  out.write(viewUp);
+  out.write(fov);
+
+  TextureCache &cache = TextureCache::instance();
+  out.write((uint64_t)textures.size());
+  for (vector<TextureEntry>::iterator it = textures.begin();
+       it != textures.end(); it++) {
+    const Texture *texture = cache.get(it->handle);
+    out.writeString(it->name);
+    out.writeString(cache.file(it->handle));
+    out.write(texture->getWidth());
+    out.write(texture->getHeight());
+    out.writeBytes(texture->data(), texture->size());
+  }
+
+  out.write((uint64_t)materials.size());
+  for (vector<MaterialEntry>::iterator it = materials.begin();
+       it != materials.end(); it++) {
+    out.writeString(it->name);
+    out.write(it->values);
+    out.write(it->texture);
+  }
+
+  out.write((uint64_t)lightEntries.size());
+  for (vector<LightEntry>::iterator it = lightEntries.begin();
+       it != lightEntries.end(); it++) {
+    out.write(*it);
+  }
+
+  out.write((uint64_t)shapeEntries.size());
+  for (size_t i = 0; i < shapeEntries.size(); i++) {
+    const ShapeEntry &entry = shapeEntries[i];
+    out.write(entry.type);
+    out.write(entry.material);
+    out.write(entry.cull);
+    out.writeArray(entry.values);
+    out.writeString(entry.file);
+    out.writeString(entry.name);
+    out.write(entry.object);
+    if (entry.type == SHAPE_MESH) {
+      ((Mesh *)entryShapes[i])->write(out);
+    }
+  }
+
+  out.write(frameCount);
+  out.writeArray(cameraKeys);
+  out.writeArray(moveKeys);
+
+  bvh->write(out);
+
+  if (!out.ok()) {
+    return fail(string("Failed writing compiled scene ") + filename);
+  }
+  return true;
+}
+
+bool Scene::loadCompiled(const char *filename) {
+  compiled = make_shared<MappedFile>();
+  if (!compiled->open(filename)) {
+    return fail(string("Can't open scene ") + filename);
+  }
+  BinaryReader in(compiled->data(), compiled->size());
+
+  const char *magic = in.readBytes(sizeof(SCENE_MAGIC));
+  if (magic == NULL || memcmp(magic, SCENE_MAGIC, sizeof(SCENE_MAGIC)) != 0 ||
+      in.read<uint32_t>() != SCENE_VERSION) {
+    return fail(string(filename) + " was compiled by another version");
+  }
+
+  width = in.read<int>();
+  height = in.read<int>();
+  recursionDepth = in.read<int>();
+  superSample = in.read<int>();
+  jitter = in.read<int>();
+  adaptiveDepth = in.read<int>();
+
+  eyePoint = in.read<Point3>();
+  lookPoint = in.read<Point3>();
+  viewUp = in.read<Vector3>();
+  fov = in.read<double>();
+
+  uint64_t count = in.read<uint64_t>();
+  for (uint64_t i = 0; i < count && in.ok(); i++) {
+    TextureEntry texture;
+    texture.name = in.readString();
+    string file = in.readString();
+
+    int textureWidth = in.read<int>();
+    int textureHeight = in.read<int>();
+    if (textureWidth < 1 || textureHeight < 1 || textureWidth > 65535 ||
+        textureHeight > 65535) {
+      in.fail();
+      break;
+    }
+    // Texels stay in the mapping, which the cache keeps alive
+    size_t size = Texture::pyramidSize(textureWidth, textureHeight);
+    const unsigned char *texels = (const unsigned char *)in.readBytes(size);
+    if (!in.ok()) {
+      break;
+    }
+    texture.handle = TextureCache::instance().add(
+        file, textureWidth, textureHeight, texels, size, compiled);
+    if (texture.handle < 0) {
+      in.fail();
+      break;
+    }
+    textures.push_back(texture);
+  }
+
+  count = in.read<uint64_t>();
+  for (uint64_t i = 0; i < count && in.ok(); i++) {
+    MaterialEntry material;
+    material.name = in.readString();
+    const char *values = in.readBytes(sizeof(material.values));
+    if (values != NULL) {
+      memcpy(material.values, values, sizeof(material.values));
+    }
+    material.texture = in.read<int>();
+    if (material.texture >= (int)textures.size()) {
+      in.fail();
+    }
+    materials.push_back(material);
+  }
+
+  count = in.read<uint64_t>();
+  for (uint64_t i = 0; i < count && in.ok(); i++) {
+    LightEntry light = in.read<LightEntry>();
+    if (!validLight(light)) {
+      in.fail();
+    }
+    lightEntries.push_back(light);
+  }
+
+  if (!in.ok()) {
+    return fail(string(filename) + " is corrupt");
+  }
+  for (vector<LightEntry>::iterator it = lightEntries.begin();
+       it != lightEntries.end(); it++) {
+    lights.push_back(createLight(*it));
+  }
+
+  count = in.read<uint64_t>();
+  for (uint64_t i = 0; i < count && in.ok(); i++) {
+    ShapeEntry entry;
+    entry.type = in.read<int>();
+    entry.material = in.read<int>();
+    entry.cull = in.read<bool>();
+    in.readArray(entry.values);
+    entry.file = in.readString();
+    entry.name = in.readString();
+    entry.object = in.read<int>();
+
+    // Every entry must have the values its constructor reads, and an
+    // instance must place an object read before it
+    size_t needed[] = {4, 6, 9, 9, 4, 9, 0, 7};
+    if (!in.ok() || entry.type < SHAPE_SPHERE ||
+        entry.type > SHAPE_INSTANCE || entry.material < 0 ||
+        entry.material >= (int)materials.size() ||
+        entry.values.size() < needed[entry.type] ||
+        (entry.type == SHAPE_INSTANCE &&
+         (entry.object < 0 || entry.object >= (int)shapeEntries.size() ||
+          shapeEntries[entry.object].name.empty()))) {
+      in.fail();
+      break;
+    }
+    shapeEntries.push_back(entry);
+
+    if (entry.type == SHAPE_MESH) {
+      addEntryShape(entry,
+                    new Mesh(in, createMaterial(materials[entry.material])));
+    } else {
+      addEntryShape(entry, createShape(entry));
+    }
+  }
+
+  frameCount = in.read<int>();
+  in.readArray(cameraKeys);
+  in.readArray(moveKeys);
+  for (vector<MoveKey>::iterator it = moveKeys.begin(); it != moveKeys.end();
+       it++) {
+    if (it->shape < 0 || it->shape >= (int)shapeEntries.size()) {
+      in.fail();
+    }
+  }
+
+  bvh = new BVH(boundedShapes(), in);
+
+  if (!in.ok()) {
+    return fail(string(filename) + " is corrupt");
+  }
+  return true;
+}
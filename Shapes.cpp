@@ -1,9 +1,29 @@
 #include "Shapes.h"
 
+void Shape::intersectPacket(const RayPacket &packet, float *t) {
+  for (int i = 0; i < PACKET_SIZE; i++) {
+    t[i] = packet.active(i) ? (float)intersect(packet.rays[i]) : -1;
+  }
+}
+
+bool Shape::occludes(Ray3 r, double tMax) {
+  double t = intersect(r);
+  return t > 0 && t < tMax;
+}
+
+double Shape::intersectPrimitive(Ray3 r, int &primitive) {
+  primitive = -1;
+  return intersect(r);
+}
+
+// Shapes without texture coordinates leave them at 0, 0
+void Shape::surface(Hit &hit) { hit.normal = normal(hit.point); }
+
 Sphere::Sphere(Point3 centre, double radius, Material mat) {
   this->centre = centre;
   this->radius = radius;
   this->material = mat;
+  this->kind = STAT_SPHERE;
 }
 Vector3 Sphere::normal(Point3 p) { return unit(p - centre); }
 double Sphere::intersect(Ray3 r) {
@@ -26,11 +46,41 @@ double Sphere::intersect(Ray3 r) {
 
   return t;
 }
-Colour Sphere::getColour(Point3 position, Vector3 normal, Lighting *light,
-                         Vector3 inverseRay, bool isShadowed) {
-
-  double u = 0.0;
-  double v = 0.0;
+/*
+ * Same test as intersect, across every lane at once
+ */
+void Sphere::intersectPacket(const RayPacket &packet, float *t) {
+  float cx = (float)centre.getX();
+  float cy = (float)centre.getY();
+  float cz = (float)centre.getZ();
+  float r2 = (float)(radius * radius);
+
+  for (int i = 0; i < PACKET_SIZE; i++) {
+    float qx = cx - packet.ox[i];
+    float qy = cy - packet.oy[i];
+    float qz = cz - packet.oz[i];
+    float vDotQ = packet.dx[i] * qx + packet.dy[i] * qy + packet.dz[i] * qz;
+    float squareDiffs = qx * qx + qy * qy + qz * qz - r2;
+    float discrim = vDotQ * vDotQ - squareDiffs;
+
+    // Every lane takes the same path, missing lanes are masked at the end.
+    // The nearer root is vDotQ - root unless it's behind the ray's start,
+    // choosing the sign rather than the sum keeps the loop branch free
+    float root = sqrtf(max(discrim, 0.0f));
+    float hit = vDotQ + (vDotQ > root ? -root : root);
+    t[i] = ((discrim >= 0) & (hit > 0)) ? hit : -1;
+  }
+}
+BBox Sphere::bounds() {
+  return BBox(centre + Vector3(-radius), centre + Vector3(radius));
+}
+void Sphere::translate(Vector3 offset) { centre = centre + offset; }
+/*
+ * Texture coordinates are only worked out for textured spheres, once per
+ * hit rather than once per light
+ */
+void Sphere::surface(Hit &hit) {
+  hit.normal = normal(hit.point);
 
   if (this->material.isTex()) {
     // UV Calculation
@@ -43,7 +93,7 @@ Colour Sphere::getColour(Point3 position, Vector3 normal, Lighting *light,
     // unit vector pointing left (horizontal axis)
     Vector3 ve = Vector3(1, 0, 0);
     // unit vector from center to hit point (hit axis)
-    Vector3 vp = unit(position - this->getPoint());
+    Vector3 vp = unit(hit.point - this->getPoint());
 
     // Inverse cosine of dot(vn,vp) gives us the angle
     // between the vertical axis and the hit axis
@@ -51,25 +101,27 @@ Colour Sphere::getColour(Point3 position, Vector3 normal, Lighting *light,
     double phi = acos(-dot(vn, vp));
 
     // Vary v between zero and one (divide by half a circle)
-    v = phi / PI;
+    hit.v = phi / PI;
 
     // Find the longitude, using the latitude
     double theta = (acos(dot(vp, ve) / sin(phi)) / (2 * PI));
     if (dot(cross(vn, ve), vp) > 0) {
-      u = theta;
+      hit.u = theta;
     } else {
-      u = 1 - theta;
+      hit.u = 1 - theta;
     }
   }
 
-  return this->material.lit_colour(position, u, v, normal, light, inverseRay,
-                                   isShadowed);
+  // u wraps once around the circumference, v runs from pole to pole
+  hit.uSpan = 2 * PI * radius;
+  hit.vSpan = PI * radius;
 }
 
 Plane::Plane(Point3 point, Vector3 normal, Material mat) {
   this->point = point;
   this->norm = normal;
   this->material = mat;
+  this->kind = STAT_PLANE;
 }
 Vector3 Plane::normal(Point3 p) { return norm; }
 double Plane::intersect(Ray3 r) {
@@ -86,12 +138,31 @@ double Plane::intersect(Ray3 r) {
 
   return t;
 }
+void Plane::intersectPacket(const RayPacket &packet, float *t) {
+  float nx = (float)norm.getXDir();
+  float ny = (float)norm.getYDir();
+  float nz = (float)norm.getZDir();
+  float px = (float)point.getX();
+  float py = (float)point.getY();
+  float pz = (float)point.getZ();
+
+  for (int i = 0; i < PACKET_SIZE; i++) {
+    float top = (px - packet.ox[i]) * nx + (py - packet.oy[i]) * ny +
+                (pz - packet.oz[i]) * nz;
+    float bot = packet.dx[i] * nx + packet.dy[i] * ny + packet.dz[i] * nz;
+    // Divides in every lane, a ray parallel with the Plane gets an
+    // infinite or NaN distance which is masked out as a miss
+    float hit = top / bot;
+    t[i] = hit < numeric_limits<float>::infinity() ? hit : -1;
+  }
+}
 Point3 Plane::getPoint() { return point; }
-Colour Plane::getColour(Point3 position, Vector3 normal, Lighting *light,
-                        Vector3 inverseRay, bool isShadowed) {
+void Plane::translate(Vector3 offset) { point = point + offset; }
+void Plane::surface(Hit &hit) {
+  hit.normal = norm;
   // TODO: Allow for planes along arbitrary axis
-  return this->material.lit_colour(position, position.getX(), position.getZ(),
-                                   normal, light, inverseRay, isShadowed);
+  hit.u = hit.point.getX();
+  hit.v = hit.point.getZ();
 }
 
 Triangle::Triangle(Point3 p1, Point3 p2, Point3 p3, Material mat) {
@@ -100,6 +171,7 @@ Triangle::Triangle(Point3 p1, Point3 p2, Point3 p3, Material mat) {
   this->point3 = p3;
 
   this->material = mat;
+  this->kind = STAT_TRIANGLE;
 
   // Construct the norm for our plane
   Vector3 norm = cross((p3 - p2), (p1 - p2));
@@ -148,12 +220,57 @@ double Triangle::intersect(Ray3 r) {
 
   return -1;
 }
+/*
+ * Same barycentric test as intersect, across every lane at once
+ * The terms that only depend on the triangle are found once per packet
+ */
+void Triangle::intersectPacket(const RayPacket &packet, float *t) {
+  internalPlane.intersectPacket(packet, t);
+
+  Vector3 v0 = point2 - point1;
+  Vector3 v1 = point3 - point1;
+  float dot00 = (float)dot(v0, v0);
+  float dot01 = (float)dot(v0, v1);
+  float dot11 = (float)dot(v1, v1);
+  float invDenom = 1 / (dot00 * dot11 - dot01 * dot01);
+
+  float ax = (float)v0.getXDir(), ay = (float)v0.getYDir();
+  float az = (float)v0.getZDir();
+  float bx = (float)v1.getXDir(), by = (float)v1.getYDir();
+  float bz = (float)v1.getZDir();
+  float px = (float)point1.getX(), py = (float)point1.getY();
+  float pz = (float)point1.getZ();
+
+  for (int i = 0; i < PACKET_SIZE; i++) {
+    float hx = packet.ox[i] + packet.dx[i] * t[i] - px;
+    float hy = packet.oy[i] + packet.dy[i] * t[i] - py;
+    float hz = packet.oz[i] + packet.dz[i] * t[i] - pz;
+    float dot02 = ax * hx + ay * hy + az * hz;
+    float dot12 = bx * hx + by * hy + bz * hz;
+
+    float u = (dot11 * dot02 - dot01 * dot12) * invDenom;
+    float v = (dot00 * dot12 - dot01 * dot02) * invDenom;
+
+    // The edges are widened by TRIANGLE_EDGE_EPSILON so float rounding
+    // can't open a gap along an edge shared by two triangles
+    bool inside = (u > -TRIANGLE_EDGE_EPSILON) & (v > -TRIANGLE_EDGE_EPSILON) &
+                  ((u + v) < 1 + TRIANGLE_EDGE_EPSILON);
+    t[i] = ((t[i] > 0) & inside) ? t[i] : -1;
+  }
+}
 Point3 Triangle::getPoint() { return this->point1; }
-Colour Triangle::getColour(Point3 position, Vector3 normal, Lighting *light,
-                           Vector3 inverseRay, bool isShadowed) {
-  // TODO: Allow for textured triangles
-  return this->material.lit_colour(position, 0.0, 0.0, normal, light,
-                                   inverseRay, isShadowed);
+BBox Triangle::bounds() {
+  BBox box = BBox(point1, point2);
+  box.grow(point3);
+  // Axis aligned triangles are flat along one axis
+  box.pad(10e-9);
+  return box;
+}
+void Triangle::translate(Vector3 offset) {
+  point1 = point1 + offset;
+  point2 = point2 + offset;
+  point3 = point3 + offset;
+  internalPlane.translate(offset);
 }
 
 /*
@@ -162,6 +279,7 @@ Colour Triangle::getColour(Point3 position, Vector3 normal, Lighting *light,
 Square::Square(Point3 point1, Point3 point2, Vector3 direction, Material mat) {
 
   this->material = mat;
+  this->kind = STAT_SQUARE;
   this->minX = min(point1.getX(), point2.getX());
   this->maxX = max(point1.getX(), point2.getX());
   this->minY = min(point1.getY(), point2.getY());
@@ -199,17 +317,27 @@ double Square::intersect(Ray3 r) {
   return -1;
 }
 Point3 Square::getPoint() { return internalPlane.getPoint(); }
-Colour Square::getColour(Point3 position, Vector3 normal, Lighting *light,
-                         Vector3 inverseRay, bool isShadowed) {
-  // TODO: Allow for textured triangles
-  return this->material.lit_colour(position, 0.0, 0.0, normal, light,
-                                   inverseRay, isShadowed);
+BBox Square::bounds() {
+  BBox box = BBox(Point3(minX, minY, minZ), Point3(maxX, maxY, maxZ));
+  // Matches the epsilon used by intersect
+  box.pad(10e-9);
+  return box;
+}
+void Square::translate(Vector3 offset) {
+  minX += offset.getXDir();
+  maxX += offset.getXDir();
+  minY += offset.getYDir();
+  maxY += offset.getYDir();
+  minZ += offset.getZDir();
+  maxZ += offset.getZDir();
+  internalPlane.translate(offset);
 }
 
 Cube::Cube(Point3 p, double size, Material mat) {
   this->origin = p;
   this->width = size;
   this->material = mat;
+  this->kind = STAT_CUBE;
 
   double d = this->width;
 
@@ -240,35 +368,103 @@ Cube::Cube(Point3 p, double size, Material mat) {
   // dont forget worst case still occurs)
   random_shuffle(squares.begin(), squares.end());
 
-  lastHit = squares.front();
+  for (vector<Square *>::iterator it = squares.begin(); it != squares.end();
+       it++) {
+    box.grow((*it)->bounds());
+  }
+}
+/*
+ * The normal of the face the point lies on, found by the closest
+ * face plane rather than remembering the last hit, so intersect
+ * does not modify the cube and it can be shared between threads
+ */
+Vector3 Cube::normal(Point3 p) {
+  Square *face = squares.front();
+  double bestDistance = -1;
+  for (vector<Square *>::iterator it = squares.begin(); it != squares.end();
+       it++) {
+    Square *itShape = *it;
+    double distance =
+        fabs(dot(p - itShape->getPoint(), itShape->normal(p)));
+    if (bestDistance < 0 || distance < bestDistance) {
+      bestDistance = distance;
+      face = itShape;
+    }
+  }
+  return face->normal(p);
 }
-Vector3 Cube::normal(Point3 p) { return lastHit->normal(p); }
 /*
  * Checks each square for an intersection
  * Returns best hit or -1
  */
 double Cube::intersect(Ray3 r) {
+  int face;
+  return intersectPrimitive(r, face);
+}
+/*
+ * As intersect, with the index of the square hit
+ */
+double Cube::intersectPrimitive(Ray3 r, int &primitive) {
   double best = -1;
+  primitive = -1;
+
+  // Rays that miss the box can't hit a face
+  Point3 o = r.startP();
+  Vector3 d = r.directionV();
+  double origin[3] = {o.getX(), o.getY(), o.getZ()};
+  double invDir[3] = {1 / d.getXDir(), 1 / d.getYDir(), 1 / d.getZDir()};
+  if (box.intersect(origin, invDir, numeric_limits<double>::infinity()) < 0) {
+    return -1;
+  }
 
   // We can stop checking if we have intersected two polygons
   int hits = 0;
 
-  for (vector<Square *>::iterator it = squares.begin(); it != squares.end();
-       it++) {
+  for (int i = 0; i < (int)squares.size(); i++) {
     if (hits >= 2)
       break; // makes about 1 seconds difference
-    Square *itShape = *it;
-    double t = itShape->intersect(r);
+    double t = squares[i]->intersect(r);
+    countTest(STAT_SQUARE, t);
     if (t > 0) {
       if (best < 0 || (best > 0 && t < best)) {
         best = t;
-        lastHit = itShape;
+        primitive = i;
       }
       hits++;
     }
   }
   return best;
 }
+/*
+ * The normal of the square hit, rather than searching for the nearest
+ */
+void Cube::surface(Hit &hit) {
+  hit.normal = hit.primitive >= 0 ? squares[hit.primitive]->normal(hit.point)
+                                  : normal(hit.point);
+}
+/*
+ * Any face hit before tMax blocks the ray, so unlike intersect
+ * this stops at the first one
+ */
+bool Cube::occludes(Ray3 r, double tMax) {
+  Point3 o = r.startP();
+  Vector3 d = r.directionV();
+  double origin[3] = {o.getX(), o.getY(), o.getZ()};
+  double invDir[3] = {1 / d.getXDir(), 1 / d.getYDir(), 1 / d.getZDir()};
+  if (box.intersect(origin, invDir, tMax) < 0) {
+    return false;
+  }
+
+  for (vector<Square *>::iterator it = squares.begin(); it != squares.end();
+       it++) {
+    bool blocked = (*it)->occludes(r, tMax);
+    countTest(STAT_SQUARE, blocked ? 1.0 : -1.0);
+    if (blocked) {
+      return true;
+    }
+  }
+  return false;
+}
 /*
  * Removes (culls) any faces of the cube that are not visible
  * from the current position. Needs to be called during scene
@@ -289,40 +485,98 @@ void Cube::removeBackFaces(Point3 eyePoint) {
 
   this->squares = culledPolys;
 }
-Colour Cube::getColour(Point3 position, Vector3 normal, Lighting *light,
-                       Vector3 inverseRay, bool isShadowed) {
-  // TODO: Allow for textured triangles
-  return this->material.lit_colour(position, 0.0, 0.0, normal, light,
-                                   inverseRay, isShadowed);
+void Cube::translate(Vector3 offset) {
+  origin = origin + offset;
+  box = BBox(Point3(box.min[0], box.min[1], box.min[2]) + offset,
+             Point3(box.max[0], box.max[1], box.max[2]) + offset);
+  for (vector<Square *>::iterator it = squares.begin(); it != squares.end();
+       it++) {
+    (*it)->translate(offset);
+  }
 }
 
 Polyhedron::Polyhedron(vector<Triangle *> polygons, Material mat) {
 
   this->polys = polygons;
   this->material = mat;
+  this->kind = STAT_POLYHEDRON;
 
-  this->lastHit = polys.front();
+  buildFaces();
 }
-Vector3 Polyhedron::normal(Point3 p) { return lastHit->normal(p); }
 /*
- * Checks each triangle for intersection
+ * Builds the BVH over the current set of triangles
+ */
+void Polyhedron::buildFaces() {
+  vector<Shape *> shapes(polys.begin(), polys.end());
+  this->faces = new BVH(shapes);
+}
+/*
+ * Same as cube normal, the triangle whose plane is closest to the point
+ * Only triangles whose bounds contain the point are considered
+ */
+Vector3 Polyhedron::normal(Point3 p) {
+  vector<Shape *> candidates;
+  faces->query(p, candidates);
+
+  Shape *face = polys.front();
+  double bestDistance = -1;
+  for (vector<Shape *>::iterator it = candidates.begin();
+       it != candidates.end(); it++) {
+    Shape *tri = *it;
+    Vector3 n = unit(tri->normal(p));
+    double distance = fabs(dot(p - tri->getPoint(), n));
+    if (bestDistance < 0 || distance < bestDistance) {
+      bestDistance = distance;
+      face = tri;
+    }
+  }
+  return face->normal(p);
+}
+/*
+ * Finds the closest triangle through the BVH
  * returns best hit or -1
  */
 double Polyhedron::intersect(Ray3 r) {
-  double best = -1;
+  int face;
+  return intersectPrimitive(r, face);
+}
+/*
+ * As intersect, with the index of the triangle hit
+ */
+double Polyhedron::intersectPrimitive(Ray3 r, int &primitive) {
+  double t;
+  primitive = faces->closest(r, t, [this](int i, const Ray3 &ray) {
+    double hit = polys[i]->intersect(ray);
+    countTest(polys[i]->kind, hit);
+    return hit;
+  });
+  return t;
+}
+void Polyhedron::surface(Hit &hit) {
+  hit.normal = hit.primitive >= 0 ? polys[hit.primitive]->normal(hit.point)
+                                  : normal(hit.point);
+}
+/*
+ * Stops at the first triangle found before tMax
+ */
+bool Polyhedron::occludes(Ray3 r, double tMax) {
+  Shape *tri;
+  return faces->occluded(r, tMax, &tri);
+}
+/*
+ * Traces the packet through the triangle BVH together
+ */
+void Polyhedron::intersectPacket(const RayPacket &packet, float *t) {
+  RayPacket local = packet;
+  for (int i = 0; i < PACKET_SIZE; i++) {
+    local.shape[i] = NULL;
+  }
 
-  for (vector<Triangle *>::iterator it = polys.begin(); it != polys.end();
-       it++) {
-    Triangle *tri = *it;
-    double t = tri->intersect(r);
-    if (t > 0) {
-      if (best < 0 || (best > 0 && t < best)) {
-        best = t;
-        lastHit = tri;
-      }
-    }
+  faces->intersect(local);
+
+  for (int i = 0; i < PACKET_SIZE; i++) {
+    t[i] = local.shape[i] != NULL ? local.t[i] : -1;
   }
-  return best;
 }
 /*
  * Same as cube removeBackFaces
@@ -340,10 +594,232 @@ void Polyhedron::removeBackFaces(Point3 eyePoint) {
   }
 
   this->polys = culledPolys;
+
+  delete faces;
+  buildFaces();
 }
-Colour Polyhedron::getColour(Point3 position, Vector3 normal, Lighting *light,
-                             Vector3 inverseRay, bool isShadowed) {
-  // TODO: Allow for textured triangles
-  return this->material.lit_colour(position, 0.0, 0.0, normal, light,
-                                   inverseRay, isShadowed);
+/*
+ * The triangles move together, so their BVH only needs refitting
+ */
+void Polyhedron::translate(Vector3 offset) {
+  for (vector<Triangle *>::iterator it = polys.begin(); it != polys.end();
+       it++) {
+    (*it)->translate(offset);
+  }
+  faces->refit();
 }
+
+Mesh::Mesh(vector<Point3f> vertices, vector<int> indices, Material mat) {
+  this->vertices = move(vertices);
+  this->indices = move(indices);
+  this->material = mat;
+  this->kind = STAT_MESH;
+
+  int count = (int)this->indices.size() / 3;
+  triangles.resize(count);
+
+  vector<BBox> boxes(count);
+  for (int i = 0; i < count; i++) {
+    Point3f p1 = this->vertices[this->indices[3 * i]];
+    Point3f p2 = this->vertices[this->indices[3 * i + 1]];
+    Point3f p3 = this->vertices[this->indices[3 * i + 2]];
+
+    triangles[i].edge1 = p2 - p1;
+    triangles[i].edge2 = p3 - p1;
+    // Same winding as Triangle
+    triangles[i].norm = unit(cross(triangles[i].edge1, triangles[i].edge2));
+
+    boxes[i].grow(Point3(p1));
+    boxes[i].grow(Point3(p2));
+    boxes[i].grow(Point3(p3));
+    boxes[i].pad(10e-9);
+  }
+
+  tree = new BVH(boxes);
+}
+Mesh::Mesh(BinaryReader &in, Material mat) {
+  this->material = mat;
+  this->kind = STAT_MESH;
+
+  in.readArray(vertices);
+  in.readArray(indices);
+  in.readArray(triangles);
+
+  bool valid = in.ok() && indices.size() == 3 * triangles.size();
+  for (vector<int>::iterator it = indices.begin(); valid && it != indices.end();
+       it++) {
+    valid = *it >= 0 && *it < (int)vertices.size();
+  }
+  if (!valid) {
+    in.fail();
+    vertices.clear();
+    indices.clear();
+    triangles.clear();
+  }
+
+  tree = new BVH((int)triangles.size(), in);
+}
+void Mesh::write(BinaryWriter &out) {
+  out.writeArray(vertices);
+  out.writeArray(indices);
+  out.writeArray(triangles);
+  tree->write(out);
+}
+/*
+ * Moller-Trumbore ray triangle intersection
+ * Solves for the distance and barycentric coordinates together,
+ * using the edges stored when the mesh was built
+ */
+double Mesh::intersectTriangle(int triangle, const Ray3 &r) {
+  const MeshTriangle &tri = triangles[triangle];
+  Point3 p1 = Point3(vertices[indices[3 * triangle]]);
+  Vector3 edge1 = Vector3(tri.edge1);
+  Vector3 edge2 = Vector3(tri.edge2);
+  Vector3 d = r.directionV();
+
+  Vector3 pVec = cross(d, edge2);
+  double det = dot(edge1, pVec);
+
+  // Ray is parallel with the triangle
+  if (fabs(det) < 1e-12) {
+    return -1;
+  }
+  double invDet = 1 / det;
+
+  Vector3 tVec = r.startP() - p1;
+  double u = dot(tVec, pVec) * invDet;
+  if (u < 0 || u > 1) {
+    return -1;
+  }
+
+  Vector3 qVec = cross(tVec, edge1);
+  double v = dot(d, qVec) * invDet;
+  if (v < 0 || u + v > 1) {
+    return -1;
+  }
+
+  return dot(edge2, qVec) * invDet;
+}
+/*
+ * The normal of the triangle whose plane is closest to the point,
+ * considering only triangles whose bounds contain it
+ */
+Vector3 Mesh::normal(Point3 p) {
+  int best = 0;
+  double bestDistance = -1;
+  tree->query(p, [&](int i) {
+    Point3 p1 = Point3(vertices[indices[3 * i]]);
+    double distance = fabs(dot(p - p1, Vector3(triangles[i].norm)));
+    if (bestDistance < 0 || distance < bestDistance) {
+      bestDistance = distance;
+      best = i;
+    }
+  });
+
+  return Vector3(triangles[best].norm);
+}
+double Mesh::intersect(Ray3 r) {
+  int triangle;
+  return intersectPrimitive(r, triangle);
+}
+double Mesh::intersectPrimitive(Ray3 r, int &primitive) {
+  double t;
+  primitive = tree->closest(r, t, [this](int i, const Ray3 &ray) {
+    // Counted with the triangles of other shapes
+    double hit = intersectTriangle(i, ray);
+    countTest(STAT_TRIANGLE, hit);
+    return hit;
+  });
+  return t;
+}
+void Mesh::surface(Hit &hit) {
+  hit.normal = hit.primitive >= 0 ? Vector3(triangles[hit.primitive].norm)
+                                  : normal(hit.point);
+}
+bool Mesh::occludes(Ray3 r, double tMax) {
+  return tree->any(r, tMax, [this, tMax](int i, const Ray3 &ray) {
+    double hit = intersectTriangle(i, ray);
+    countTest(STAT_TRIANGLE, hit);
+    return hit > 0 && hit < tMax;
+  }) >= 0;
+}
+Point3 Mesh::getPoint() {
+  return Point3(vertices.front());
+}
+/*
+ * Edges and normals don't change when the whole mesh moves, only the
+ * vertices and the boxes its BVH is refit with
+ */
+void Mesh::translate(Vector3 offset) {
+  Vector3f shift = Vector3f(offset);
+  for (vector<Point3f>::iterator it = vertices.begin(); it != vertices.end();
+       it++) {
+    *it = *it + shift;
+  }
+
+  int count = (int)triangles.size();
+  vector<BBox> boxes(count);
+  for (int i = 0; i < count; i++) {
+    for (int k = 0; k < 3; k++) {
+      boxes[i].grow(Point3(vertices[indices[3 * i + k]]));
+    }
+    boxes[i].pad(10e-9);
+  }
+  tree->refit(boxes);
+}
+
+Instance::Instance(Shape *object, Transform transform) {
+  this->object = object;
+  this->transform = transform;
+  this->material = object->getMaterial();
+  // Counted as the shape it places
+  this->kind = object->kind;
+}
+Vector3 Instance::normal(Point3 p) {
+  return transform.rotate(object->normal(transform.toObject(p)));
+}
+double Instance::intersect(Ray3 r) {
+  int primitive;
+  return intersectPrimitive(r, primitive);
+}
+double Instance::intersectPrimitive(Ray3 r, int &primitive) {
+  double t = object->intersectPrimitive(transform.toObject(r), primitive);
+  return t > 0 ? t * transform.scale : -1;
+}
+/*
+ * The object's surface at the hit, moved back into the world
+ */
+void Instance::surface(Hit &hit) {
+  Hit local = hit;
+  local.point = transform.toObject(hit.point);
+  object->surface(local);
+  hit.normal = transform.rotate(local.normal);
+  hit.u = local.u;
+  hit.v = local.v;
+  hit.uSpan = local.uSpan * transform.scale;
+  hit.vSpan = local.vSpan * transform.scale;
+}
+bool Instance::occludes(Ray3 r, double tMax) {
+  return object->occludes(transform.toObject(r), tMax / transform.scale);
+}
+Point3 Instance::getPoint() {
+  return transform.toWorld(object->getPoint());
+}
+/*
+ * Box around the corners of the object's box, once placed
+ */
+BBox Instance::bounds() {
+  BBox objectBox = object->bounds();
+  BBox box;
+  for (int corner = 0; corner < 8; corner++) {
+    box.grow(transform.toWorld(
+        Point3(corner & 1 ? objectBox.max[0] : objectBox.min[0],
+               corner & 2 ? objectBox.max[1] : objectBox.min[1],
+               corner & 4 ? objectBox.max[2] : objectBox.min[2])));
+  }
+  return box;
+}
+void Instance::translate(Vector3 offset) {
+  transform.position = transform.position + offset;
+}
+
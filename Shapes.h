@@ -1,11 +1,37 @@
 #pragma once
 
+#include "BBox.h"
+#include "BVH.h"
 #include "GeomX.h"
 #include "Illumination.h"
+#include "RayPacket.h"
+#include "Stats.h"
+#include "Transform.h"
 #include "pi.h"
 #include <list>
 #include <vector>
 
+class Shape;
+
+/*
+ * Hit
+ * Where a ray meets a shape. Found once at the closest hit, then used
+ * for every light's shading and the reflection, so shapes never keep
+ * state between the intersection and shading.
+ */
+struct Hit {
+  double t;      // Distance along the ray, -1 if nothing was hit
+  Shape *shape;  // Shape hit, which holds the material
+  int primitive; // Face or triangle hit in a shape made of parts, or -1
+  Point3 point;
+  Vector3 normal;
+  double u, v;         // Texture coordinates
+  double uSpan, vSpan; // Width of surface one unit of u, and of v, covers
+
+  Hit()
+      : t(-1), shape(NULL), primitive(-1), u(0), v(0), uSpan(1), vSpan(1) {}
+};
+
 /*
  * Abstract class shape
  * Defines that all shapes have a material, return a normal at a point,
@@ -16,17 +42,82 @@ protected:
   Material material;
 
 public:
-  Material getMaterial() { return material; }
+  StatShape kind; // Type of shape, for render statistics
+
+  Material &getMaterial() { return material; }
   virtual Vector3 normal(Point3 p) = 0;
   /*
    * MUST check that result is postive.
    */
   virtual double intersect(Ray3 r) = 0;
 
+  /*
+   * As intersect, also setting primitive to the part of the shape hit,
+   * for shapes made of parts, or -1
+   */
+  virtual double intersectPrimitive(Ray3 r, int &primitive);
+
+  /*
+   * Fills in the normal and texture coordinates of a hit on this shape,
+   * given its point and primitive. Texture coordinates are left as they
+   * are by shapes without them
+   */
+  virtual void surface(Hit &hit);
+
+  // Completes hit for the ray meeting this shape at hit.t
+  void completeHit(const Ray3 &r, Hit &hit) {
+    hit.shape = this;
+    hit.point = r.pos(hit.t);
+    surface(hit);
+  }
+
+  /*
+   * Intersects every lane of a packet, writing each lane's distance
+   * (or -1) into t. Shapes without a packet version test lane by lane.
+   */
+  virtual void intersectPacket(const RayPacket &packet, float *t);
+
+  /*
+   * Returns true if the shape blocks the ray before tMax, for shadow rays
+   * Shapes made of parts override it to stop at the first part hit
+   */
+  virtual bool occludes(Ray3 r, double tMax);
+
   virtual Point3 getPoint() = 0;
 
-  virtual Colour getColour(Point3 position, Vector3 normal, Lighting *light,
-                           Vector3 inverseRay, bool isShadowed) = 0;
+  // Colour of the hit lit by one light. footprint is the width of the
+  // area one sample covers at the hit, used to filter textures
+  Colour getColour(const Hit &hit, Lighting *light, Vector3 inverseRay,
+                   bool isShadowed, double footprint) {
+    return material.lit_colour(hit.point, hit.u, hit.v, hit.normal, light,
+                               inverseRay, isShadowed,
+                               footprint / hit.uSpan,
+                               footprint / hit.vSpan);
+  }
+
+  // Colour of the hit lit by levels summed over its lights, see
+  // Material::shaded_colour
+  Colour getShaded(const Hit &hit, double ambient, double diffuse,
+                   double specular, double footprint) {
+    return material.shaded_colour(hit.u, hit.v, ambient, diffuse, specular,
+                                  footprint / hit.uSpan,
+                                  footprint / hit.vSpan);
+  }
+
+  /*
+   * Box enclosing the shape, used to build the BVH
+   * Only meaningful if bounded() is true
+   */
+  virtual BBox bounds() = 0;
+  virtual bool bounded() { return true; }
+
+  /*
+   * Moves the shape by offset, for animation
+   * Any BVH holding the shape must be refit afterwards
+   */
+  virtual void translate(Vector3 offset) = 0;
+
+  virtual ~Shape() {}
 };
 
 /*
@@ -40,13 +131,16 @@ public:
   Sphere(Point3 centre, double radius, Material mat);
   Vector3 normal(Point3 p);
   double intersect(Ray3 r);
+  void intersectPacket(const RayPacket &packet, float *t);
+  void surface(Hit &hit);
   Point3 getPoint() { return centre; }
-  Colour getColour(Point3 position, Vector3 normal, Lighting *light,
-                   Vector3 inverseRay, bool isShadowed);
+  BBox bounds();
+  void translate(Vector3 offset);
 };
 
 /*
  * Plane
+ * Planes are infinite, so are kept out of the BVH
  */
 class Plane : public Shape {
 
@@ -58,9 +152,12 @@ public:
   Plane(Point3 point, Vector3 normal, Material mat);
   Vector3 normal(Point3 p);
   double intersect(Ray3 r);
+  void intersectPacket(const RayPacket &packet, float *t);
+  void surface(Hit &hit);
   Point3 getPoint();
-  Colour getColour(Point3 position, Vector3 normal, Lighting *light,
-                   Vector3 inverseRay, bool isShadowed);
+  BBox bounds() { return BBox(); }
+  bool bounded() { return false; }
+  void translate(Vector3 offset);
 };
 
 /*
@@ -78,9 +175,10 @@ public:
   Triangle(Point3 p1, Point3 p2, Point3 p3, Material mat);
   Vector3 normal(Point3 p);
   double intersect(Ray3 r);
+  void intersectPacket(const RayPacket &packet, float *t);
   Point3 getPoint();
-  Colour getColour(Point3 position, Vector3 normal, Lighting *light,
-                   Vector3 inverseRay, bool isShadowed);
+  BBox bounds();
+  void translate(Vector3 offset);
 };
 
 /*
@@ -98,46 +196,122 @@ public:
   Vector3 normal(Point3 p);
   double intersect(Ray3 r);
   Point3 getPoint();
-  Colour getColour(Point3 position, Vector3 normal, Lighting *light,
-                   Vector3 inverseRay, bool isShadowed);
+  BBox bounds();
+  void translate(Vector3 offset);
 };
 
 /*
  * Cubes are made of 6 squares
- * Intersections require each square to be tested
+ * Rays that miss the cube's box are rejected before any square is tested
  * Complexity can be reduced with removeBackFaces
  */
 class Cube : public Shape {
   Point3 origin;
   double width;
   vector<Square *> squares;
-  Square *lastHit;
+  BBox box;
 
 public:
   Cube(Point3 p, double size, Material mat);
   Vector3 normal(Point3 p);
   double intersect(Ray3 r);
+  double intersectPrimitive(Ray3 r, int &primitive);
+  void surface(Hit &hit);
+  bool occludes(Ray3 r, double tMax);
   void removeBackFaces(Point3 eyePoint);
   Point3 getPoint() { return origin; }
-  Colour getColour(Point3 position, Vector3 normal, Lighting *light,
-                   Vector3 inverseRay, bool isShadowed);
+  BBox bounds() { return box; }
+  void translate(Vector3 offset);
 };
 
 /*
  * A Polyhedron is a collection of triangles
+ * The triangles are kept in their own BVH, so large polyhedra
+ * don't test every triangle
  * Complexity can be reduced with removeBackFaces
- * This is very similar to Cube's implementation
 */
 class Polyhedron : public Shape {
   vector<Triangle *> polys;
-  Triangle *lastHit;
+  BVH *faces;
+
+  void buildFaces();
 
 public:
   Polyhedron(vector<Triangle *> polygons, Material mat);
   Vector3 normal(Point3 p);
   double intersect(Ray3 r);
+  double intersectPrimitive(Ray3 r, int &primitive);
+  void surface(Hit &hit);
+  void intersectPacket(const RayPacket &packet, float *t);
+  bool occludes(Ray3 r, double tMax);
   void removeBackFaces(Point3 eyePoint);
   Point3 getPoint() { return Point3(0, 0, 0); }
-  Colour getColour(Point3 position, Vector3 normal, Lighting *light,
-                   Vector3 inverseRay, bool isShadowed);
+  BBox bounds() { return faces->bounds(); }
+  void translate(Vector3 offset);
+  ~Polyhedron() { delete faces; }
+};
+
+/*
+ * Mesh
+ * An indexed triangle mesh. Vertices are stored once and shared between
+ * triangles, each triangle keeps only the edges and normal needed by a
+ * Moller-Trumbore intersection, and the whole mesh has one material.
+ */
+class Mesh : public Shape {
+
+  // Precomputed intersection data for one triangle
+  struct MeshTriangle {
+    Vector3f edge1; // Second vertex minus first
+    Vector3f edge2; // Third vertex minus first
+    Vector3f norm;  // Unit normal
+  };
+
+  vector<Point3f> vertices;
+  vector<int> indices; // Three vertices per triangle
+  vector<MeshTriangle> triangles;
+  BVH *tree;
+
+  double intersectTriangle(int triangle, const Ray3 &r);
+
+public:
+  // Takes the vertex and index arrays, which are moved rather than copied
+  Mesh(vector<Point3f> vertices, vector<int> indices, Material mat);
+  // Restores a mesh saved by write, without rebuilding its BVH
+  Mesh(BinaryReader &in, Material mat);
+  void write(BinaryWriter &out);
+  Vector3 normal(Point3 p);
+  double intersect(Ray3 r);
+  double intersectPrimitive(Ray3 r, int &primitive);
+  void surface(Hit &hit);
+  bool occludes(Ray3 r, double tMax);
+  Point3 getPoint();
+  BBox bounds() { return tree->bounds(); }
+  void translate(Vector3 offset);
+  int triangleCount() { return (int)triangles.size(); }
+  ~Mesh() { delete tree; }
+};
+
+/*
+ * Instance
+ * Places shared geometry, such as a Polyhedron or Mesh, somewhere in the
+ * scene. Rays are moved into the geometry's object space and traced
+ * through its own BVH, below the scene's BVH over every instance, so a
+ * repeated object is stored once however often it is placed.
+ * The geometry isn't owned by the instance, and is shaded with its
+ * normal and texture coordinates moved back into the world.
+ */
+class Instance : public Shape {
+  Shape *object;
+  Transform transform;
+
+public:
+  Instance(Shape *object, Transform transform);
+  Vector3 normal(Point3 p);
+  double intersect(Ray3 r);
+  double intersectPrimitive(Ray3 r, int &primitive);
+  void surface(Hit &hit);
+  bool occludes(Ray3 r, double tMax);
+  Point3 getPoint();
+  BBox bounds();
+  void translate(Vector3 offset);
 };
@@ -0,0 +1,180 @@
+#include "Stats.h"
+
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+thread_local StatCounters threadStats;
+
+static const char *SHAPE_NAMES[STAT_SHAPES] = {
+    "Sphere", "Plane", "Triangle", "Square", "Cube", "Polyhedron", "Mesh"};
+
+static mutex statsLock;
+static StatCounters statsTotals;
+static vector<pair<string, double> > statsPhases;
+
+void StatCounters::add(const StatCounters &other) {
+  primaryRays += other.primaryRays;
+  reflectionRays += other.reflectionRays;
+  refractionRays += other.refractionRays;
+  lightsCulled += other.lightsCulled;
+  lightsUnsampled += other.lightsUnsampled;
+  softShadows += other.softShadows;
+  penumbras += other.penumbras;
+  rouletteEnds += other.rouletteEnds;
+  budgetEnds += other.budgetEnds;
+  shadowRays += other.shadowRays;
+  occluderCacheHits += other.occluderCacheHits;
+  for (int i = 0; i < STAT_SHAPES; i++) {
+    tests[i] += other.tests[i];
+    hits[i] += other.hits[i];
+  }
+  for (int i = 0; i <= STATS_MAX_DEPTH; i++) {
+    depths[i] += other.depths[i];
+  }
+  for (int i = 0; i < STATS_MAX_LIGHTS; i++) {
+    shading[i] += other.shading[i];
+  }
+}
+
+void Stats::flush() {
+  lock_guard<mutex> guard(statsLock);
+  statsTotals.add(threadStats);
+  memset(&threadStats, 0, sizeof(threadStats));
+}
+
+void Stats::addPhase(const string &phase, double seconds) {
+  lock_guard<mutex> guard(statsLock);
+  for (size_t i = 0; i < statsPhases.size(); i++) {
+    if (statsPhases[i].first == phase) {
+      statsPhases[i].second += seconds;
+      return;
+    }
+  }
+  statsPhases.push_back(make_pair(phase, seconds));
+}
+
+double Stats::phaseTime(const string &phase) {
+  lock_guard<mutex> guard(statsLock);
+  for (size_t i = 0; i < statsPhases.size(); i++) {
+    if (statsPhases[i].first == phase) {
+      return statsPhases[i].second;
+    }
+  }
+  return 0;
+}
+
+StatCounters Stats::totals() {
+  flush();
+  lock_guard<mutex> guard(statsLock);
+  return statsTotals;
+}
+
+vector<pair<string, double> > Stats::phases() {
+  lock_guard<mutex> guard(statsLock);
+  return statsPhases;
+}
+
+void Stats::print(ostream &out, int recursionDepth, int lightCount) {
+  StatCounters counts = totals();
+  recursionDepth = min(recursionDepth, STATS_MAX_DEPTH);
+  lightCount = min(lightCount, STATS_MAX_LIGHTS);
+
+  out << "Rays: " << counts.primaryRays << " primary, "
+      << counts.reflectionRays << " reflection, " << counts.refractionRays
+      << " refraction, " << counts.shadowRays
+      << " shadow (" << counts.occluderCacheHits
+      << " blocked by the last occluder)" << endl;
+
+  for (int i = 0; i < STAT_SHAPES; i++) {
+    if (counts.tests[i] > 0) {
+      out << "  " << SHAPE_NAMES[i] << ": " << counts.tests[i] << " tests, "
+          << counts.hits[i] << " hits" << endl;
+    }
+  }
+
+  out << "Branches ended by roulette: " << counts.rouletteEnds
+      << ", by the ray budget: " << counts.budgetEnds << endl;
+
+  out << "Depth reached (of " << recursionDepth << "):";
+  for (int i = 0; i <= recursionDepth; i++) {
+    out << " " << counts.depths[i];
+  }
+  out << endl;
+
+  out << "Lights skipped at hits: " << counts.lightsCulled
+      << " out of reach, " << counts.lightsUnsampled << " not sampled"
+      << endl;
+
+  out << "Soft shadows: " << counts.softShadows << " tests, "
+      << counts.penumbras << " in penumbra" << endl;
+
+  out << "Shading calls per light:";
+  for (int i = 0; i < lightCount; i++) {
+    out << " " << counts.shading[i];
+  }
+  out << endl;
+
+  vector<pair<string, double> > times = phases();
+  for (size_t i = 0; i < times.size(); i++) {
+    out << "  " << times[i].first << ": " << times[i].second * 1000 << " ms"
+        << endl;
+  }
+}
+
+bool Stats::writeJSON(const char *filename, int recursionDepth,
+                      int lightCount) {
+  StatCounters counts = totals();
+  recursionDepth = min(recursionDepth, STATS_MAX_DEPTH);
+  lightCount = min(lightCount, STATS_MAX_LIGHTS);
+
+  ofstream out(filename);
+  if (!out) {
+    return false;
+  }
+
+  out << "{\n  \"rays\": {\"primary\": " << counts.primaryRays
+      << ", \"reflection\": " << counts.reflectionRays
+      << ", \"refraction\": " << counts.refractionRays
+      << ", \"shadow\": " << counts.shadowRays
+      << ", \"occluderCacheHits\": " << counts.occluderCacheHits << "},\n";
+
+  out << "  \"shapes\": {";
+  for (int i = 0; i < STAT_SHAPES; i++) {
+    out << (i > 0 ? ", " : "") << "\"" << SHAPE_NAMES[i]
+        << "\": {\"tests\": " << counts.tests[i]
+        << ", \"hits\": " << counts.hits[i] << "}";
+  }
+  out << "},\n";
+
+  out << "  \"ended\": {\"roulette\": " << counts.rouletteEnds
+      << ", \"budget\": " << counts.budgetEnds << "},\n";
+
+  out << "  \"depth\": [";
+  for (int i = 0; i <= recursionDepth; i++) {
+    out << (i > 0 ? ", " : "") << counts.depths[i];
+  }
+  out << "],\n";
+
+  out << "  \"lightsSkipped\": {\"culled\": " << counts.lightsCulled
+      << ", \"unsampled\": " << counts.lightsUnsampled << "},\n";
+
+  out << "  \"softShadows\": {\"tests\": " << counts.softShadows
+      << ", \"penumbras\": " << counts.penumbras << "},\n";
+
+  out << "  \"shading\": [";
+  for (int i = 0; i < lightCount; i++) {
+    out << (i > 0 ? ", " : "") << counts.shading[i];
+  }
+  out << "],\n";
+
+  vector<pair<string, double> > times = phases();
+  out << "  \"phases\": {";
+  for (size_t i = 0; i < times.size(); i++) {
+    out << (i > 0 ? ", " : "") << "\"" << times[i].first
+        << "\": " << times[i].second;
+  }
+  out << "}\n}\n";
+
+  return (bool)out;
+}
@@ -0,0 +1,98 @@
+/*
+ * Stats.h
+ * Render statistics: ray counts, intersection tests per shape type,
+ * ray tree depth, shading calls per light and time spent per phase.
+ *
+ * Each thread counts into its own plain counters, so counting is an
+ * increment with no locking or shared cache lines. Threads flush their
+ * counters into the totals once they finish a piece of work.
+ */
+
+#pragma once
+
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+enum StatShape {
+  STAT_SPHERE,
+  STAT_PLANE,
+  STAT_TRIANGLE,
+  STAT_SQUARE,
+  STAT_CUBE,
+  STAT_POLYHEDRON,
+  STAT_MESH,
+  STAT_SHAPES // Number of shape types
+};
+
+// Depths and lights past these are counted in the last bucket
+#define STATS_MAX_DEPTH 64
+#define STATS_MAX_LIGHTS 32
+
+struct StatCounters {
+  uint64_t primaryRays;
+  uint64_t reflectionRays;
+  uint64_t refractionRays;
+  uint64_t shadowRays;
+  uint64_t occluderCacheHits; // Shadow rays blocked by the last occluder
+  uint64_t tests[STAT_SHAPES];
+  uint64_t hits[STAT_SHAPES];
+  uint64_t lightsCulled;    // Lights skipped at hits they can't reach
+  uint64_t lightsUnsampled; // and left out by light sampling
+  uint64_t softShadows;  // Area light shadow tests
+  uint64_t penumbras;    // of which the probes disagreed
+  uint64_t rouletteEnds; // Branches of ray trees ended by roulette
+  uint64_t budgetEnds;   // and by running out of their ray budget
+  uint64_t depths[STATS_MAX_DEPTH + 1]; // Surfaces hit down each branch
+  uint64_t shading[STATS_MAX_LIGHTS];   // Shading calls for each light
+
+  void add(const StatCounters &other);
+};
+
+// The calling thread's counters, zero initialised plain data so using
+// them costs no more than a global
+extern thread_local StatCounters threadStats;
+
+inline void countTest(StatShape shape, double t) {
+  threadStats.tests[shape]++;
+  if (t > 0) {
+    threadStats.hits[shape]++;
+  }
+}
+
+inline void countDepth(int depth) {
+  threadStats.depths[depth < STATS_MAX_DEPTH ? depth : STATS_MAX_DEPTH]++;
+}
+
+inline void countShading(int light) {
+  threadStats.shading[light < STATS_MAX_LIGHTS ? light
+                                                : STATS_MAX_LIGHTS - 1]++;
+}
+
+class Stats {
+public:
+  // Adds the calling thread's counters to the totals and clears them
+  static void flush();
+
+  // Adds wall clock time to a phase, phases are reported in the order
+  // they are first timed
+  static void addPhase(const string &phase, double seconds);
+
+  // Wall clock time added to a phase so far, 0 if it hasn't been timed
+  static double phaseTime(const string &phase);
+
+  static StatCounters totals();
+  static vector<pair<string, double> > phases();
+
+  // Prints a summary, with depths up to recursionDepth and lights up to
+  // lightCount
+  static void print(ostream &out, int recursionDepth, int lightCount);
+
+  // Writes the same figures as JSON, returns false if it can't be written
+  static bool writeJSON(const char *filename, int recursionDepth,
+                        int lightCount);
+};
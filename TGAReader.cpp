@@ -4,46 +4,100 @@
 
 #include "TGAReader.h"
 
-bool loadTGA(const char *filename, STGA &tgaFile) {
-  FILE *file;
-  unsigned char type[4];
-  unsigned char info[6];
+#include <cstring>
 
-  file = fopen(filename, "rb");
+#define TGA_HEADER_SIZE 18
 
-  if (!file)
-    return false;
+#define TGA_UNCOMPRESSED 2
+#define TGA_RLE 10
 
-  fread(&type, sizeof(char), 3, file);
-  fseek(file, 12, SEEK_SET);
-  fread(&info, sizeof(char), 6, file);
+/*
+ * Expands RLE packets into texels
+ * Each packet starts with a byte holding its length - 1, with the top bit
+ * set for a run of one repeated texel or clear for that many raw texels
+ */
+static bool decodeRLE(const unsigned char *in, const unsigned char *end,
+                      unsigned char *out, size_t texels, int byteCount) {
+  size_t done = 0;
 
-  // image type either 2 (color) or 3 (greyscale)
-  if (type[1] != 0 || (type[2] != 2 && type[2] != 3)) {
-    fclose(file);
-    return false;
+  while (done < texels) {
+    if (in >= end) {
+      return false;
+    }
+    unsigned char header = *in++;
+    size_t count = (header & 0x7f) + 1;
+    if (count > texels - done) {
+      return false;
+    }
+
+    if (header & 0x80) {
+      // Run packet, one texel repeated
+      if (end - in < byteCount) {
+        return false;
+      }
+      for (size_t i = 0; i < count; i++) {
+        memcpy(out, in, byteCount);
+        out += byteCount;
+      }
+      in += byteCount;
+    } else {
+      // Raw packet, copied as is
+      size_t bytes = count * byteCount;
+      if ((size_t)(end - in) < bytes) {
+        return false;
+      }
+      memcpy(out, in, bytes);
+      out += bytes;
+      in += bytes;
+    }
+    done += count;
   }
 
-  tgaFile.width = info[0] + info[1] * 256;
-  tgaFile.height = info[2] + info[3] * 256;
-  tgaFile.byteCount = info[4] / 8;
+  return true;
+}
 
-  if (tgaFile.byteCount != 3 && tgaFile.byteCount != 4) {
-    fclose(file);
+bool readTGA(const char *file, size_t size, STGA &tgaFile,
+             vector<unsigned char> &decoded) {
+  const unsigned char *bytes = (const unsigned char *)file;
+
+  if (size < TGA_HEADER_SIZE) {
+    return false;
+  }
+
+  // Colour mapped images are not supported
+  unsigned char idLength = bytes[0];
+  unsigned char type = bytes[2];
+  if (bytes[1] != 0 || (type != TGA_UNCOMPRESSED && type != TGA_RLE)) {
     return false;
   }
 
-  long imageSize =
-      tgaFile.width * tgaFile.height * tgaFile.width * tgaFile.byteCount;
+  tgaFile.width = bytes[12] + bytes[13] * 256;
+  tgaFile.height = bytes[14] + bytes[15] * 256;
+  tgaFile.byteCount = bytes[16] / 8;
 
-  // allocate memory for image data
-  tgaFile.data = new unsigned char[imageSize];
+  if (tgaFile.byteCount != 3 && tgaFile.byteCount != 4) {
+    return false;
+  }
 
-  // read in image data
-  fread(tgaFile.data, sizeof(unsigned char), imageSize, file);
+  size_t offset = TGA_HEADER_SIZE + idLength;
+  if (offset > size) {
+    return false;
+  }
 
-  // close file
-  fclose(file);
+  if (type == TGA_UNCOMPRESSED) {
+    if (size - offset < tgaFile.size()) {
+      return false;
+    }
+    tgaFile.data = bytes + offset;
+    return true;
+  }
 
+  decoded.resize(tgaFile.size());
+  if (!decodeRLE(bytes + offset, bytes + size, decoded.data(),
+                 (size_t)tgaFile.width * tgaFile.height, tgaFile.byteCount)) {
+    decoded.clear();
+    return false;
+  }
+  tgaFile.data = decoded.data();
   return true;
 }
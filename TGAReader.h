@@ -1,11 +1,22 @@
 // Taken from
 // http://steinsoft.net/index.php?site=Programming/Code%20Snippets/Cpp/no8
 // Reads TGA files
+//
+// Files are read in place from memory, usually a mapped file. Texels of
+// uncompressed files are used straight from that memory, run length
+// encoded files are decoded once into a buffer of their own.
 
 #pragma once
 
-#include <stdio.h>
+#include <stddef.h>
+#include <vector>
 
+using namespace std;
+
+/*
+ * A decoded TGA image, texels are stored in BGR(A) order
+ * STGA never owns its texels, they belong to whatever holds the file
+ */
 struct STGA {
   STGA() {
     data = (unsigned char *)0;
@@ -14,18 +25,20 @@ struct STGA {
     byteCount = 0;
   }
 
-  // Had to disable delete as we were losing reference
-  // after reading one texel
-  ~STGA() { // delete[] data; data = 0;
-  }
-
-  void destroy() { // delete[] data; data = 0;
-  }
+  // Bytes of texel data
+  size_t size() const { return (size_t)width * height * byteCount; }
 
   int width;
   int height;
   unsigned char byteCount;
-  unsigned char *data;
+  const unsigned char *data;
 };
 
-bool loadTGA(const char *filename, STGA &tgaFile);
+/*
+ * Reads a 24 or 32 bit TGA file held in memory, either uncompressed
+ * (type 2) or run length encoded (type 10)
+ * Uncompressed texels are left in place, RLE texels are decoded into
+ * decoded. Returns false if the file is not a supported TGA.
+ */
+bool readTGA(const char *file, size_t size, STGA &tgaFile,
+             vector<unsigned char> &decoded);
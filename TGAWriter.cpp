@@ -5,64 +5,189 @@
 //	Lewis Christie
 
 #include "TGAWriter.h"
+#include "TileScheduler.h"
 
-TGAWriter::TGAWriter(int nWidth, int nHeight) {
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+TGAWriter::TGAWriter(int nWidth, int nHeight, int tileSize, int shard,
+                     int shards) {
 
   width = nWidth;
   height = nHeight;
-  data = new float[width * height * 3];
+  this->tileSize = max(tileSize, 1);
+  this->shard = shard;
+  this->shards = max(shards, 1);
+  tilesAcross = (width + this->tileSize - 1) / this->tileSize;
+
+  if (this->shards == 1) {
+    slots = (size_t)width * height;
+    held = slots;
+  } else {
+    vector<Tile> tiles =
+        TileScheduler::split(width, height, tileSize, shard, shards);
+    slots = tiles.size() * this->tileSize * this->tileSize;
+    held = 0;
+    for (size_t i = 0; i < tiles.size(); i++) {
+      held += (size_t)(tiles[i].x1 - tiles[i].x0) * (tiles[i].y1 - tiles[i].y0);
+    }
+  }
+
+  data = new float[slots * 3];
   currentPixel = 0;
+  pixelCount = 0;
+  toneMapping = TONE_CLAMP;
+  exposure = 1.0f;
+  stored = new atomic<bool>[slots];
+  for (size_t i = 0; i < slots; i++) {
+    stored[i] = false;
+  }
 }
 
-void TGAWriter::putNextPixel(float red, float green, float blue) {
+void TGAWriter::markStored(size_t slot) {
+  // Release, so a preview that sees the flag also sees the pixel.
+  // Refined pixels are stored twice but only counted once
+  if (!stored[slot].exchange(true, memory_order_acq_rel)) {
+    pixelCount++;
+  }
+}
 
-  data[currentPixel] = blue;
-  data[currentPixel + 1] = green;
-  data[currentPixel + 2] = red;
-  currentPixel += 3;
+// Stores pixels in scanline order, bottom row first
+void TGAWriter::putNextPixel(float red, float green, float blue) {
+  putPixel((int)(currentPixel % width), (int)(currentPixel / width),
+           Colour(red, green, blue));
+  currentPixel++;
 }
 
 void TGAWriter::putNextPixel(Colour c) {
   putNextPixel((float)c.red(), (float)c.green(), (float)c.blue());
 }
 
-bool TGAWriter::writeImage() {
-  if (currentPixel < width * height * 3) {
-    return false;
-  }
+void TGAWriter::putPixel(int x, int y, Colour c) {
+  size_t pixel = slot(x, y);
+  size_t index = 3 * pixel;
 
-  string fileName = "output.tga";
+  data[index] = (float)c.blue();
+  data[index + 1] = (float)c.green();
+  data[index + 2] = (float)c.red();
+  markStored(pixel);
+}
 
-  ofstream imageFile(fileName.c_str(), ios_base::binary);
+Colour TGAWriter::getPixel(int x, int y) {
+  size_t index = 3 * slot(x, y);
+  return Colour(data[index + 2], data[index + 1], data[index]);
+}
 
-  if (!imageFile) {
-    return false;
-  }
+void TGAWriter::setToneMap(ToneMapping mapping, float exposure) {
+  this->toneMapping = mapping;
+  this->exposure = exposure;
+}
 
-  // Addition of the TGA header (source: http://www.codermind.com/)
-  imageFile.put(0).put(0);
-  imageFile.put(2);
+#ifdef __SSE2__
+// Four channels exposed, tone mapped and scaled to 0 - 255
+static inline __m128i toLevels(__m128 x, ToneMapping mapping,
+                               __m128 exposure) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(255.0f);
+  x = _mm_mul_ps(x, exposure);
+  if (mapping == TONE_REINHARD) {
+    x = _mm_div_ps(x, _mm_add_ps(one, _mm_max_ps(x, _mm_setzero_ps())));
+  }
+  return _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(x, scale), scale));
+}
+#endif
+
+/*
+ * Exposes, tone maps, saturates and truncates to bytes, four channels at
+ * a time with SSE2. This is the only place radiance is clamped
+ */
+static void convert(const float *in, unsigned char *out, size_t count,
+                    ToneMapping mapping, float exposure) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128 scale = _mm_set1_ps(exposure);
+  for (; i + 16 <= count; i += 16) {
+    __m128i a = toLevels(_mm_loadu_ps(in + i), mapping, scale);
+    __m128i b = toLevels(_mm_loadu_ps(in + i + 4), mapping, scale);
+    __m128i c = toLevels(_mm_loadu_ps(in + i + 8), mapping, scale);
+    __m128i d = toLevels(_mm_loadu_ps(in + i + 12), mapping, scale);
+    __m128i packed =
+        _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+    _mm_storeu_si128((__m128i *)(out + i), packed);
+  }
+#endif
+  for (; i < count; i++) {
+    float x = max(in[i] * exposure, 0.0f);
+    if (mapping == TONE_REINHARD) {
+      x = x / (1.0f + x);
+    }
+    out[i] = (unsigned char)min(x * 255.0f, 255.0f);
+  }
+}
 
-  imageFile.put(0).put(0);
-  imageFile.put(0).put(0);
-  imageFile.put(0);
+long TGAWriter::storedNear(int x, int y) {
+  // Step out to coarser grids until a stored pixel is found
+  for (int step = 1; step / 2 < max(width, height); step *= 2) {
+    int cx = x - x % step;
+    int cy = y - y % step;
+    if (isStored(cx, cy)) {
+      return (long)slot(cx, cy);
+    }
+  }
+  return -1;
+}
 
-  imageFile.put(0).put(0);
-  imageFile.put(0).put(0);
+void TGAWriter::toBytes(vector<unsigned char> &bytes, bool fill) {
+  bytes.resize((size_t)width * height * 3);
+  if (!fill && shards == 1) {
+    convert(data, bytes.data(), bytes.size(), toneMapping, exposure);
+    return;
+  }
 
-  imageFile.put((unsigned char)(width & 0x00FF))
-      .put((unsigned char)((width & 0xFF00) / 256));
-  imageFile.put((unsigned char)(height & 0x00FF))
-      .put((unsigned char)((height & 0xFF00) / 256));
-  imageFile.put(24);
-  imageFile.put(0);
-  // end of the TGA header
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      long pixel = fill ? storedNear(x, y)
+                        : holds(x, y) ? (long)slot(x, y) : -1;
+      unsigned char *out = &bytes[3 * ((size_t)y * width + x)];
+      if (pixel < 0) {
+        out[0] = out[1] = out[2] = 0;
+      } else {
+        convert(data + 3 * pixel, out, 3, toneMapping, exposure);
+      }
+    }
+  }
+}
 
-  for (int i = 0; i < (width * height * 3); i++) {
-    imageFile.put((unsigned char)min(data[i] * 255.0f, 255.0f));
+void TGAWriter::toBytes(int x0, int y0, int x1, int y1,
+                        vector<unsigned char> &bytes) {
+  size_t rowSize = 3 * (size_t)(x1 - x0);
+  bytes.resize(rowSize * (y1 - y0));
+  // Rows of a tile are kept whole in either layout
+  for (int y = y0; y < y1; y++) {
+    convert(data + 3 * slot(x0, y), &bytes[rowSize * (y - y0)], rowSize,
+            toneMapping, exposure);
   }
+}
 
-  return true;
+void TGAWriter::toFloats(vector<float> &floats, bool fill) {
+  floats.assign((size_t)width * height * 3, 0.0f);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      long pixel = fill ? storedNear(x, y)
+                        : holds(x, y) ? (long)slot(x, y) : -1;
+      if (pixel < 0) {
+        continue;
+      }
+      size_t i = (size_t)y * width + x;
+      floats[3 * i] = data[3 * pixel + 2] * exposure;
+      floats[3 * i + 1] = data[3 * pixel + 1] * exposure;
+      floats[3 * i + 2] = data[3 * pixel] * exposure;
+    }
+  }
 }
 
-TGAWriter::~TGAWriter() { delete data; }
+TGAWriter::~TGAWriter() {
+  delete[] data;
+  delete[] stored;
+}
@@ -2,26 +2,117 @@
 
 #include "Colour.h"
 
-#include <fstream>
+#include <atomic>
 #include <time.h>
+#include <vector>
 
 using namespace std;
 
+// How radiance is brought into the 0 - 1 range of an 8 bit image
+enum ToneMapping {
+  TONE_CLAMP,   // Channels above one saturate
+  TONE_REINHARD // x / (1 + x), compressing highlights instead of clipping
+};
+
 class TGAWriter {
 
   int width;
   int height;
+
+  // A shard of a frame holds only its own tiles, each in a tileSize
+  // square block of its own, so it takes memory for its share of the
+  // frame. A whole frame is held row by row
+  int tileSize;
+  int shard;
+  int shards;
+  int tilesAcross;
+  size_t slots; // Pixels there is room for, including the unused parts
+                // of blocks for tiles cut off by the image's edge
+  size_t held;  // Pixels of the frame the image holds
+
   float *data;
-  int currentPixel;
+  size_t currentPixel;
+  atomic<size_t> pixelCount; // Distinct pixels stored so far, from any thread
+  atomic<bool> *stored;      // Set once each pixel has been stored
+  ToneMapping toneMapping;
+  float exposure; // Scale applied to radiance before tone mapping
+
+  void markStored(size_t slot);
+
+  // Index of the closest stored pixel on a coarser power of two grid
+  // than x, y, or -1 if there is none
+  long storedNear(int x, int y);
 
 public:
-  TGAWriter(int nWidth, int nHeight);
+  // An image holding the whole frame, or with shards above 1 just the
+  // tiles of one shard, as TileScheduler::split gives them
+  TGAWriter(int nWidth, int nHeight, int tileSize = 0, int shard = 0,
+            int shards = 1);
 
   void putNextPixel(float red, float green, float blue);
 
   void putNextPixel(Colour c);
 
-  bool writeImage();
+  // True if the pixel at column x, row y is in the image's shard
+  bool holds(int x, int y) {
+    return shards == 1 ||
+           ((y / tileSize) * tilesAcross + x / tileSize) % shards == shard;
+  }
+
+  // Where the pixel at column x, row y is kept, from 0 to slots(). Only
+  // meaningful for pixels the image holds
+  size_t slot(int x, int y) {
+    if (shards == 1) {
+      return (size_t)y * width + x;
+    }
+    int tile = (y / tileSize) * tilesAcross + x / tileSize;
+    return (size_t)(tile / shards) * tileSize * tileSize +
+           (y % tileSize) * tileSize + x % tileSize;
+  }
+
+  size_t slotCount() { return slots; }
+
+  // Stores a pixel at column x, row y (counted from the bottom)
+  // Safe to call from multiple threads for different pixels
+  void putPixel(int x, int y, Colour c);
+
+  // Colour stored at column x, row y
+  Colour getPixel(int x, int y);
+
+  // True once the pixel at column x, row y has been stored
+  bool isStored(int x, int y) {
+    return holds(x, y) &&
+           stored[slot(x, y)].load(memory_order_acquire);
+  }
+
+  int getWidth() { return width; }
+  int getHeight() { return height; }
+
+  // True once every pixel the image holds has been stored
+  bool complete() { return pixelCount == held; }
+
+  // Sets how toBytes maps radiance, by default it is clamped unscaled
+  void setToneMap(ToneMapping mapping, float exposure);
+
+  /*
+   * Converts the image to 8 bit BGR, bottom row first, as TGA stores it
+   * With fill set it may be called while other threads are still storing
+   * pixels, and missing pixels are filled from the closest stored pixel
+   * on a coarser power of two grid, which suits renders that refine from
+   * coarse to fine. Pixels outside the image's shard are black
+   */
+  void toBytes(vector<unsigned char> &bytes, bool fill);
+
+  // Converts the rectangle [x0, x1) x [y0, y1) to 8 bit BGR, bottom row
+  // first, so a shard is saved a tile at a time. The rectangle must be
+  // within one tile the image holds, or anywhere in a whole frame
+  void toBytes(int x0, int y0, int x1, int y1, vector<unsigned char> &bytes);
+
+  /*
+   * The image as float RGB radiance, bottom row first, scaled by the
+   * exposure but neither clamped nor tone mapped. fill as toBytes
+   */
+  void toFloats(vector<float> &floats, bool fill);
 
   ~TGAWriter();
 };
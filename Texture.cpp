@@ -0,0 +1,196 @@
+#include "Texture.h"
+
+#include <cmath>
+#include <cstring>
+
+// Size of the next level down
+static int halve(int size) { return size > 1 ? size / 2 : 1; }
+
+static int tiles(int size) { return (size + TEXTURE_TILE - 1) / TEXTURE_TILE; }
+
+// Repeats a texel coordinate, mirroring negative coordinates like the
+// original nearest neighbour lookup
+static int wrap(double coordinate, int size) {
+  double positive = fabs(coordinate);
+  if (positive < 2147483647.0) {
+    return (int)positive % size;
+  }
+  return (int)fmod(positive, (double)size);
+}
+
+Texture::Texture() {
+  width = 0;
+  height = 0;
+}
+
+size_t Texture::pyramidSize(int textureWidth, int textureHeight) {
+  size_t size = 0;
+  int w = textureWidth;
+  int h = textureHeight;
+  while (true) {
+    size += (size_t)tiles(w) * tiles(h) * TEXTURE_TILE * TEXTURE_TILE * 4;
+    if (w == 1 && h == 1) {
+      break;
+    }
+    w = halve(w);
+    h = halve(h);
+  }
+  return size;
+}
+
+void Texture::layout(const unsigned char *texels) {
+  levels.clear();
+  int w = width;
+  int h = height;
+  while (true) {
+    TextureLevel level;
+    level.width = w;
+    level.height = h;
+    level.tilesX = tiles(w);
+    level.texels = texels;
+    levels.push_back(level);
+
+    texels += (size_t)tiles(w) * tiles(h) * TEXTURE_TILE * TEXTURE_TILE * 4;
+    if (w == 1 && h == 1) {
+      break;
+    }
+    w = halve(w);
+    h = halve(h);
+  }
+}
+
+const unsigned char *Texture::texel(const TextureLevel &level, int x,
+                                    int y) const {
+  int tile = (y / TEXTURE_TILE) * level.tilesX + x / TEXTURE_TILE;
+  // Interleave the bits of x and y within the tile
+  int within = (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2);
+  return level.texels + (tile * TEXTURE_TILE * TEXTURE_TILE + within) * 4;
+}
+
+void Texture::build(const STGA &tga) {
+  width = max(tga.width, 1);
+  height = max(tga.height, 1);
+
+  // Level 0 in row major RGBA, converted from the TGA's BGR(A) texels
+  vector<unsigned char> current((size_t)width * height * 4, 255);
+  if (tga.data != NULL && tga.width > 0 && tga.height > 0) {
+    size_t count = (size_t)width * height;
+    int stride = tga.byteCount;
+    unsigned char *out = current.data();
+    const unsigned char *in = tga.data;
+    for (size_t i = 0; i < count; i++) {
+      out[4 * i] = in[stride * i + 2];
+      out[4 * i + 1] = in[stride * i + 1];
+      out[4 * i + 2] = in[stride * i];
+      out[4 * i + 3] = stride == 4 ? in[stride * i + 3] : 255;
+    }
+  }
+
+  storage.assign(pyramidSize(width, height), 0);
+  layout(storage.data());
+
+  for (size_t l = 0; l < levels.size(); l++) {
+    TextureLevel &level = levels[l];
+
+    // Swizzle the level into its tiles
+    for (int y = 0; y < level.height; y++) {
+      for (int x = 0; x < level.width; x++) {
+        memcpy((void *)texel(level, x, y),
+               &current[4 * ((size_t)y * level.width + x)], 4);
+      }
+    }
+
+    if (l + 1 == levels.size()) {
+      break;
+    }
+
+    // Box filter down to the next level, odd edges reuse the last texel
+    int nextWidth = levels[l + 1].width;
+    int nextHeight = levels[l + 1].height;
+    vector<unsigned char> next((size_t)nextWidth * nextHeight * 4);
+    for (int y = 0; y < nextHeight; y++) {
+      int y0 = min(2 * y, level.height - 1);
+      int y1 = min(2 * y + 1, level.height - 1);
+      for (int x = 0; x < nextWidth; x++) {
+        int x0 = min(2 * x, level.width - 1);
+        int x1 = min(2 * x + 1, level.width - 1);
+        for (int c = 0; c < 4; c++) {
+          int sum = current[4 * ((size_t)y0 * level.width + x0) + c] +
+                    current[4 * ((size_t)y0 * level.width + x1) + c] +
+                    current[4 * ((size_t)y1 * level.width + x0) + c] +
+                    current[4 * ((size_t)y1 * level.width + x1) + c];
+          next[4 * ((size_t)y * nextWidth + x) + c] =
+              (unsigned char)((sum + 2) / 4);
+        }
+      }
+    }
+    current.swap(next);
+  }
+}
+
+bool Texture::restore(int textureWidth, int textureHeight,
+                      const unsigned char *texels, size_t size) {
+  if (textureWidth < 1 || textureHeight < 1 || texels == NULL ||
+      size != pyramidSize(textureWidth, textureHeight)) {
+    return false;
+  }
+  width = textureWidth;
+  height = textureHeight;
+  storage.clear();
+  layout(texels);
+  return true;
+}
+
+Colour Texture::bilinear(const TextureLevel &level, double u,
+                         double v) const {
+  // Texel centres sit at half texel offsets
+  double x = u * level.width - 0.5;
+  double y = v * level.height - 0.5;
+  double fx = floor(x);
+  double fy = floor(y);
+  float ax = (float)(x - fx);
+  float ay = (float)(y - fy);
+
+  int x0 = wrap(fx, level.width);
+  int x1 = wrap(fx + 1, level.width);
+  int y0 = wrap(fy, level.height);
+  int y1 = wrap(fy + 1, level.height);
+
+  const unsigned char *t00 = texel(level, x0, y0);
+  const unsigned char *t10 = texel(level, x1, y0);
+  const unsigned char *t01 = texel(level, x0, y1);
+  const unsigned char *t11 = texel(level, x1, y1);
+
+  float w00 = (1 - ax) * (1 - ay);
+  float w10 = ax * (1 - ay);
+  float w01 = (1 - ax) * ay;
+  float w11 = ax * ay;
+
+  float rgb[3];
+  for (int c = 0; c < 3; c++) {
+    rgb[c] = (t00[c] * w00 + t10[c] * w10 + t01[c] * w01 + t11[c] * w11) /
+             255.0f;
+  }
+  return Colour(rgb[0], rgb[1], rgb[2]);
+}
+
+Colour Texture::sample(double u, double v, double footprintU,
+                       double footprintV) const {
+  // Level where one texel covers the footprint
+  double texels = max(footprintU * width, footprintV * height);
+  double lod = log2(max(texels, 1e-12));
+  int last = (int)levels.size() - 1;
+
+  if (lod <= 0 || last == 0) {
+    return bilinear(levels[0], u, v);
+  }
+  if (lod >= last) {
+    return bilinear(levels[last], u, v);
+  }
+
+  // Trilinear, blending the two closest levels
+  int level = (int)lod;
+  double blend = lod - level;
+  return bilinear(levels[level], u, v) * (1 - blend) +
+         bilinear(levels[level + 1], u, v) * blend;
+}
@@ -0,0 +1,83 @@
+/*
+ * Texture.h
+ * Contains the Texture class, a mip mapped texture sampled with
+ * bilinear or trilinear filtering.
+ *
+ * Each level is stored in 4x4 texel tiles of RGBA bytes, so a tile fills
+ * one 64 byte cache line, with the texels of a tile in Morton order. The
+ * four texels of a bilinear lookup then usually share a cache line, where
+ * a row major layout spreads them over two rows of the image.
+ */
+
+#pragma once
+
+#include "Colour.h"
+#include "TGAReader.h"
+
+#include <stddef.h>
+#include <vector>
+
+using namespace std;
+
+// Tile edge length in texels
+#define TEXTURE_TILE 4
+
+struct TextureLevel {
+  int width;
+  int height;
+  int tilesX; // Tiles per row
+  const unsigned char *texels;
+};
+
+class Texture {
+  int width;
+  int height;
+  vector<TextureLevel> levels;  // Largest first, down to 1x1
+  vector<unsigned char> storage; // Texels, unless they are used in place
+
+  // Levels point into the texels, so textures can't be copied
+  Texture(const Texture &);
+  Texture &operator=(const Texture &);
+
+  // Points each level at its part of the texels
+  void layout(const unsigned char *texels);
+
+  // Address of the texel at x, y of a level
+  const unsigned char *texel(const TextureLevel &level, int x, int y) const;
+
+  Colour bilinear(const TextureLevel &level, double u, double v) const;
+
+public:
+  Texture();
+
+  // Builds the mip pyramid of a decoded TGA, filtering each level down
+  // from the one above with a 2x2 box filter
+  void build(const STGA &tga);
+
+  /*
+   * Uses a pyramid saved from data(), without copying it
+   * The texels must outlive the texture
+   */
+  bool restore(int textureWidth, int textureHeight,
+               const unsigned char *texels, size_t size);
+
+  // Bytes of texels in the pyramid of a texture of the given size
+  static size_t pyramidSize(int textureWidth, int textureHeight);
+
+  const unsigned char *data() const { return levels[0].texels; }
+  size_t size() const { return pyramidSize(width, height); }
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  int levelCount() const { return (int)levels.size(); }
+
+  /*
+   * Colour at u, v, repeating outside 0 - 1
+   * footprintU and footprintV are the width of the area one sample covers
+   * along u and along v. The wider in texels picks the mip levels to
+   * blend, a footprint of a texel or less is a bilinear lookup in the
+   * full size texture
+   */
+  Colour sample(double u, double v, double footprintU,
+                double footprintV) const;
+};
@@ -0,0 +1,140 @@
+#include "TextureCache.h"
+#include "Stats.h"
+
+#include <chrono>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+TextureCache &TextureCache::instance() {
+  static TextureCache cache;
+  return cache;
+}
+
+int TextureCache::find(const string &file) {
+  for (size_t i = 0; i < textures.size(); i++) {
+    if (textures[i]->file == file) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+int TextureCache::load(const char *filename) {
+  lock_guard<mutex> guard(lock);
+
+  int handle = find(filename);
+  if (handle >= 0) {
+    return handle;
+  }
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  // The file is only needed until the pyramid is built
+  MappedFile file;
+  STGA tga;
+  vector<unsigned char> decoded;
+  if (!file.open(filename) ||
+      !readTGA(file.data(), file.size(), tga, decoded)) {
+    cout << "Can't load texture " << filename << endl;
+    return -1;
+  }
+
+  Entry *entry = new Entry();
+  entry->file = filename;
+  entry->texture.build(tga);
+
+  textures.push_back(entry);
+  Stats::addPhase("texture load", chrono::duration<double>(
+                                      chrono::steady_clock::now() - start)
+                                      .count());
+  return (int)textures.size() - 1;
+}
+
+int TextureCache::add(const string &file, int width, int height,
+                      const unsigned char *texels, size_t size,
+                      shared_ptr<MappedFile> mapping) {
+  lock_guard<mutex> guard(lock);
+
+  int handle = find(file);
+  if (handle >= 0) {
+    return handle;
+  }
+
+  Entry *entry = new Entry();
+  entry->file = file;
+  entry->mapping = mapping;
+  if (!entry->texture.restore(width, height, texels, size)) {
+    delete entry;
+    return -1;
+  }
+
+  textures.push_back(entry);
+  return (int)textures.size() - 1;
+}
+
+const Texture *TextureCache::get(int handle) {
+  lock_guard<mutex> guard(lock);
+  return &textures[handle]->texture;
+}
+
+const string &TextureCache::file(int handle) {
+  lock_guard<mutex> guard(lock);
+  return textures[handle]->file;
+}
+
+/*
+ * Mapped texels are only resident once they have been touched, so the
+ * kernel is asked which of their pages are in memory
+ */
+size_t TextureCache::resident(int handle) {
+  lock_guard<mutex> guard(lock);
+  const Texture &texture = textures[handle]->texture;
+
+  if (textures[handle]->mapping == NULL) {
+    return texture.size();
+  }
+
+  size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  size_t start = (size_t)texture.data() & ~(pageSize - 1);
+  size_t end = (size_t)texture.data() + texture.size();
+  size_t pages = (end - start + pageSize - 1) / pageSize;
+
+  vector<unsigned char> inCore(pages);
+  if (pages == 0 || mincore((void *)start, end - start, inCore.data()) != 0) {
+    return 0;
+  }
+
+  size_t resident = 0;
+  for (size_t i = 0; i < pages; i++) {
+    if (inCore[i] & 1) {
+      resident += pageSize;
+    }
+  }
+  return min(resident, texture.size());
+}
+
+void TextureCache::report(ostream &out) {
+  size_t count;
+  {
+    lock_guard<mutex> guard(lock);
+    count = textures.size();
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    Entry *entry = textures[i];
+    out << entry->file << ": " << entry->texture.getWidth() << "x"
+        << entry->texture.getHeight() << ", "
+        << entry->texture.levelCount() << " levels, "
+        << (entry->mapping == NULL ? "built" : "mapped") << ", "
+        << resident((int)i) / 1024 << " of " << entry->texture.size() / 1024
+        << " KB resident" << endl;
+  }
+}
+
+TextureCache::~TextureCache() {
+  for (vector<Entry *>::iterator it = textures.begin(); it != textures.end();
+       it++) {
+    delete *it;
+  }
+}
@@ -0,0 +1,72 @@
+/*
+ * TextureCache.h
+ * Contains the TextureCache class, which holds every texture used by the
+ * process. Each file is loaded once and shared by every material using it,
+ * materials refer to textures by handle.
+ *
+ * TGA files are memory mapped while their mip pyramid is built. Compiled
+ * scenes hold built pyramids, which are mapped and used in place so only
+ * the pages actually sampled are ever read from disk.
+ */
+
+#pragma once
+
+#include "MappedFile.h"
+#include "TGAReader.h"
+#include "Texture.h"
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class TextureCache {
+  struct Entry {
+    string file;
+    Texture texture;
+    shared_ptr<MappedFile> mapping; // Holds the texels, if they are mapped
+  };
+
+  // Textures are never removed, so handles and pointers stay valid
+  vector<Entry *> textures;
+  mutex lock;
+
+  TextureCache() {}
+  TextureCache(const TextureCache &);
+  TextureCache &operator=(const TextureCache &);
+
+  // Handle of an already loaded file, or -1. Caller holds the lock
+  int find(const string &file);
+
+public:
+  // The cache shared by the whole process
+  static TextureCache &instance();
+
+  // Returns the handle for a TGA file, loading it if it's not cached yet
+  // Returns -1 if the file can't be read
+  int load(const char *filename);
+
+  /*
+   * Adds a texture from a mip pyramid already in memory, kept alive by
+   * mapping. Used by compiled scenes, returns -1 if the pyramid is invalid
+   */
+  int add(const string &file, int width, int height,
+          const unsigned char *texels, size_t size,
+          shared_ptr<MappedFile> mapping);
+
+  // The texture for a handle, valid for the life of the process
+  const Texture *get(int handle);
+
+  const string &file(int handle);
+
+  // Bytes of the texture currently held in memory
+  size_t resident(int handle);
+
+  // Prints the size and resident memory of every texture
+  void report(ostream &out);
+
+  ~TextureCache();
+};
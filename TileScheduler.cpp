@@ -0,0 +1,111 @@
+#include "TileScheduler.h"
+
+#include <algorithm>
+#include <thread>
+
+vector<Tile> TileScheduler::split(int width, int height, int tileSize,
+                                  int shard, int shards) {
+  tileSize = max(tileSize, 1);
+  shards = max(shards, 1);
+
+  int tilesX = (width + tileSize - 1) / tileSize;
+  int tilesY = (height + tileSize - 1) / tileSize;
+
+  vector<Tile> tiles;
+  int index = 0;
+  for (int ty = 0; ty < tilesY; ty++) {
+    for (int tx = 0; tx < tilesX; tx++, index++) {
+      if (index % shards != shard) {
+        continue;
+      }
+      Tile tile;
+      tile.x0 = tx * tileSize;
+      tile.y0 = ty * tileSize;
+      tile.x1 = min(tile.x0 + tileSize, width);
+      tile.y1 = min(tile.y0 + tileSize, height);
+      tile.index = index;
+      tiles.push_back(tile);
+    }
+  }
+  return tiles;
+}
+
+TileScheduler::TileScheduler(int width, int height, int tileSize, int workers,
+                             int shard, int shards) {
+  workers = max(workers, 1);
+
+  for (int i = 0; i < workers; i++) {
+    queues.push_back(new WorkQueue());
+  }
+
+  vector<Tile> tiles = split(width, height, tileSize, shard, shards);
+  tileCount = (int)tiles.size();
+
+  // Deal out contiguous runs of tiles so each worker starts on
+  // neighbouring parts of the image, stealing evens out the rest
+  for (int i = 0; i < tileCount; i++) {
+    int owner = (int)(((long)i * workers) / tileCount);
+    // Owners pop from the back, so push front to keep scanline order
+    queues[owner]->tiles.push_front(tiles[i]);
+  }
+}
+
+bool TileScheduler::popLocal(int worker, Tile &tile) {
+  WorkQueue *queue = queues[worker];
+  lock_guard<mutex> guard(queue->lock);
+  if (queue->tiles.empty()) {
+    return false;
+  }
+  tile = queue->tiles.back();
+  queue->tiles.pop_back();
+  return true;
+}
+
+/*
+ * Steals from the front of the other queues, which holds the work
+ * furthest from what their owner is currently rendering
+ */
+bool TileScheduler::steal(int worker, Tile &tile) {
+  int count = (int)queues.size();
+  for (int i = 1; i < count; i++) {
+    WorkQueue *victim = queues[(worker + i) % count];
+    lock_guard<mutex> guard(victim->lock);
+    if (!victim->tiles.empty()) {
+      tile = victim->tiles.front();
+      victim->tiles.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TileScheduler::nextTile(int worker, Tile &tile) {
+  // No tiles are ever added after construction, so once every queue
+  // is empty the work is done
+  return popLocal(worker, tile) || steal(worker, tile);
+}
+
+void TileScheduler::run(function<void(int, const Tile &)> work) {
+  vector<thread> threads;
+
+  for (int w = 0; w < (int)queues.size(); w++) {
+    threads.push_back(thread([this, w, &work]() {
+      Tile tile;
+      while (nextTile(w, tile)) {
+        work(w, tile);
+      }
+    }));
+  }
+
+  for (vector<thread>::iterator it = threads.begin(); it != threads.end();
+       it++) {
+    it->join();
+  }
+}
+
+TileScheduler::~TileScheduler() {
+  for (vector<WorkQueue *>::iterator it = queues.begin(); it != queues.end();
+       it++) {
+    delete *it;
+  }
+}
@@ -0,0 +1,71 @@
+/*
+ * TileScheduler.h
+ * Contains the TileScheduler class, which splits an image into tiles
+ * and hands them out to a pool of worker threads.
+ *
+ * Each worker owns a deque of tiles. A worker takes tiles from the back
+ * of its own deque, and when that is empty steals from the front of
+ * another worker's deque, so threads that finish early keep busy.
+ */
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Tile
+ * A rectangle of pixels, covering [x0, x1) and [y0, y1)
+ */
+struct Tile {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+  int index; // Position of the tile in scanline order
+};
+
+class TileScheduler {
+
+  // A worker's queue of tiles, guarded by its own lock
+  struct WorkQueue {
+    mutex lock;
+    deque<Tile> tiles;
+  };
+
+  vector<WorkQueue *> queues;
+  int tileCount;
+
+  bool popLocal(int worker, Tile &tile);
+  bool steal(int worker, Tile &tile);
+
+public:
+  /*
+   * Splits a width x height image into tileSize square tiles, in
+   * scanline order. Frames split across processes give each shard every
+   * shards'th tile, so every process gets a share of each part of the
+   * image. Tiles keep their index in the whole frame.
+   */
+  static vector<Tile> split(int width, int height, int tileSize,
+                            int shard = 0, int shards = 1);
+
+  // Schedules the tiles of one shard of a width x height image
+  TileScheduler(int width, int height, int tileSize, int workers,
+                int shard = 0, int shards = 1);
+
+  // Gets the next tile for a worker, returns false when all work is done
+  bool nextTile(int worker, Tile &tile);
+
+  // Runs work(worker, tile) for every tile across all workers,
+  // returning once every tile has been processed
+  void run(function<void(int, const Tile &)> work);
+
+  int tiles() { return tileCount; }
+  int workers() { return (int)queues.size(); }
+
+  ~TileScheduler();
+};
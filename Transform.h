@@ -0,0 +1,90 @@
+/*
+ * Transform.h
+ * Placement of an instance: a uniform scale, then a rotation, then a
+ * translation from object space into the world.
+ *
+ * Keeping the scale uniform means directions stay unit length through
+ * the rotation, and normals transform by the rotation alone.
+ */
+
+#pragma once
+
+#include "GeomX.h"
+#include "pi.h"
+
+#include <cmath>
+
+struct Transform {
+  double rotation[3][3]; // Object to world
+  Point3 position;
+  double scale;
+
+  // Leaves objects where they are
+  Transform() : position(0, 0, 0), scale(1) {
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        rotation[i][j] = i == j ? 1 : 0;
+      }
+    }
+  }
+
+  /*
+   * Rotates by degrees about the x, then y, then z axis, scales by
+   * scale, and moves the object's origin to position
+   */
+  Transform(Point3 position, Vector3 degrees, double scale) {
+    double angles[3] = {degrees.getXDir() * PI / 180,
+                        degrees.getYDir() * PI / 180,
+                        degrees.getZDir() * PI / 180};
+    double c[3], s[3];
+    for (int a = 0; a < 3; a++) {
+      c[a] = cos(angles[a]);
+      s[a] = sin(angles[a]);
+    }
+
+    // Rz * Ry * Rx
+    rotation[0][0] = c[2] * c[1];
+    rotation[0][1] = c[2] * s[1] * s[0] - s[2] * c[0];
+    rotation[0][2] = c[2] * s[1] * c[0] + s[2] * s[0];
+    rotation[1][0] = s[2] * c[1];
+    rotation[1][1] = s[2] * s[1] * s[0] + c[2] * c[0];
+    rotation[1][2] = s[2] * s[1] * c[0] - c[2] * s[0];
+    rotation[2][0] = -s[1];
+    rotation[2][1] = c[1] * s[0];
+    rotation[2][2] = c[1] * c[0];
+
+    this->position = position;
+    this->scale = scale;
+  }
+
+  Vector3 rotate(Vector3 v) const {
+    double x = v.getXDir(), y = v.getYDir(), z = v.getZDir();
+    return Vector3(rotation[0][0] * x + rotation[0][1] * y + rotation[0][2] * z,
+                   rotation[1][0] * x + rotation[1][1] * y + rotation[1][2] * z,
+                   rotation[2][0] * x + rotation[2][1] * y + rotation[2][2] * z);
+  }
+
+  // The inverse rotation is its transpose
+  Vector3 unrotate(Vector3 v) const {
+    double x = v.getXDir(), y = v.getYDir(), z = v.getZDir();
+    return Vector3(rotation[0][0] * x + rotation[1][0] * y + rotation[2][0] * z,
+                   rotation[0][1] * x + rotation[1][1] * y + rotation[2][1] * z,
+                   rotation[0][2] * x + rotation[1][2] * y + rotation[2][2] * z);
+  }
+
+  Point3 toWorld(Point3 p) const {
+    return position + rotate(Vector3(p) * scale);
+  }
+
+  Point3 toObject(Point3 p) const {
+    return Point3(unrotate(p - position) / scale);
+  }
+
+  /*
+   * A world ray in object space. The direction stays unit length, so
+   * distances along it are the world distances divided by scale
+   */
+  Ray3 toObject(const Ray3 &r) const {
+    return Ray3(toObject(r.startP()), unrotate(r.directionV()));
+  }
+};
@@ -30,3 +30,5 @@ Ray3 View::createRay(float column, float row) {
 
   return ray;
 }
+
+double View::pixelAngle() { return 2 * tan(((fov / 2.0) * PI) / 180) / width; }
@@ -34,4 +34,7 @@ public:
 
   // Generates a ray within the viewplane
   Ray3 createRay(float column, float row);
+
+  // Angle between the rays of neighbouring pixels, in radians
+  double pixelAngle();
 };
@@ -0,0 +1,258 @@
+#include "Wavefront.h"
+
+#include <algorithm>
+
+void Wavefront::RayQueue::push(const Branch &branch, int path) {
+  this->branch.push_back(branch);
+  this->path.push_back(path);
+}
+
+void Wavefront::RayQueue::clear() {
+  branch.clear();
+  path.clear();
+}
+
+void Wavefront::HitQueue::clear() {
+  path.clear();
+  hit.clear();
+  branch.clear();
+  firstChoice.clear();
+  footprint.clear();
+}
+
+Wavefront::Wavefront() {
+  this->scene = NULL;
+  this->spread = 0;
+}
+
+void Wavefront::begin(Scene *scene, const RenderSettings &settings,
+                      double spread) {
+  this->scene = scene;
+  this->settings = settings;
+  this->spread = spread;
+  clear();
+}
+
+int Wavefront::add(Ray3 ray, double coef) {
+  int path = (int)colours.size();
+  colours.push_back(Colour(0.0, 0.0, 0.0));
+  rays.push(rootBranch(ray, coef, settings), path);
+  return path;
+}
+
+void Wavefront::clear() {
+  colours.clear();
+  rays.clear();
+  next.clear();
+  hits.clear();
+}
+
+void Wavefront::trace() {
+  threadStats.primaryRays += rays.size();
+
+  for (int bounce = 0; rays.size() > 0; bounce++) {
+    sortByDirection();
+    intersect(bounce);
+    shadow();
+    shade();
+    branch(bounce);
+
+    swap(rays, next);
+    next.clear();
+  }
+}
+
+/*
+ * A counting sort on the sign of each direction component, which keeps
+ * rays in the order they were queued within an octant. Camera rays are
+ * already coherent and all but always fall in one or two octants.
+ */
+void Wavefront::sortByDirection() {
+  int count = rays.size();
+  int start[9] = {0};
+  octants.resize(count);
+  for (int i = 0; i < count; i++) {
+    Vector3 d = rays.branch[i].ray.directionV();
+    octants[i] = (char)((d.getXDir() < 0 ? 1 : 0) | (d.getYDir() < 0 ? 2 : 0) |
+                        (d.getZDir() < 0 ? 4 : 0));
+    start[octants[i] + 1]++;
+  }
+  for (int i = 1; i < 9; i++) {
+    start[i] += start[i - 1];
+  }
+
+  order.resize(count);
+  for (int i = 0; i < count; i++) {
+    order[start[(int)octants[i]]++] = i;
+  }
+}
+
+/*
+ * Rays are traced in packets in sorted order. As in the packet renderer,
+ * each hit is refined in double precision, falling back to a single ray
+ * if the packet's single precision hit doesn't hold up. Rays that miss
+ * end here, and the hits of the rest are queued in the same order.
+ */
+void Wavefront::intersect(int bounce) {
+  hits.clear();
+  int count = rays.size();
+  for (int first = 0; first < count; first += PACKET_SIZE) {
+    RayPacket packet;
+    int lanes = min(PACKET_SIZE, count - first);
+    for (int lane = 0; lane < lanes; lane++) {
+      packet.set(lane, rays.branch[order[first + lane]].ray);
+    }
+
+    scene->closestHit(packet);
+
+    for (int lane = 0; lane < lanes; lane++) {
+      int i = order[first + lane];
+      const Branch &branch = rays.branch[i];
+      int path = rays.path[i];
+      if (bounce > 0) {
+        if (branch.refracted) {
+          threadStats.refractionRays++;
+        } else {
+          threadStats.reflectionRays++;
+        }
+      }
+
+      const Ray3 &ray = packet.rays[lane];
+      Hit hit;
+      if (packet.shape[lane] != NULL) {
+        hit.t = packet.shape[lane]->intersectPrimitive(ray, hit.primitive);
+        if (hit.t > 0) {
+          packet.shape[lane]->completeHit(ray, hit);
+        } else {
+          scene->closestHit(ray, hit);
+        }
+      }
+
+      if (hit.shape == NULL) {
+        if (branch.seesSky) {
+          colours[path] = colours[path] + (SKY_COLOUR * branch.weight);
+        }
+        countDepth(bounce);
+        continue;
+      }
+
+      // Width of the sample's cone where it meets the surface, stretched
+      // as the surface turns away from the ray
+      double footprint = spread * (branch.distance + hit.t) /
+                         max(fabs(dot(ray.directionV(), hit.normal)), 0.01);
+
+      hits.path.push_back(path);
+      hits.hit.push_back(hit);
+      hits.branch.push_back(branch);
+      hits.footprint.push_back(footprint);
+    }
+  }
+}
+
+/*
+ * Chooses the lights for every hit, then tests the chosen hits against
+ * one light before moving to the next, so the last occluder of each
+ * light is usually the next ray's blocker too
+ */
+void Wavefront::shadow() {
+  LightTree &lightTree = scene->getLightTree();
+  int lightCount = lightTree.size();
+
+  choices.clear();
+  choiceHit.clear();
+  for (int h = 0; h < hits.size(); h++) {
+    lightTree.choose(hits.hit[h].point, hits.hit[h].normal,
+                     hits.branch[h].ray, settings.maxLights, chosen);
+    hits.firstChoice.push_back((int)choices.size());
+    choices.insert(choices.end(), chosen.begin(), chosen.end());
+    choiceHit.insert(choiceHit.end(), chosen.size(), h);
+  }
+  hits.firstChoice.push_back((int)choices.size());
+
+  // A counting sort groups the choices by light, keeping hit order
+  int count = (int)choices.size();
+  lightStart.assign(lightCount + 1, 0);
+  for (int c = 0; c < count; c++) {
+    lightStart[choices[c].light + 1]++;
+  }
+  for (int l = 1; l <= lightCount; l++) {
+    lightStart[l] += lightStart[l - 1];
+  }
+  byLight.resize(count);
+  for (int c = 0; c < count; c++) {
+    byLight[lightStart[choices[c].light]++] = c;
+  }
+
+  Shape *lastOccluder = NULL;
+  int lastLight = -1;
+  for (int k = 0; k < count; k++) {
+    int c = byLight[k];
+    int l = choices[c].light;
+    if (l != lastLight) {
+      lastOccluder = NULL;
+      lastLight = l;
+    }
+
+    int h = choiceHit[c];
+    choices[c].weight *= scene->visibility(
+        lightTree.light(l), hits.hit[h].point, hits.branch[h].ray,
+        settings.shadowSamples, &lastOccluder);
+  }
+}
+
+/*
+ * Hits are shaded grouped by shape, so the same material and texture
+ * are used for a run of hits. Each hit sums its lights in the order they
+ * were chosen, so colours match the depth first renderer.
+ */
+void Wavefront::shade() {
+  // Keyed by shape then hit, so the sort is stable without the buffer
+  // stable_sort would allocate
+  byShape.resize(hits.size());
+  for (int h = 0; h < hits.size(); h++) {
+    byShape[h] = make_pair(hits.hit[h].shape, h);
+  }
+  sort(byShape.begin(), byShape.end());
+
+  const LightTable &table = scene->getLightTree().table();
+  for (int k = 0; k < hits.size(); k++) {
+    int h = byShape[k].second;
+    int path = hits.path[h];
+    const Hit &hit = hits.hit[h];
+    const Branch &branch = hits.branch[h];
+    Vector3 view = -branch.ray.directionV();
+    double surfaceCoef = branch.weight * hit.shape->getMaterial().opacity();
+
+    int first = hits.firstChoice[h];
+    int end = hits.firstChoice[h + 1];
+    for (int c = first; c < end; c++) {
+      countShading(choices[c].light);
+    }
+
+    double diffuse, specular;
+    table.shade(hit.point, hit.normal, view,
+                hit.shape->getMaterial().shininess(), choices.data() + first,
+                end - first, diffuse, specular);
+    colours[path] =
+        colours[path] + (hit.shape->getShaded(hit, table.ambient(), diffuse,
+                                              specular, hits.footprint[h]) *
+                         surfaceCoef);
+  }
+}
+
+/*
+ * Rays whose tree may still grow queue their reflection and refraction
+ * for the next bounce, the rest end here
+ */
+void Wavefront::branch(int bounce) {
+  for (int h = 0; h < hits.size(); h++) {
+    Branch children[2];
+    int count = splitBranch(hits.branch[h], hits.hit[h], settings, children);
+    if (count == 0) {
+      countDepth(bounce + 1);
+    }
+    for (int i = 0; i < count; i++) {
+      next.push(children[i], hits.path[h]);
+    }
+  }
+}
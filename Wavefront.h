@@ -0,0 +1,116 @@
+/*
+ * Wavefront.h
+ * Contains the Wavefront class, which traces a batch of paths together
+ * one stage at a time rather than following each path to its end.
+ *
+ * Every bounce runs as separate passes over the whole batch:
+ *
+ *   intersect  rays sorted by direction octant, traced in SIMD packets.
+ *              Rays that miss end here, the hits of the rest are queued
+ *              in order, so later stages only see rays that hit
+ *   shadow     lights that reach each hit are chosen, then shadow tested
+ *              one light at a time over every hit
+ *   shade      hits sorted by shape, so each material's data stays hot,
+ *              each lit by all of its lights in one LightTable pass
+ *   branch     surviving rays queue their reflections and refractions
+ *              for the next bounce
+ *
+ * Each pass runs one kernel over the whole queue, instead of interleaving
+ * intersection, shadow tests and shading per pixel. Rays are queued whole
+ * and laid out one array per field in the packets the intersection
+ * kernels read.
+ */
+
+#pragma once
+
+#include "GeomX.h"
+#include "Illumination.h"
+#include "RayPacket.h"
+#include "RayTree.h"
+#include "RenderSettings.h"
+#include "Scene.h"
+#include "Shapes.h"
+
+#include <vector>
+
+using namespace std;
+
+class Wavefront {
+
+  // Rays waiting to be intersected
+  struct RayQueue {
+    vector<Branch> branch; // The ray and its place in its path's tree
+    vector<int> path;      // Path, the camera ray whose tree the ray is in
+
+    void push(const Branch &branch, int path);
+    int size() const { return (int)path.size(); }
+    void clear();
+  };
+
+  // Rays that hit a surface, waiting for shadows and shading
+  struct HitQueue {
+    vector<int> path;
+    vector<Hit> hit;
+    vector<Branch> branch; // The ray that made the hit
+    vector<double> footprint;
+
+    // Lights chosen for each hit, [firstChoice[h], firstChoice[h + 1])
+    // of choices
+    vector<int> firstChoice;
+
+    int size() const { return (int)path.size(); }
+    void clear();
+  };
+
+  Scene *scene;
+  RenderSettings settings;
+  double spread; // Angle covered by one sample, for texture filtering
+
+  // Colour so far of every sample, gathered from all of its rays
+  vector<Colour> colours;
+
+  RayQueue rays;
+  RayQueue next; // Reflections and refractions, traced in the next bounce
+  HitQueue hits;
+
+  vector<LightChoice> choices; // Of every hit in turn, weighted by shadows
+  vector<int> byLight;         // Choice indices grouped by light
+  vector<int> choiceHit;       // Hit each choice was made for
+  vector<LightChoice> chosen;  // Scratch for one hit's choices
+  vector<int> order;           // Scratch order for sorting a queue
+  vector<char> octants;        // Scratch direction octant of each ray
+  vector<int> lightStart;      // Scratch first choice of each light
+  vector<pair<Shape *, int>> byShape; // Scratch hits keyed by shape
+
+  // Sorts rays into the order they are intersected, grouped by the
+  // octant of their direction so packets stay coherent
+  void sortByDirection();
+
+  // The stages of one bounce
+  void intersect(int bounce);
+  void shadow();
+  void shade();
+  void branch(int bounce);
+
+public:
+  /*
+   * Every queue keeps its memory from batch to batch, so a renderer
+   * thread keeps one Wavefront and starts each tile's batch with begin
+   */
+  Wavefront();
+
+  // Starts an empty batch of paths through scene
+  void begin(Scene *scene, const RenderSettings &settings, double spread);
+
+  // Queues a camera ray weighted by coef, returning its path's index
+  int add(Ray3 ray, double coef);
+
+  // Traces every queued path and its ray tree to the end
+  void trace();
+
+  // Colour of a traced path
+  Colour colour(int path) { return colours[path]; }
+
+  // Forgets every path, keeping the memory for the next batch
+  void clear();
+};
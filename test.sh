@@ -0,0 +1,140 @@
+#!/bin/sh
+#
+# test.sh
+# Checks raxar's command line behaviour end to end, run with `make test`
+#
+# Each test prints its name and PASS or FAIL, and the script exits with
+# the number of failures.
+
+RAXAR=./raxar
+DIR=$(mktemp -d)
+FAILURES=0
+
+trap 'rm -rf "$DIR"' EXIT
+
+pass() {
+  echo "PASS $1"
+}
+
+fail() {
+  echo "FAIL $1: $2"
+  FAILURES=$((FAILURES + 1))
+}
+
+# A shard rendering progressively must only ever write its own
+# .shard file, never the frame's output file or that file's .part
+test_shard_previews() {
+  name="shard with previews leaves the output path alone"
+  out="$DIR/shard.tga"
+  $RAXAR -t 1 -k 0/2 -r 0.01 -o "$out" > "$DIR/shard.log" 2>&1 &
+  pid=$!
+  seen=""
+  while kill -0 $pid 2> /dev/null; do
+    if [ -e "$out" ] || [ -e "$out.part" ]; then
+      seen=yes
+    fi
+  done
+  if ! wait $pid; then
+    fail "$name" "raxar exited with an error"
+  elif [ -n "$seen" ] || [ -e "$out" ]; then
+    fail "$name" "$out was written"
+  elif [ ! -s "$out.shard0" ]; then
+    fail "$name" "$out.shard0 is missing"
+  else
+    pass "$name"
+  fi
+}
+
+# Writes a binary PLY file with the given vertex count in its header,
+# followed by one vertex and one triangle
+write_ply() {
+  {
+    printf 'ply\nformat binary_little_endian 1.0\n'
+    printf 'element vertex %s\n' "$2"
+    printf 'property float x\nproperty float y\nproperty float z\n'
+    printf 'element face 1\nproperty list uchar int vertex_indices\n'
+    printf 'end_header\n'
+    printf '\000\000\000\000\000\000\000\000\000\000\000\000'
+    printf '\003\000\000\000\000\000\000\000\000\000\000\000\000'
+  } > "$1"
+}
+
+# A malformed PLY header must be reported as a load error, not crash
+test_ply_header() {
+  name="PLY header with vertex count $1 is rejected"
+  write_ply "$DIR/bad.ply" "$1"
+  $RAXAR -t 1 -m "$DIR/bad.ply" -o "$DIR/bad.tga" > "$DIR/ply.log" 2>&1
+  status=$?
+  if [ $status -ne 1 ]; then
+    fail "$name" "raxar exited with $status"
+  elif ! grep -q "Error loading mesh" "$DIR/ply.log"; then
+    fail "$name" "no load error was reported"
+  else
+    pass "$name"
+  fi
+}
+
+# The same file with a correct header loads
+test_ply_loads() {
+  name="PLY header with vertex count 1 loads"
+  write_ply "$DIR/good.ply" 1
+  if ! $RAXAR -t 1 -m "$DIR/good.ply" -o "$DIR/good.tga" > "$DIR/ply.log" \
+      2>&1; then
+    fail "$name" "raxar exited with an error"
+  elif ! grep -q "1 triangles" "$DIR/ply.log"; then
+    fail "$name" "the triangle wasn't loaded"
+  else
+    pass "$name"
+  fi
+}
+
+# Every mode traces a pixel's samples with the same jitter, so a jittered
+# render with the given flags must match a normal render byte for byte
+test_jitter_matches() {
+  name="jittered render with $* matches a normal render"
+  if ! $RAXAR -j -a 1 -o "$DIR/normal.tga" > "$DIR/jitter.log" 2>&1 ||
+      ! $RAXAR -j -a 1 "$@" -o "$DIR/mode.tga" > "$DIR/jitter.log" 2>&1; then
+    fail "$name" "raxar exited with an error"
+  elif ! cmp -s "$DIR/normal.tga" "$DIR/mode.tga"; then
+    fail "$name" "the images differ"
+  else
+    pass "$name"
+  fi
+}
+
+# A scene whose last line is the given statement must fail to parse with
+# an error naming that line. The scene before it places an object once
+# and opens a polyhedron if the second argument is "polyhedron"
+test_move_rejected() {
+  name="key move $2 is rejected"
+  {
+    printf 'frames 2\nmaterial M 1 1 1 0 0 0 0 0 1 1\n'
+    if [ "$2" = "polyhedron" ]; then
+      printf 'polyhedron M\nface 0 0 0 1 0 0 0 1 0\n'
+    else
+      printf 'object ball\nsphere 0 0 0 1 M\n'
+    fi
+    printf '%s\n' "$1"
+  } > "$DIR/move.scene"
+  $RAXAR -t 1 -f "$DIR/move.scene" -o "$DIR/move.tga" > "$DIR/move.log" 2>&1
+  status=$?
+  if [ $status -ne 1 ]; then
+    fail "$name" "raxar exited with $status"
+  elif ! grep -q "move.scene:5:" "$DIR/move.log"; then
+    fail "$name" "the error doesn't name line 5"
+  else
+    pass "$name"
+  fi
+}
+
+test_shard_previews
+test_move_rejected "key move 1 0 1 0" object
+test_move_rejected "key move 1 0 1 0" polyhedron
+test_jitter_matches -r 0.05
+test_jitter_matches -p
+test_ply_loads
+test_ply_header -5
+test_ply_header 1000000
+test_ply_header 12abc
+
+exit $FAILURES